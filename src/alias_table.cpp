@@ -0,0 +1,88 @@
+#include "alias_table.h"
+
+#include <algorithm>
+#include <limits>
+
+namespace {
+    // negative and NaN weights are never picked
+    inline double usableWeight(double weight) {
+        return weight > 0.0 ? weight : 0.0;
+    }
+}
+
+AliasTable::AliasTable() { }
+AliasTable::~AliasTable() { }
+
+void AliasTable::clear() {
+    bins_.clear();
+}
+
+void AliasTable::build(std::vector<double> const& weights) {
+    clear();
+
+    double total = 0.0;
+    for (double weight : weights) {
+        total += usableWeight(weight);
+    }
+
+    if (!(total > 0.0)) {
+        return;
+    }
+
+    const std::size_t n = weights.size();
+    bins_.resize(n);
+
+    // weights scaled so the average bin holds exactly 1
+    std::vector<double> scaled(n);
+    std::vector<std::size_t> small, large;
+    for (std::size_t i = 0; i < n; ++i) {
+        bins_[i].probability = usableWeight(weights[i]) / total;
+        bins_[i].alias = i;
+        scaled[i] = bins_[i].probability * n;
+        (scaled[i] < 1.0 ? small : large).push_back(i);
+    }
+
+    // fill the remainder of every underfull bin from an overfull one
+    while (!small.empty() && !large.empty()) {
+        std::size_t under = small.back();
+        small.pop_back();
+        std::size_t over = large.back();
+
+        bins_[under].keep = scaled[under];
+        bins_[under].alias = over;
+
+        scaled[over] -= 1.0 - scaled[under];
+        if (scaled[over] < 1.0) {
+            large.pop_back();
+            small.push_back(over);
+        }
+    }
+
+    // whatever is left is full, up to rounding
+    for (std::size_t i : small) {
+        bins_[i].keep = 1.0;
+    }
+    for (std::size_t i : large) {
+        bins_[i].keep = 1.0;
+    }
+}
+
+std::size_t AliasTable::sample(double& u) const {
+    // the first part of u picks the bin, the rest decides between
+    // its item and the alias
+    double scaled = u * bins_.size();
+    std::size_t index = std::min(static_cast<std::size_t>(scaled), bins_.size() - 1);
+    double remainder = scaled - index;
+
+    Bin const& bin = bins_[index];
+    if (remainder < bin.keep) {
+        u = remainder / bin.keep;
+    }
+    else {
+        u = (remainder - bin.keep) / (1.0 - bin.keep);
+        index = bin.alias;
+    }
+
+    u = std::min(u, 1.0 - std::numeric_limits<double>::epsilon());
+    return index;
+}
@@ -0,0 +1,59 @@
+#ifndef _ALIAS_TABLE_H_
+#define _ALIAS_TABLE_H_
+
+#include <vector>
+#include <cstddef>
+
+/**
+ * Picks one of many items at random, in proportion to their weights,
+ * in constant time. (Vose, "A Linear Algorithm For Generating Random
+ * Numbers With a Given Distribution")
+ *
+ * Each item owns a bin of equal probability. A bin keeps its item with
+ * some probability, and otherwise hands over to an alias item, whose
+ * weight overflowed its own bin.
+ */
+class AliasTable {
+
+public:
+    AliasTable();
+    ~AliasTable();
+
+    /**
+     * Build the table over items with (non-negative) @a weights.
+     * Items are referred to by their index in @a weights. Negative and
+     * NaN weights count as zero.
+     *
+     * If no weight is positive, the table is left empty.
+     */
+    void build(std::vector<double> const& weights);
+
+    void clear();
+
+    /** @return whether there are any items to pick */
+    bool empty() const { return bins_.empty(); }
+
+    std::size_t size() const { return bins_.size(); }
+
+    /**
+     * Pick an item using the uniform number @a u in [0,1), which is
+     * rescaled to a fresh uniform number in [0,1).
+     *
+     * ASSUMPTION: the table is not empty
+     */
+    std::size_t sample(double& u) const;
+
+    /** @return the probability of picking the item at @a index */
+    double probability(std::size_t index) const { return bins_[index].probability; }
+
+private:
+    struct Bin {
+        double keep;        ///< probability of keeping the bin's own item
+        std::size_t alias;  ///< item picked otherwise
+        double probability; ///< normalized weight of the bin's own item
+    };
+
+    std::vector<Bin> bins_;
+};
+
+#endif // _ALIAS_TABLE_H_
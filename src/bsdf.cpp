@@ -0,0 +1,27 @@
+#include "bsdf.h"
+#include "ray.h"
+#include "texture/material.h"
+
+ShadingFrame::ShadingFrame(Vector3D const& axis) : normal(axis) {
+    double sign = std::copysign(1.0, axis[2]);
+    double a = -1.0 / (sign + axis[2]);
+    double b = axis[0] * axis[1] * a;
+
+    tangent = Vector3D(1.0 + sign * axis[0] * axis[0] * a, sign * b, -sign * axis[0]);
+    bitangent = Vector3D(b, sign + axis[1] * axis[1] * a, -axis[1]);
+}
+
+BSDF::BSDF(Ray3D const& ray) :
+        frame(ray.intersection.normal),
+        mirror(reflectedDir(ray.dir, ray.intersection.normal)) {
+
+    Material const& mat = *ray.intersection.mat;
+    UVPoint const& uv = ray.intersection.uv;
+
+    ambient = mat.ambient.at(uv);
+    diffuse = mat.diffuse.at(uv);
+    specular = mat.specular.at(uv);
+    emittance = mat.emittance.at(uv);
+    exponent = mat.specular_exp;
+    reflectance = mat.reflectance.at(uv);
+}
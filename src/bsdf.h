@@ -0,0 +1,80 @@
+#ifndef _BSDF_H_
+#define _BSDF_H_
+
+#include "math/math_types.h"
+#include "colour.h"
+
+class Ray3D;
+
+/**
+ * An orthonormal basis around a unit vector, for moving directions
+ * between world space and a local space where that vector is (0, 0, 1).
+ * (Duff et al., "Building an Orthonormal Basis, Revisited")
+ */
+struct ShadingFrame {
+    ShadingFrame() { }
+
+    /** ASSUMPTION: @a axis is unit length */
+    explicit ShadingFrame(Vector3D const& axis);
+
+    Vector3D toWorld(Vector3D const& local) const {
+        return local[0]*tangent + local[1]*bitangent + local[2]*normal;
+    }
+
+    Vector3D toLocal(Vector3D const& dir) const {
+        return Vector3D(dir.dot(tangent), dir.dot(bitangent), dir.dot(normal));
+    }
+
+    Vector3D tangent;
+    Vector3D bitangent;
+    Vector3D normal; ///< the axis the frame is built around
+};
+
+/**
+ * The material at the intersection of a ray, with all its textures
+ * looked up once, so the point can be shaded by many lights and
+ * samples without repeating the lookups.
+ *
+ * Evaluates the Phong BRDF towards the viewer (back along the ray), and
+ * holds the frames its diffuse and specular lobes are sampled in.
+ */
+class BSDF {
+
+public:
+    /**
+     * ASSUMPTION: @a ray has an intersection, and unit length
+     * direction and normal
+     */
+    explicit BSDF(Ray3D const& ray);
+
+    /**
+     * Ratio of light arriving from @a incoming, to light reflected
+     * towards the viewer, for each RGB component.
+     * ASSUMPTION: incoming faces away from the surface, and is unit length
+     */
+    Colour eval(Vector3D const& incoming) const {
+        // diffuse is just uniform distribution
+        Colour ratio(diffuse);
+
+        // cos of angle between incoming, and the mirror direction
+        // of the viewer
+        double rv = incoming.dot(mirror.normal);
+        if (rv > 0) {
+            ratio += specular * pow(rv, exponent);
+        }
+
+        return ratio;
+    }
+
+    Colour ambient;
+    Colour diffuse;
+    Colour specular;
+    Colour emittance;
+    double exponent;    ///< specular exponent
+    double reflectance; ///< chance of a perfect mirror reflection
+
+    ShadingFrame frame;  ///< around the normal of the surface
+    ShadingFrame mirror; ///< around the mirror direction of the ray
+};
+
+#endif // _BSDF_H_
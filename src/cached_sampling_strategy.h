@@ -20,10 +20,11 @@ class CachedSamplingStrategy {
 public:
     /**
      * Create a new CachedSamplingStrategy, using a specific
-     * SamplingStrategy @a s with the specific Ray3D @a ray.
+     * SamplingStrategy @a s with the specific Ray3D @a ray,
+     * and the @a bsdf at its intersection.
      */
-    CachedSamplingStrategy(SamplingStrategy* s, Ray3D const& ray)
-            : strategy(s), cache_(strategy->initCache(ray)) { }
+    CachedSamplingStrategy(SamplingStrategy* s, Ray3D const& ray, BSDF const& bsdf)
+            : strategy(s), cache_(strategy->initCache(ray, bsdf)) { }
 
     /**
      * Given unit samples @a u and @a v, set a direction through @a dir,
@@ -3,6 +3,17 @@
 #include "texture/rgba_converter.hpp"
 #include "texture/bmp_image.h"
 
+#include <algorithm>
+
+namespace {
+
+    // camera samples traced together by the batch sampling function,
+    // rounded to whole pixels. Enough for its stages to run long loops,
+    // while the data of the batch still fits in cache.
+    const int batchSamples = 1024;
+
+}
+
 Camera::Camera(unsigned int width, unsigned int height,
        Point3D const& eye, Vector3D const& view, Vector3D const& up,
        double fov) :
@@ -10,8 +21,10 @@ Camera::Camera(unsigned int width, unsigned int height,
             apertureRadius_(0),
             sensor_(width, height),
             gamma_(1.0),
+            seed_(0),
             subSampler_(1),
             apertureSampler_(1),
+            pixelSamples_(0),
             eye_(eye),
             view_(view),
             up_(up),
@@ -28,8 +41,10 @@ Camera::Camera(unsigned int width, unsigned int height,
             apertureRadius_(0),
             sensor_(width, height),
             gamma_(1.0),
+            seed_(0),
             subSampler_(1),
             apertureSampler_(1),
+            pixelSamples_(0),
             eye_(0.0, 0.0, 0.0),
             view_(0.0, 0.0, -1.0),
             up_(0.0, 1.0, 0.0),
@@ -54,6 +69,16 @@ void Camera::setFocalDistance(double d) {
     focalDistance_ = d;
 }
 
+void Camera::setSeed(std::uint64_t seed) {
+    seed_ = qnd::mixBits(seed) ^ std::hash<std::string>()(name);
+}
+
+qnd::Rng Camera::pixelRng(int i, int j, unsigned int pass) const {
+    // pixels are told apart by stream, passes by seed
+    std::uint64_t pixel = std::uint64_t(i)*sensor_.width() + j;
+    return qnd::Rng(qnd::mixBits(seed_ + qnd::mixBits(pass)), pixel);
+}
+
 void Camera::setEye (Point3D const& eye) {
     eye_ = eye;
     viewToWorld_ = initInvViewMatrix(eye_, view_, up_);
@@ -74,6 +99,15 @@ bool Camera::mergeSensor(Image<SensorPixel> const& other) {
     return mergeSensors(sensor_, other);
 }
 
+double Camera::meanSamples() const {
+    double samples = 0;
+    for (SensorPixel const& pixel : sensor_) {
+        samples += pixel.samples;
+    }
+
+    return samples / (sensor_.width() * sensor_.height());
+}
+
 bool Camera::dumpToBMP(std::string filename) const {
     Image<RGBA> convertedImage = convertImageToRGBA(sensor_,
                                                     RGBAConverter<SensorPixel>{gamma_});
@@ -88,9 +122,20 @@ bool Camera::dumpRawData(std::string filename) const {
 // For a given pixel in the pixel buffer, generate
 // image plane coordinates and pass those to the lens
 // to be sampled
-void Camera::computePixel(int i, int j) const {
+void Camera::computePixel(int i, int j, ScratchArena& scratch) const {
     SensorPixel& pixel = sensor_[i][j];
 
+    // memory left over from earlier pixels is no longer needed
+    scratch.reset();
+
+    if (pixelSamples_.n() > 0) {
+        computePixelFlat(i, j, pixel, scratch);
+        return;
+    }
+
+    qnd::Rng rng = pixelRng(i, j, pixel.samples);
+    PixelSampler sampler(rng, scratch);
+
     // if we are taking more than one sample from each pixel,
     // do antialiasing
     if (subSampler_.n() > 1) {
@@ -99,7 +144,7 @@ void Camera::computePixel(int i, int j) const {
         double yStart = (-double(sensor_.height())/2 + i);
 
         //typedef coordinate_traits<double, 2>::type sample_type;
-        for (auto const& sample : subSampler_)
+        for (auto const& sample : subSampler_(sampler.rng()))
         {
             // for each sample, offset pixel coordinate so we are
             // sampling within the pixel
@@ -107,7 +152,7 @@ void Camera::computePixel(int i, int j) const {
             double y = (yStart + sample[1]);
 
             // let the lens handle FOV and DOF
-            pixel += sampleLens(x, y); 
+            pixel += sampleLens(x, y, sampler); 
         }
 
         // NOTE: here I do not divide by number of samples, instead the
@@ -122,38 +167,116 @@ void Camera::computePixel(int i, int j) const {
         double x = (-double(sensor_.width())/2 + 0.5 + j);
         double y = (-double(sensor_.height())/2 + 0.5 + i);
 
-        pixel += sampleLens(x, y); 
+        pixel += sampleLens(x, y, sampler); 
+    }
+}
+
+void Camera::computePixelFlat(int i, int j, SensorPixel& pixel,
+                              ScratchArena& scratch) const {
+    const std::uint32_t key = pixelKey(i, j);
+
+    for (int s = 0; s < pixelSamples_.n(); ++s) {
+        // every sample has its own stream of random numbers, so samples
+        // can also be traced in any order (see computeAreaBatched)
+        qnd::Rng rng = pixelRng(i, j, pixel.samples);
+        PixelSampler sampler(pixelSamples_, pixel.samples, key, rng, scratch);
+        ScratchArena::Scope scope(scratch);
+
+        Ray3D ray = flatSampleRay(i, j, sampler);
+        pixel += sceneSamplingFunc_(ray, sampler);
     }
 }
 
+void Camera::computeAreaBatched(int iStart, int iEnd,
+                                int jStart, int jEnd, ScratchArena& scratch) const {
+    const int samples = pixelSamples_.n();
+    const int width = jEnd - jStart;
+    const int pixels = (iEnd - iStart) * width;
+    const int batchPixels = std::max(1, batchSamples / samples);
+
+    for (int first = 0; first < pixels; first += batchPixels) {
+        const int last = std::min(pixels, first + batchPixels);
+        const std::size_t capacity = std::size_t(last - first) * samples;
+
+        ScratchArena::Scope scope(scratch);
+
+        // the samples of each pixel, with the random numbers
+        // computePixelFlat would give them
+        ScratchArray< qnd::Rng > rngs(scratch, capacity);
+        ScratchArray< PixelSampler > samplers(scratch, capacity);
+        PathBatch paths(scratch, capacity);
+
+        for (int k = first; k < last; ++k) {
+            const int i = iStart + k / width;
+            const int j = jStart + k % width;
+            const std::uint32_t key = pixelKey(i, j);
+            unsigned int index = sensor_[i][j].samples;
+
+            for (int s = 0; s < samples; ++s, ++index) {
+                rngs.push_back(pixelRng(i, j, index));
+                samplers.push_back(PixelSampler(pixelSamples_, index, key,
+                                                rngs[rngs.size() - 1], scratch));
+
+                PixelSampler& sampler = samplers[samplers.size() - 1];
+                Ray3D ray = flatSampleRay(i, j, sampler);
+                paths.addPath(ray.origin, ray.dir, sampler);
+            }
+        }
+
+        sceneBatchFunc_(paths);
+
+        // deposit the samples in the order computePixelFlat would
+        std::size_t path = 0;
+        for (int k = first; k < last; ++k) {
+            SensorPixel& pixel = sensor_[iStart + k / width][jStart + k % width];
+            for (int s = 0; s < samples; ++s) {
+                pixel += paths.col[path++];
+            }
+        }
+    }
+}
+
+Ray3D Camera::flatSampleRay(int i, int j, PixelSampler& sampler) const {
+    // find image plane coordinates of pixel
+    double xStart = (-double(sensor_.width())/2 + j);
+    double yStart = (-double(sensor_.height())/2 + i);
+
+    // first dimensions choose the position in the pixel,
+    // followed by the position on the lens
+    uv_sample offset = sampler.get2D();
+    uv_sample lens = { { 0.0, 0.0 } };
+    if (apertureRadius_ > std::numeric_limits<double>::epsilon()) {
+        lens = sampler.get2D();
+    }
+
+    return lensRay(xStart + offset[0], yStart + offset[1], lens[0], lens[1]);
+}
+
+Colour Camera::probePixel(int i, int j, ScratchArena& scratch) const {
+    // probing should not disturb the samples of the pixel, so use
+    // a pass that is never rendered
+    qnd::Rng rng = pixelRng(i, j, ~0u);
+    PixelSampler sampler(rng, scratch);
+    ScratchArena::Scope scope(scratch);
+
+    double x = (-double(sensor_.width())/2 + 0.5 + j);
+    double y = (-double(sensor_.height())/2 + 0.5 + i);
+
+    return sampleLens(x, y, sampler);
+}
+
 // Uses image plane coordinates to construct rays from lens
-Colour Camera::sampleLens(double x, double y) const {
-    x = (x * focalDistance_) / factor_;
-    y = (y * focalDistance_) / factor_;
-    
+Colour Camera::sampleLens(double x, double y, PixelSampler& sampler) const {
     Colour col;
 
     // sample aperture disk for DOF, if not pinhole camera
     if ( apertureRadius_ > std::numeric_limits<double>::epsilon() && apertureSampler_.n() > 1) {
 
-        for (auto const& sample : apertureSampler_)
+        for (auto const& sample : apertureSampler_(sampler.rng()))
         {
-            // respect the jacobian when sampling disk
-            double r = sqrt(sample[0])*apertureRadius_;
-            double theta = 2*M_PI*sample[1];
-
-            // find the aperture point that acts as the origin of the ray
-            Point3D aperturePoint(r*cos(theta),
-                                  r*sin(theta), 0);
-            // get direction to focus point
-            Vector3D toPixel(Point3D(x, y, -focalDistance_) - aperturePoint);
-
-            // construct ray
-            Ray3D ray(viewToWorld_.transformPoint(aperturePoint.v),
-                      viewToWorld_.transformVector(toPixel.v));
-
             // sample scene with ray
-            col += sceneSamplingFunc_(ray); 
+            Ray3D ray = lensRay(x, y, sample[0], sample[1]);
+            col += sceneSamplingFunc_(ray, sampler); 
         }
 
         // divide by number of samples taken by the sampler
@@ -162,13 +285,32 @@ Colour Camera::sampleLens(double x, double y) const {
     // otherwise it's a pinhole camera
     else {
         // shoot a single ray directly through center of aperture
-        Ray3D ray(eye_, viewToWorld_.transformVector(Eigen::Vector3d(x, y, -focalDistance_)));
-        col += sceneSamplingFunc_(ray); 
+        Ray3D ray = lensRay(x, y, 0.0, 0.0);
+        col += sceneSamplingFunc_(ray, sampler); 
     }
 
     return col;
 }
 
+Ray3D Camera::lensRay(double x, double y, double u, double v) const {
+    x = (x * focalDistance_) / factor_;
+    y = (y * focalDistance_) / factor_;
+
+    // respect the jacobian when sampling disk
+    double r = sqrt(u)*apertureRadius_;
+    double theta = 2*M_PI*v;
+
+    // find the aperture point that acts as the origin of the ray
+    Point3D aperturePoint(r*cos(theta),
+                          r*sin(theta), 0);
+    // get direction to focus point
+    Vector3D toPixel(Point3D(x, y, -focalDistance_) - aperturePoint);
+
+    // construct ray
+    return Ray3D(viewToWorld_.transformPoint(aperturePoint.v),
+                 viewToWorld_.transformVector(toPixel.v));
+}
+
 AffineTrans3D initInvViewMatrix( Point3D const& eye, Vector3D view, Vector3D up) {
     AffineTrans3D mat; 
     Vector3D w;
@@ -6,9 +6,14 @@
 #include "ray.h"
 
 #include "uv_sampler.h"
+#include "pixel_sampler.h"
+#include "scratch_arena.h"
+#include "path_batch.h"
 #include "math/math_traits.hpp"
 #include "texture/sensor.h"
 
+#include <functional>
+
 /**
  * Initalize an transformation matrix from view to world coordinates,
  * given the @a eye position, @a view direction, and @up orientation.
@@ -22,9 +27,16 @@ class Camera {
 public:
 
     /**
-     * A function that returns a colour given a ray
+     * A function that returns a colour given a ray, drawing any
+     * random numbers it needs from the sampler passed
+     */
+    typedef std::function<Colour (Ray3D&, PixelSampler&)> sampling_func;
+
+    /**
+     * A function that traces a whole batch of camera samples together,
+     * leaving the colour of each in the batch
      */
-    typedef std::function<Colour (Ray3D&)> sampling_func;
+    typedef std::function<void (PathBatch&)> batch_sampling_func;
 
     Camera(unsigned int width, unsigned int height,
            Point3D const& eye, Vector3D const& view, Vector3D const& up,
@@ -42,6 +54,15 @@ public:
         sceneSamplingFunc_ = func;
     }
 
+    /**
+     * Set a function that traces the camera samples of many pixels
+     * together, used instead of the sampling function while a flat budget
+     * of pixel samples is set. An empty function turns this off.
+     */
+    void setBatchSamplingFunc(batch_sampling_func func) {
+        sceneBatchFunc_ = func;
+    }
+
     // getters for dimensions
     int width()  const { return sensor_.width(); }
     int height() const { return sensor_.height(); }
@@ -51,7 +72,38 @@ public:
     void setView(Vector3D const& view);
     void setUp  (Vector3D const& up);
     void setGamma  (double gamma) { gamma_ = gamma; }
-    void setAntialiasSamples(int n) { subSampler_ = UVSampler(n); }
+
+    /**
+     * Set the seed random numbers are derived from, combined with the
+     * name of the camera (so set the name first).
+     *
+     * Every pixel gets its own stream of random numbers, keyed by its
+     * position and the number of samples already on it. This way the
+     * result does not depend on which thread renders a pixel, and
+     * repeated passes over the sensor take new samples.
+     */
+    void setSeed(std::uint64_t seed);
+    void setAntialiasSamples(int n, SampleSequence sequence = Sequence_Stratified) {
+        subSampler_ = UVSampler(n, sequence);
+    }
+
+    /**
+     * Set a flat budget of @a n samples per pixel, taken from @a sequence.
+     *
+     * Instead of nesting the antialias and aperture samples, and the
+     * samples of every strategy at every bounce, each camera sample takes
+     * a single sample of each, from its own dimensions of the sequence.
+     * Cost is then linear in the number of samples.
+     *
+     * Antialias and aperture sample counts are ignored while set.
+     * A count of 0 switches back to nested sampling.
+     */
+    void setPixelSamples(int n, SampleSequence sequence = Sequence_Stratified) {
+        pixelSamples_ = UVSampler(n, sequence);
+    }
+
+    /** flat budget of samples per pixel, 0 if sampling is nested */
+    int pixelSamples() const { return pixelSamples_.n(); }
     std::string name;
 
     /************************
@@ -66,10 +118,13 @@ public:
     void setApertureRadius(double r);
 
     /**
-     * Set the number of samples to take on the surface of the aperture.
+     * Set the number of samples to take on the surface of the aperture,
+     * and the @a sequence they are taken from.
      * Currently the aperture is circular.
      */
-    void setApertureSamples(int n) { apertureSampler_ = UVSampler(n); }
+    void setApertureSamples(int n, SampleSequence sequence = Sequence_Stratified) {
+        apertureSampler_ = UVSampler(n, sequence);
+    }
 
     /**
      * Set the distance to the focal plane
@@ -108,23 +163,61 @@ public:
     /**
      * Compute the pixel (i,j) on the sensor, using the 
      * dampling function provided earlier.
+     *
+     * The shading gets its temporary memory from @a scratch, which
+     * belongs to the calling thread.
      */
-    void computePixel(int i, int j) const;
+    void computePixel(int i, int j, ScratchArena& scratch) const;
+
+    /**
+     * Trace a single ray through the centre of pixel (i,j) without
+     * depositing anything on the sensor.
+     *
+     * Used to estimate how expensive parts of the image are to render.
+     */
+    Colour probePixel(int i, int j, ScratchArena& scratch) const;
 
     /**
      * Convenience method to compute a rectangular area on 
      * the sensor.
      */
     void computeArea(int iStart, int iEnd,
+                     int jStart, int jEnd, ScratchArena& scratch) const {
+
+        if (sceneBatchFunc_ && pixelSamples_.n() > 0) {
+            computeAreaBatched(iStart, iEnd, jStart, jEnd, scratch);
+            return;
+        }
+
+        for (int i = iStart; i < iEnd; ++i) {
+            for (int j = jStart; j < jEnd; ++j) {
+                computePixel(i, j, scratch);
+            }
+        }
+
+    }
+
+    /**
+     * Largest relative error estimate of the pixels in a rectangular
+     * area on the sensor.
+     */
+    double areaError(int iStart, int iEnd,
                      int jStart, int jEnd) const {
 
+        double error = 0.0;
         for (int i = iStart; i < iEnd; ++i) {
             for (int j = jStart; j < jEnd; ++j) {
-                computePixel(i, j);
+                error = std::max(error, sensor_[i][j].relativeError());
             }
         }
 
+        return error;
     }
+
+    /**
+     * Average number of samples taken per pixel of the sensor
+     */
+    double meanSamples() const;
     /*********************************************************/
 
 private:
@@ -134,10 +227,56 @@ private:
      */
     void initDefault();
 
+    /**
+     * Create the random number generator for pixel (i,j), when
+     * @a pass samples have already been taken from it
+     */
+    qnd::Rng pixelRng(int i, int j, unsigned int pass) const;
+
     /**
      * Given a location on the sensor array, sample through the lens
      */
-    Colour sampleLens(double x, double y) const;
+    Colour sampleLens(double x, double y, PixelSampler& sampler) const;
+
+    /**
+     * Sample pixel (i,j) with a flat budget of samples, each
+     * drawing all its dimensions from the pixel samples sequence
+     */
+    void computePixelFlat(int i, int j, SensorPixel& pixel,
+                          ScratchArena& scratch) const;
+
+    /**
+     * Compute a rectangular area with the batch sampling function,
+     * in batches of the samples of whole pixels.
+     */
+    void computeAreaBatched(int iStart, int iEnd,
+                            int jStart, int jEnd, ScratchArena& scratch) const;
+
+    /**
+     * Ray of a camera sample of pixel (i,j) with a flat budget of
+     * samples, drawing its position in the pixel and on the lens from
+     * @a sampler
+     */
+    Ray3D flatSampleRay(int i, int j, PixelSampler& sampler) const;
+
+    /**
+     * Key that randomizes the pixel samples sequence for pixel (i,j).
+     * It is the same for every pass, so further passes continue the
+     * sequence instead of starting a new one.
+     *
+     * Drawn from a pass that is never rendered (nor probed, which uses
+     * ~0u), so it is independent of the random numbers of the samples.
+     */
+    std::uint32_t pixelKey(int i, int j) const {
+        return pixelRng(i, j, ~1u).next();
+    }
+
+    /**
+     * Create a ray from a location on the sensor array, passing through
+     * the aperture at unit square coordinates (@a u, @a v).
+     * (0, 0) is the center of the aperture.
+     */
+    Ray3D lensRay(double x, double y, double u, double v) const;
 
     double factor_; ///< scaling factor on x,y position to map from image coordinates to camera coordinates
     double apertureRadius_; ///< radius of lens aperture for DOF
@@ -147,10 +286,14 @@ private:
 
     double gamma_; ///< sensor gamma
 
-    std::function<Colour (Ray3D&)> sceneSamplingFunc_; ///< function pointer to shade function 
+    std::uint64_t seed_; ///< seed for the random numbers of all pixels
+
+    sampling_func sceneSamplingFunc_; ///< function pointer to shade function 
+    batch_sampling_func sceneBatchFunc_; ///< traces many samples at once, if set
 
     UVSampler subSampler_; ///< Sampler used for antialiasing
     UVSampler apertureSampler_; ///< Sampler used for sampling the aperture
+    UVSampler pixelSamples_; ///< Flat budget of samples per pixel, if not 0
 
     Point3D eye_; ///< position of the "eye" or aperture in world space
     Vector3D view_; ///< direction where the camera is facing
@@ -0,0 +1,98 @@
+#include "checkpoint_writer.h"
+#include "camera.h"
+
+#include <omp.h>
+#include <cstdio>
+#include <iostream>
+
+CheckpointWriter::CheckpointWriter() : interval_(0),
+                                       last_(0),
+                                       busy_(false),
+                                       stopping_(false) { }
+
+CheckpointWriter::~CheckpointWriter() {
+    finish();
+}
+
+void CheckpointWriter::start() {
+    last_ = omp_get_wtime();
+}
+
+void CheckpointWriter::offer(Camera const& cam) {
+    if (interval_ <= 0) {
+        return;
+    }
+
+    double now = omp_get_wtime();
+    if (now - last_ < interval_) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> guard(lock_);
+
+    // never hold up rendering for a slow disk
+    if (pending_ || busy_) {
+        return;
+    }
+
+    if (!thread_.joinable()) {
+        thread_ = std::thread(&CheckpointWriter::run, this);
+    }
+
+    pending_.reset(new Camera(cam));
+    last_ = now;
+    wake_.notify_one();
+}
+
+void CheckpointWriter::finish() {
+    if (!thread_.joinable()) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        stopping_ = true;
+        wake_.notify_one();
+    }
+
+    thread_.join();
+    stopping_ = false;
+}
+
+void CheckpointWriter::run() {
+    std::unique_lock<std::mutex> guard(lock_);
+
+    while (true) {
+        wake_.wait(guard, [this]() { return pending_ || stopping_; });
+
+        // a pending snapshot is still written when stopping
+        if (!pending_) {
+            return;
+        }
+
+        std::unique_ptr<Camera> snapshot(std::move(pending_));
+        busy_ = true;
+
+        guard.unlock();
+        write(*snapshot);
+        guard.lock();
+
+        busy_ = false;
+    }
+}
+
+void CheckpointWriter::write(Camera const& snapshot) {
+    std::string bmpFileName = snapshot.name + ".bmp";
+    std::string rawFileName = snapshot.name + ".rsd";
+    std::string tmpSuffix(".tmp");
+
+    if (!snapshot.dumpToBMP(bmpFileName + tmpSuffix)
+        || std::rename((bmpFileName + tmpSuffix).c_str(), bmpFileName.c_str()) != 0) {
+        std::cerr << "Could not write checkpoint " << bmpFileName << std::endl;
+    }
+
+    if (!snapshot.dumpRawData(rawFileName + tmpSuffix)
+        || std::rename((rawFileName + tmpSuffix).c_str(), rawFileName.c_str()) != 0) {
+        std::cerr << "Could not write checkpoint " << rawFileName << std::endl;
+    }
+}
@@ -0,0 +1,77 @@
+#ifndef _CHECKPOINT_WRITER_H_
+#define _CHECKPOINT_WRITER_H_
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+
+class Camera;
+
+/**
+ * Periodically saves the image of a camera being rendered in passes,
+ * as a BMP and as raw sensor data (.rsd), so a long render can be
+ * stopped at any time and continued later.
+ *
+ * Between passes the renderer offers the camera. If enough time has
+ * passed since the last checkpoint, a copy of the camera is taken and
+ * written out by a background thread, while rendering carries on.
+ *
+ * Files are first written under a temporary name and then renamed, so
+ * an interrupted write never destroys the previous checkpoint.
+ *
+ * Usage:
+ *   writer.start();             // when rendering starts
+ *   writer.offer(cam);          // after every pass
+ *   writer.finish();            // once rendering is done
+ */
+class CheckpointWriter {
+
+public:
+    CheckpointWriter();
+    ~CheckpointWriter();
+
+    /**
+     * Set the number of seconds between checkpoints. 0 turns
+     * checkpoints off.
+     */
+    void setInterval(double seconds) { interval_ = seconds; }
+    double interval() const { return interval_; }
+
+    /**
+     * Start timing the interval until the first checkpoint
+     */
+    void start();
+
+    /**
+     * Take a checkpoint of @a cam if one is due. The sensor must not
+     * be written to while this is called.
+     *
+     * If the previous checkpoint is still being written, this one is
+     * skipped rather than waited for.
+     */
+    void offer(Camera const& cam);
+
+    /**
+     * Wait for the checkpoint being written (if any), and stop the
+     * background thread.
+     */
+    void finish();
+
+private:
+    void run();
+    void write(Camera const& snapshot);
+
+    double interval_; ///< seconds between checkpoints
+    double last_;     ///< time the last checkpoint was taken
+
+    std::thread thread_;
+    std::mutex lock_;
+    std::condition_variable wake_;
+
+    std::unique_ptr<Camera> pending_; ///< snapshot waiting to be written
+    bool busy_;     ///< whether a snapshot is being written
+    bool stopping_; ///< whether the thread should exit once idle
+};
+
+#endif // _CHECKPOINT_WRITER_H_
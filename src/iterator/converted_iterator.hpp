@@ -5,6 +5,8 @@
 
 namespace qnd {
 
+    class Rng;
+
     // Takes an iterator and a conversion function object to 
     // create a new iterator that ierates over the converted values
     template <class Iter, class Conv>
@@ -15,7 +17,7 @@ namespace qnd {
                                    typename Conv::result_type const> {
 
     public:
-        explicit converted_iterator(int n, bool end) : _i(n, end) { }
+        explicit converted_iterator(int n, bool end, Rng& rng) : _i(n, end, rng) { }
 
         static int round(int iterations) { return Iter::round(iterations); }
 
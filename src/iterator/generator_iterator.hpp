@@ -9,8 +9,13 @@
 
 namespace qnd {
 
+    class Rng;
+
     /**
-     * Iterates over a generator's output an integer number of times
+     * Iterates over a generator's output an integer number of times.
+     *
+     * The generator draws its random numbers from @a rng, which has to
+     * outlive the iterator.
      */
     template <class Gen>
     class generator_iterator : 
@@ -20,7 +25,8 @@ namespace qnd {
                                    typename Gen::result_type const > {
 
     public:
-        explicit generator_iterator(int n, bool end) : _i((end ? n : 0)) { }
+        explicit generator_iterator(int n, bool end, Rng& rng) :
+                    _i((end ? n : 0)), _rng(&rng) { }
 
         /**
          * Adjust the final number of iterations if needed
@@ -38,18 +44,23 @@ namespace qnd {
         }
         
         typename Gen::result_type dereference() const {
-            return Gen::generate();
+            return Gen::generate(*_rng);
         }
 
     private:
         int _i;
+        Rng* _rng;
 
     };
 
     /**
-     * Can be iterated over like a container and used in algorithms
+     * Once given a random number generator, can be iterated over like a
+     * container and used in algorithms
      *
      * Think of this as a generator in python that yields values.
+     *
+     * Usage:
+     *   for (auto const& sample : builder(rng)) { ... }
      */
     template <class GenIter>
     class generator_iterator_builder {
@@ -58,19 +69,35 @@ namespace qnd {
         typedef GenIter const_iterator;
         typedef const_iterator iterator;
 
+        /**
+         * The iterations of a builder, drawing from a particular generator
+         */
+        class range {
+        public:
+            range(int n, Rng& rng) : _n(n), _rng(&rng) { }
+
+            GenIter begin() const {
+                return GenIter(_n, false, *_rng);
+            }
+
+            GenIter end() const {
+                return GenIter(_n, true, *_rng);
+            }
+
+        private:
+            int _n;
+            Rng* _rng;
+        };
+
         generator_iterator_builder(int iterations) :
                 _n(GenIter::round(iterations)) { }
 
         int n() const { 
             return _n;
         }
-        
-        GenIter begin() const {
-            return GenIter(_n, false);
-        }
 
-        GenIter end() const {
-            return GenIter(_n, true);
+        range operator()(Rng& rng) const {
+            return range(_n, rng);
         }
 
     private:
@@ -1,7 +1,7 @@
 #include "generator_iterator.hpp"
 #include "converted_iterator.hpp"
 #include "stratified_iterator.hpp"
-#include "../threadrand.h"
+#include "../rng.h"
 #include <string>
 
 using namespace std;
@@ -9,7 +9,7 @@ using namespace std;
 struct generator {
     typedef int result_type;
 
-    static result_type generate () {
+    static result_type generate (qnd::Rng&) {
         return 42;
     }
 };
@@ -42,17 +42,17 @@ int main (int argc, char* argv[]) {
     typedef qnd::generator_iterator_builder<conv_iter > gen_stuff;
     
 
-    for (auto output : gen_stuff(10) ) {
+    qnd::Rng rng;
+
+    for (auto output : gen_stuff(10)(rng) ) {
         std::cout << output << std::endl;
     }
 
-    qnd::init_threadrand();
-
     const int subdivisions = 5;
     typedef qnd::stratified_iterator<qnd::uniform_generator<1> > strat_iter;
     typedef qnd::generator_iterator_builder<strat_iter> stratified_sampler;
 
-    for (auto output : stratified_sampler(subdivisions*subdivisions) ) {
+    for (auto output : stratified_sampler(subdivisions*subdivisions)(rng) ) {
         std::cout << output[0] << " " << output[1] << std::endl;
     }
 
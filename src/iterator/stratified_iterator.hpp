@@ -6,6 +6,8 @@
 #include <math.h>
 
 namespace qnd {
+
+    class Rng;
     
     inline int closestSquareRoot(int num) {
         return int(sqrt(double(num)));
@@ -13,7 +15,7 @@ namespace qnd {
 
     /**
      * Given a static generator that generates uniformly distributed
-     * numbers from 0-1, makes the samples stratified in 2-d
+     * numbers from 0-1 out of @a rng, makes the samples stratified in 2-d
      */
     template < class UnitGen>
     class stratified_iterator :
@@ -23,10 +25,11 @@ namespace qnd {
                                    boost::array<typename UnitGen::result_type, 2> const> {
 
     public:
-        explicit stratified_iterator(int n, bool end) :
+        explicit stratified_iterator(int n, bool end, Rng& rng) :
                     _n(closestSquareRoot(n)),
                     _i((end ? (_n) : 0)),
-                    _j(0) { }
+                    _j(0),
+                    _rng(&rng) { }
 
         static int round(int iterations) {
             int n = closestSquareRoot(iterations);
@@ -52,7 +55,7 @@ namespace qnd {
         }
         
         result_type dereference() const {
-            result_type result = { { (double(_i) + UnitGen::generate()) / _n, (double(_j) + UnitGen::generate()) / _n } };
+            result_type result = { { (double(_i) + UnitGen::generate(*_rng)) / _n, (double(_j) + UnitGen::generate(*_rng)) / _n } };
             return result;
         }
 
@@ -62,6 +65,8 @@ namespace qnd {
         int _i;
         int _j;
 
+        Rng* _rng;
+
     };
 
 }
@@ -1,38 +1,94 @@
 #include "kd_tree.h"
 
+#include <omp.h>
+#include <algorithm>
+#include <cmath>
+
 namespace {
     const int K = 3; // max number of dimensions. 
     // hopefully later will be templated
+
+    // relative costs used by the surface area heuristic. Faces are tested
+    // a TriangleBlock at a time, so it is blocks that cost.
+    const double traversalCost = 1.0;    ///< cost of stepping through a node
+    const double intersectionCost = 1.5; ///< cost of testing a block of faces
+    const double emptyBonus = 0.8;       ///< discount for cutting off empty space
+
+    /**
+     * Nodes with more faces than this are split off into parallel tasks,
+     * and have their dimensions swept in parallel.
+     */
+    const size_t parallelThreshold = 4096;
+
+    /** @return the surface area of the box spanned by the two points */
+    double surfaceArea(Point3D const& minPoint, Point3D const& maxPoint) {
+        Vector3D d = maxPoint - minPoint;
+        return 2.0 * (d[0]*d[1] + d[1]*d[2] + d[2]*d[0]);
+    }
+
+    double surfaceArea(BoundingBox const& box) {
+        return surfaceArea(box.minPoint(), box.maxPoint());
+    }
+
+    /** @return the number of blocks needed for @a count faces */
+    double blocksOf(size_t count) {
+        return double((count + PacketWidth - 1) / PacketWidth);
+    }
+
+    /**
+     * SAH cost of splitting a node into children holding @a leftCount
+     * and @a rightCount faces, with @a leftArea and @a rightArea being
+     * the surface areas of the children relative to the parent.
+     * Intersection is charged per block of PacketWidth faces, not per face.
+     */
+    double splitCost(double leftArea, double rightArea,
+                     unsigned int leftCount, unsigned int rightCount) {
+        double cost = traversalCost
+                    + intersectionCost * (leftArea*blocksOf(leftCount)
+                                          + rightArea*blocksOf(rightCount));
+        if (leftCount == 0 || rightCount == 0) {
+            cost *= emptyBonus;
+        }
+        return cost;
+    }
+
+    /** @return @a box with its bound in dimension @a dim replaced by @a value */
+    BoundingBox lessBox(BoundingBox const& box, int dim, double value) {
+        Point3D maxPoint = box.maxPoint();
+        maxPoint[dim] = value;
+        return BoundingBox(box.minPoint(), maxPoint);
+    }
+
+    BoundingBox moreBox(BoundingBox const& box, int dim, double value) {
+        Point3D minPoint = box.minPoint();
+        minPoint[dim] = value;
+        return BoundingBox(minPoint, box.maxPoint());
+    }
 }
 
 // =========================================
 
 /**
- * Given faces, find the bounding box
+ * Given a face, with its vertices in @a vertices, find the bounding box
  */
-BoundingBox getBoundingBox( std::vector< FaceIter > const& faces ) {
+BoundingBox getBoundingBox( Face const& face, VertexStorage const& vertices ) {
 
     const double inf = std::numeric_limits<double>::infinity();
     Point3D minPoint(inf, inf, inf);
     Point3D maxPoint(-inf, -inf, -inf);
 
-    // loop through faces and find bounds
-    for (auto const& faceIter : faces) {
-        Face const& face = *faceIter;
-
-        for (auto const& vertex : face.vertices) {
-            Point3D const& v = vertex.point;
-            // update min and max points for box bound
-            for (int dim = 0; dim < K; ++dim) {
-                // check min
-                if (v[dim] < minPoint[dim]) {
-                    minPoint[dim] = v[dim];
-                }
+    for (std::uint32_t vertex : face.vertices) {
+        Point3D const& v = vertices[vertex].point;
+        // update min and max points for box bound
+        for (int dim = 0; dim < K; ++dim) {
+            // check min
+            if (v[dim] < minPoint[dim]) {
+                minPoint[dim] = v[dim];
+            }
 
-                // check max
-                if (v[dim] > maxPoint[dim]) {
-                    maxPoint[dim] = v[dim];
-                }
+            // check max
+            if (v[dim] > maxPoint[dim]) {
+                maxPoint[dim] = v[dim];
             }
         }
     }
@@ -42,38 +98,66 @@ BoundingBox getBoundingBox( std::vector< FaceIter > const& faces ) {
 
 // =========================================
 
-KDNode::KDNode() : faceBound(Point3D(), Point3D()),
-                   boundaryValue(0),
-                   lessNode(nullptr),
-                   moreNode(nullptr) { }
-KDNode::~KDNode() { }
+/**
+ * Bounds of a face within a single dimension, as seen by the SAH sweep.
+ * Events at the same position are ordered ends first, then faces
+ * lying in the plane, then starts.
+ */
+struct KDTree::SplitEvent {
+    enum Type {
+        End = 0,
+        Planar = 1,
+        Start = 2
+    };
 
-bool KDNode::intersectFaces(Point3D const& origin,
-        Vector3D const& dir,
-        FaceIntersection& intersection) const {
+    SplitEvent(double pos, Type type) : pos(pos), type(type) { }
 
-    bool success = false;
-    for (auto const& faceIter : faces) {
-        if (intersectFace(*faceIter, origin, dir, intersection) ) {
-            success = true;
-        }
+    bool operator< (SplitEvent const& other) const {
+        return pos < other.pos || (pos == other.pos && type < other.type);
     }
 
-    return success;
-}
+    double pos;
+    Type type;
+};
+
+/**
+ * State of the part of a build running on a single thread.
+ *
+ * Face indices of the nodes being built are kept on a stack. Each node
+ * partitions its range of the stack in place, and leaves the children's
+ * ranges on top, so no memory is allocated per node. Only faces that end
+ * up in both children are copied.
+ */
+struct KDTree::BuildContext {
+    std::vector< std::uint32_t > indices; ///< stack of face indices
+    std::vector< SplitEvent > events;     ///< reused by the SAH sweeps
+
+    // output, in the same form as the finished tree
+    std::vector< KDFlatNode > nodes;
+    std::vector< std::uint32_t > faceIndices;
+};
 
 // =======================
-KDTree::KDTree() : root_(nullptr),
+KDTree::KDTree() : faceReferences_(0),
+                   faces_(nullptr),
                    box_(Point3D(), Point3D()),
+                   method_(KDBuild_SurfaceArea),
+                   buildTime_(0),
+                   maxDepth_(0),
                    fomThreshold_(6),
                    differenceThreshold_(3) { }
 KDTree::~KDTree() { clear(); }
 
 
-void KDTree::build(FaceStorage const& faces, BoundingBox const& box) {
+void KDTree::build(FaceStorage const& faces, VertexStorage const& vertices,
+                   BoundingBox const& box, KDBuildMethod method) {
     // clear the tree first
     clear();
+    faces_ = &faces;
     box_ = box;
+    method_ = method;
+
+    double start = omp_get_wtime();
 
     // set thresholds
 
@@ -89,96 +173,584 @@ void KDTree::build(FaceStorage const& faces, BoundingBox const& box) {
     // to determine smallest bisecting distance
     resolution_ = minDimension / 1000;
 
+    if (method == KDBuild_SurfaceArea) {
+        // usual depth limit, growing with the log of the number of faces
+        maxDepth_ = 8 + int(1.3 * std::log2(std::max<size_t>(faces.size(), 1)));
+        maxDepth_ = std::min(maxDepth_, MaxDepth - 1);
+    }
+    else {
+        maxDepth_ = MaxDepth - 1;
+    }
+
+    // bounds of every face are needed many times during the build
+    const int numFaces = faces.size();
+    faceBounds_.assign(numFaces, BoundingBox(Point3D(), Point3D()));
+
+    #pragma omp parallel for
+    for (int f = 0; f < numFaces; ++f) {
+        BoundingBox bound = getBoundingBox(faces[f], vertices);
+
+        // SAH planes are stored in single precision, and are always placed
+        // on face bounds. Round the bounds the same way, so faces are
+        // classified against the plane that is actually stored, and
+        // faces meeting at a vertex on the plane are not duplicated.
+        if (method == KDBuild_SurfaceArea) {
+            Point3D minPoint = bound.minPoint();
+            Point3D maxPoint = bound.maxPoint();
+            for (int dim = 0; dim < K; ++dim) {
+                minPoint[dim] = float(minPoint[dim]);
+                maxPoint[dim] = float(maxPoint[dim]);
+            }
+            bound = BoundingBox(minPoint, maxPoint);
+        }
+
+        faceBounds_[f] = bound;
+    }
+
+    // start with all faces on the stack
+    BuildContext context;
+    context.indices.reserve(2 * faces.size());
+    for (int f = 0; f < numFaces; ++f) {
+        context.indices.push_back(f);
+    }
+
+    // call recursive function, which spawns tasks for large subtrees
+    #pragma omp parallel
+    {
+        #pragma omp single
+        buildNode(context, 0, box, 0);
+    }
+
+    nodes_ = std::move(context.nodes);
+    buildBlocks(context.faceIndices, vertices);
+
+    std::vector< BoundingBox >().swap(faceBounds_);
+
+    buildTime_ = omp_get_wtime() - start;
+}
+
+void KDTree::buildNode(BuildContext& context, size_t begin,
+                       BoundingBox const& box, int depth) const {
+    if (method_ == KDBuild_SurfaceArea) {
+        buildSAH(context, begin, box, depth);
+    }
+    else {
+        buildFOM(context, begin, box, depth);
+    }
+}
+
+void KDTree::buildLeaf(BuildContext& context, size_t begin) const {
+    KDFlatNode node;
+    node.boundaryValue = 0;
+    node.axisAndChild = KDFlatNode::LeafAxis;
+    node.faceOffset = context.faceIndices.size();
+    node.faceCount = context.indices.size() - begin;
+
+    context.faceIndices.insert(context.faceIndices.end(),
+                               context.indices.begin() + begin,
+                               context.indices.end());
+    context.nodes.push_back(node);
+
+    // pop the faces off the stack
+    context.indices.resize(begin);
+}
+
+void KDTree::buildBlocks(std::vector< std::uint32_t > const& faceIndices,
+                         VertexStorage const& vertices) {
+    FaceStorage const& faces = *faces_;
+
+    blocks_.clear();
+    faceReferences_ = faceIndices.size();
+
+    // next free lane, counted over all blocks
+    std::uint32_t lane = 0;
+
+    for (KDFlatNode& node : nodes_) {
+        std::uint32_t const* faceIndex = faceIndices.data() + node.faceOffset;
+
+        // start a new block, unless the faces fit in what is left of the last
+        if (lane % PacketWidth + node.faceCount > PacketWidth) {
+            lane = blocks_.size() * PacketWidth;
+        }
+        node.faceOffset = lane;
+
+        for (std::uint32_t k = 0; k < node.faceCount; ++k, ++lane) {
+            if (lane % PacketWidth == 0) {
+                blocks_.push_back(TriangleBlock());
+            }
+            blocks_.back().setFace(lane % PacketWidth, faces, faceIndex[k], vertices);
+        }
+    }
+}
+
+void KDTree::appendContext(BuildContext& context, BuildContext const& other) {
+    std::uint32_t nodeOffset = context.nodes.size();
+    std::uint32_t faceOffset = context.faceIndices.size();
+
+    for (KDFlatNode node : other.nodes) {
+        if (!node.isLeaf()) {
+            node.axisAndChild += nodeOffset << 2;
+        }
+        node.faceOffset += faceOffset;
+        context.nodes.push_back(node);
+    }
+
+    context.faceIndices.insert(context.faceIndices.end(),
+                               other.faceIndices.begin(),
+                               other.faceIndices.end());
+}
+
+void KDTree::buildChildren(BuildContext& context, std::uint32_t node,
+                           size_t begin, size_t middle,
+                           BoundingBox const& lessBox, BoundingBox const& moreBox,
+                           int depth) const {
+
+    if (context.indices.size() - begin > parallelThreshold) {
+        // give each subtree a context of its own, and build them in parallel
+        BuildContext lessContext, moreContext;
+        lessContext.indices.assign(context.indices.begin() + middle,
+                                   context.indices.end());
+        moreContext.indices.assign(context.indices.begin() + begin,
+                                   context.indices.begin() + middle);
+        context.indices.resize(begin);
+
+        #pragma omp task shared(lessContext)
+        buildNode(lessContext, 0, lessBox, depth + 1);
+
+        #pragma omp task shared(moreContext)
+        buildNode(moreContext, 0, moreBox, depth + 1);
+
+        #pragma omp taskwait
+
+        // less child directly follows its parent
+        appendContext(context, lessContext);
+        context.nodes[node].axisAndChild |= std::uint32_t(context.nodes.size()) << 2;
+        appendContext(context, moreContext);
+        return;
+    }
+
+    // the less child is on top of the stack, and directly follows its parent
+    buildNode(context, middle, lessBox, depth + 1);
+
+    // once popped, the more child is on top
+    context.nodes[node].axisAndChild |= std::uint32_t(context.nodes.size()) << 2;
+    buildNode(context, begin, moreBox, depth + 1);
+}
+
+KDTree::SplitCandidate KDTree::sweepSAH(int dim,
+                                        std::uint32_t const* faces, size_t count,
+                                        BoundingBox const& box,
+                                        std::vector< SplitEvent >& events) const {
+    SplitCandidate best;
+
+    Point3D const boxMin = box.minPoint();
+    Point3D const boxMax = box.maxPoint();
+    double const area = surfaceArea(boxMin, boxMax);
+
+    // skip dimension if the box is flat in it
+    if (area <= 0 || boxMax[dim] <= boxMin[dim]) {
+        return best;
+    }
+
+    // generate events from the face bounds, clipped to the node
+    events.clear();
+    for (size_t k = 0; k < count; ++k) {
+        BoundingBox const& bound = faceBounds(faces[k]);
+        double low = std::max(bound.minPoint()[dim], boxMin[dim]);
+        double high = std::min(bound.maxPoint()[dim], boxMax[dim]);
+
+        if (low == high) {
+            events.push_back(SplitEvent(low, SplitEvent::Planar));
+        }
+        else {
+            events.push_back(SplitEvent(low, SplitEvent::Start));
+            events.push_back(SplitEvent(high, SplitEvent::End));
+        }
+    }
+    std::sort(events.begin(), events.end());
+
+    // sweep the plane through the events, keeping track of the
+    // number of faces on each side of it
+    unsigned int leftCount = 0;
+    unsigned int rightCount = count;
+    for (size_t i = 0; i < events.size(); ) {
+        double const pos = events[i].pos;
+        unsigned int ending = 0, planar = 0, starting = 0;
+
+        while (i < events.size() && events[i].pos == pos
+                && events[i].type == SplitEvent::End) {
+            ++ending; ++i;
+        }
+        while (i < events.size() && events[i].pos == pos
+                && events[i].type == SplitEvent::Planar) {
+            ++planar; ++i;
+        }
+        while (i < events.size() && events[i].pos == pos
+                && events[i].type == SplitEvent::Start) {
+            ++starting; ++i;
+        }
+
+        // faces ending at or lying on the plane are no longer to the right
+        rightCount -= ending + planar;
+
+        // planes on the node boundary do not divide anything
+        if (boxMin[dim] < pos && pos < boxMax[dim]) {
+            Point3D leftMax = boxMax;
+            leftMax[dim] = pos;
+            Point3D rightMin = boxMin;
+            rightMin[dim] = pos;
+            double leftArea = surfaceArea(boxMin, leftMax) / area;
+            double rightArea = surfaceArea(rightMin, boxMax) / area;
+
+            // faces in the plane go to whichever side is cheaper
+            double costLeft = splitCost(leftArea, rightArea,
+                                        leftCount + planar, rightCount);
+            double costRight = splitCost(leftArea, rightArea,
+                                         leftCount, rightCount + planar);
+
+            if (costLeft < best.cost) {
+                best.dim = dim;
+                best.boundary = pos;
+                best.planarLeft = true;
+                best.cost = costLeft;
+            }
+            if (costRight < best.cost) {
+                best.dim = dim;
+                best.boundary = pos;
+                best.planarLeft = false;
+                best.cost = costRight;
+            }
+        }
+
+        // faces starting at or lying on the plane are now to the left
+        leftCount += starting + planar;
+    }
+
+    return best;
+}
+
+void KDTree::buildSAH(BuildContext& context, size_t begin,
+                      BoundingBox const& box, int depth) const {
+
+    size_t const count = context.indices.size() - begin;
+
+    SplitCandidate split;
+    if (count > 1 && depth < maxDepth_) {
+        SplitCandidate candidates[K];
+        std::uint32_t const* faces = context.indices.data() + begin;
+
+        if (count > parallelThreshold) {
+            // sweep the dimensions in parallel, each with its own events
+            for (int dim = 0; dim < K; ++dim) {
+                #pragma omp task shared(candidates)
+                {
+                    std::vector< SplitEvent > events;
+                    candidates[dim] = sweepSAH(dim, faces, count, box, events);
+                }
+            }
+            #pragma omp taskwait
+        }
+        else {
+            for (int dim = 0; dim < K; ++dim) {
+                candidates[dim] = sweepSAH(dim, faces, count, box, context.events);
+            }
+        }
+
+        for (int dim = 0; dim < K; ++dim) {
+            if (candidates[dim].cost < split.cost) {
+                split = candidates[dim];
+            }
+        }
+    }
 
-    // initialize vector of iterators with all faces
-    std::vector< FaceIter > faceIterators;
-    for (FaceIter it = begin(faces); it != end(faces); ++it) {
-        faceIterators.push_back(it);
+    // stop when no split is cheaper than testing every face
+    if (split.dim < 0 || split.cost >= intersectionCost * blocksOf(count)) {
+        buildLeaf(context, begin);
+        return;
     }
 
-//     std::cout << "starting kd build" << std::endl;
+    int const dim = split.dim;
+    double const boundary = split.boundary;
+
+    // order the faces as: right only, both sides, left only.
+    std::uint32_t* first = context.indices.data() + begin;
+    std::uint32_t* last = first + count;
+    auto goesRight = [&](std::uint32_t face) {
+        BoundingBox const& bound = faceBounds(face);
+        double low = bound.minPoint()[dim];
+        double high = bound.maxPoint()[dim];
+        if (low == boundary && high == boundary) {
+            return !split.planarLeft;
+        }
+        return high > boundary;
+    };
+    auto goesLeft = [&](std::uint32_t face) {
+        BoundingBox const& bound = faceBounds(face);
+        double low = bound.minPoint()[dim];
+        double high = bound.maxPoint()[dim];
+        if (low == boundary && high == boundary) {
+            return split.planarLeft;
+        }
+        return low < boundary;
+    };
+    std::uint32_t* bothBegin = std::partition(first, last,
+            [&](std::uint32_t face) { return !goesLeft(face); });
+    std::uint32_t* leftBegin = std::partition(bothBegin, last,
+            [&](std::uint32_t face) { return goesRight(face); });
+
+    // Faces straddling the plane end up on both sides. The more child
+    // takes [right | both] in place, and the less child gets
+    // [left | copy of both] on top of the stack.
+    size_t const middle = begin + (bothBegin - first);
+    size_t const bothCount = leftBegin - bothBegin;
+    size_t const moreEnd = begin + (leftBegin - first);
+
+    context.indices.resize(context.indices.size() + bothCount);
+    std::copy(context.indices.begin() + middle,
+              context.indices.begin() + middle + bothCount,
+              context.indices.begin() + begin + count);
+
+    // ranges are now [begin, moreEnd) for more, and [moreEnd, end) for less
+    std::uint32_t node = context.nodes.size();
+    KDFlatNode flat;
+    flat.boundaryValue = boundary;
+    flat.axisAndChild = dim;
+    flat.faceOffset = context.faceIndices.size();
+    flat.faceCount = 0;
+    context.nodes.push_back(flat);
+
+    buildChildren(context, node, begin, moreEnd,
+                  ::lessBox(box, dim, boundary), ::moreBox(box, dim, boundary),
+                  depth);
+}
+
+// =========================================
+
+// computes figure of merit
+inline unsigned int computeFOM(unsigned int leftCount,
+                        unsigned int rightCount,
+                        unsigned int sharedCount) {
+    return (leftCount > rightCount ? leftCount - rightCount
+                                   : rightCount - leftCount) + sharedCount;
+}
+
+unsigned int KDTree::computeFOM(KDTree::PlaneEvaluation const& eval) {
+    return ::computeFOM(eval.leftCount, eval.rightCount, eval.sharedCount);
+}
+
+std::pair< size_t, size_t > KDTree::partitionFaces(int dim, double boundary,
+                      std::uint32_t* begin, std::uint32_t* end) const {
+
+    // a face is on the right if all its vertices are at or past the
+    // boundary, on the left if they are all before it, and shared otherwise
+    std::uint32_t* sharedBegin = std::partition(begin, end,
+            [&](std::uint32_t face) {
+                return faceBounds(face).maxPoint()[dim] < boundary;
+            });
+    std::uint32_t* rightBegin = std::partition(sharedBegin, end,
+            [&](std::uint32_t face) {
+                return faceBounds(face).minPoint()[dim] < boundary;
+            });
+
+    return std::make_pair(sharedBegin - begin, rightBegin - begin);
+}
+
+KDTree::PlaneEvaluation KDTree::chooseDimPlane( int dim,
+                                     std::uint32_t* begin, std::uint32_t* end,
+                                     unsigned int extraLeftFaces,
+                                     unsigned int extraRightFaces,
+                                     double min, double max ) const {
 
-    // call recursive function
-    root_.reset(buildHelper(faceIterators, box));
+    while (true) {
+        PlaneEvaluation eval;
+
+        // bisect volume in the current dimension. Planes are
+        // stored in single precision, so faces are classified against
+        // the rounded plane
+        eval.boundary = float((min + max) / 2.0);
+
+        // faces are ordered [left | shared | right]
+        std::pair< size_t, size_t > split = partitionFaces(dim, eval.boundary,
+                                                           begin, end);
+        unsigned int leftFaces = split.first;
+        unsigned int rightFaces = (end - begin) - split.second;
+        eval.sharedCount = split.second - split.first;
+        eval.leftCount = leftFaces + extraLeftFaces;
+        eval.rightCount = rightFaces + extraRightFaces;
+
+        unsigned int fom = computeFOM(eval);
+
+        // Check which side we should bisect further
+        bool bisectRight = false;
+        if ( eval.rightCount > eval.leftCount ) {
+            bisectRight = true;
+            min = eval.boundary;
+        }
+        else {
+            max = eval.boundary; // left side
+        }
+
+        // resolution limit reached, or all faces on boundary,
+        // or figure of merit is lower than threshold, or perfect balance
+        if ( (fabs(max - min) < resolution_) || fom == size_t(end - begin)
+                || fom < fomThreshold_
+                || rightFaces == leftFaces) { 
+            // we are done bisecting so
+            // return the separation of faces, and boundary value
+            return eval;
+        }
+
+        // otherwise, keep bisecting the shared faces and the larger side,
+        // which are contiguous, counting the smaller side as extra
+        if (bisectRight) {
+            extraLeftFaces = eval.leftCount;
+            begin += split.first;
+        }
+        else {
+            extraRightFaces = eval.rightCount;
+            end = begin + split.second;
+        }
+    }
 }
 
+void KDTree::buildFOM(BuildContext& context, size_t begin,
+                      BoundingBox const& box, int depth) const {
 
-// recursive function for building the kd tree
-KDNode* KDTree::buildHelper(std::vector< FaceIter > const& faces, BoundingBox const& box) {
-    
-//     std::cout << "calling buildHelper with numfaces: "
-//               << faces.size() << std::endl;
+    size_t const count = context.indices.size() - begin;
+    std::uint32_t* first = context.indices.data() + begin;
+    std::uint32_t* last = first + count;
 
-    KDNode* node = new KDNode();
     // evaluate all 3 dimensions
     int bestDim = 3;
     PlaneEvaluation bestEval;
     unsigned int bestFom = std::numeric_limits<unsigned int>::max();
-    for (int dim = 0; dim < K; ++dim) {
+    for (int dim = 0; dim < K && count > 0; ++dim) {
         // skip dimension if it is too thin already
         if (fabs(box.maxPoint()[dim] - box.minPoint()[dim]) < resolution_) {
             continue;
         }
 
         // create a divison plane
-        PlaneEvaluation eval = chooseDimPlane( dim, faces, 0, 0,
+        PlaneEvaluation eval = chooseDimPlane( dim, first, last, 0, 0,
                 box.minPoint()[dim],
                 box.maxPoint()[dim]);
         unsigned int fom = computeFOM(eval);
-//         std::cout << "dim fom: " << fom << std::endl;
         if (fom < bestFom) {
-            bestEval = std::move(eval);
+            bestEval = eval;
             bestDim = dim;
             bestFom = fom;
         }
     }
 
-    node->dim = bestDim;
-
     // if we reach termination conditions, stop recursing
-    if ( (bestFom >= faces.size())
-            || (bestFom < fomThreshold_) ) {
-        node->faces = faces;
-        node->faceBound = getBoundingBox(node->faces);
-        return node;
+    if ( (bestFom >= count)
+            || (bestFom < fomThreshold_)
+            || depth >= maxDepth_ ) {
+        buildLeaf(context, begin);
+        return;
     }
 
-    // update the boundary value
-    node->boundaryValue = bestEval.boundary;
-    // any faces that sit on the boundary will be allocated to this node
-    node->faces = std::move(bestEval.sharedFaces);
-    node->faceBound = getBoundingBox(node->faces);
+    // faces were reordered by the other dimensions, so partition again,
+    // this time as [right | left | shared]
+    std::pair< size_t, size_t > split = partitionFaces(bestDim,
+                                                       bestEval.boundary,
+                                                       first, last);
+    std::rotate(first, first + split.second, last);
+    size_t const rightCount = count - split.second;
+    size_t const middle = begin + rightCount;
+    size_t const sharedBegin = middle + split.first;
 
-//     std::cout << "sharedFaces: " << bestEval.sharedFaces.size()
-//               << " leftFaces: " <<  bestEval.leftFaces.size()
-//               << " rightFaces: " << bestEval.rightFaces.size()
-//               << " fom: " << bestFom 
-//               << " dim: " << node->dim
-//               << " boundary: " << node->boundaryValue
-//               << std::endl;
+    // any faces that sit on the boundary will be allocated to this node
+    std::uint32_t node = context.nodes.size();
+    KDFlatNode flat;
+    flat.boundaryValue = bestEval.boundary;
+    flat.axisAndChild = bestDim;
+    flat.faceOffset = context.faceIndices.size();
+    flat.faceCount = count - rightCount - split.first;
+    context.faceIndices.insert(context.faceIndices.end(),
+                               context.indices.begin() + sharedBegin,
+                               context.indices.end());
+    context.nodes.push_back(flat);
+    context.indices.resize(sharedBegin);
 
     // recursively create nodes for left and right sides of the boundary
-    if (bestEval.leftFaces.size() > 0) {
-        Point3D maxPoint = box.maxPoint();
-        maxPoint[bestDim] = bestEval.boundary;
-        BoundingBox innerBox(box.minPoint(), maxPoint);
-        node->lessNode.reset(buildHelper(bestEval.leftFaces, 
-                                    innerBox));
-    }
-
-    if (bestEval.rightFaces.size() > 0) {
-        Point3D minPoint = box.minPoint();
-        minPoint[bestDim] = bestEval.boundary;
-        BoundingBox innerBox(minPoint, box.maxPoint());
-        node->moreNode.reset(buildHelper(bestEval.rightFaces, 
-                                    innerBox));
-    }
-
-    return node;
+    buildChildren(context, node, begin, middle,
+                  ::lessBox(box, bestDim, bestEval.boundary),
+                  ::moreBox(box, bestDim, bestEval.boundary),
+                  depth);
 }
 
 void KDTree::clear() {
-    root_.reset();
+    nodes_.clear();
+    blocks_.clear();
+    faceReferences_ = 0;
+}
+
+template <typename Visitor>
+void KDTree::walk(Point3D const& origin, Vector3D const& dir,
+                  double tNear, double tFar, Visitor visit) const {
+
+    // far halves of nodes still to be visited, with the ray segment in them
+    struct StackEntry {
+        std::uint32_t node;
+        double tNear;
+        double tFar;
+    };
+    StackEntry stack[MaxDepth];
+    int stackSize = 0;
+
+    std::uint32_t index = 0;
+
+    while (true) {
+        KDFlatNode const& node = nodes_[index];
+
+        if ( visit(node, tFar) ) {
+            return;
+        }
+
+        if ( !node.isLeaf() ) {
+            // determine where the ray segment is situated,
+            // relative to the division boundary.
+            int const dim = node.dim();
+            double const boundary = node.boundaryValue;
+            double const start = origin[dim] + tNear * dir[dim];
+
+            // see if the ray starts on the left or right side of the
+            // boundary. If it starts on the boundary, the direction decides.
+            bool startsOnLeft = (start < boundary)
+                || (start == boundary && dir[dim] < 0);
+
+            std::uint32_t nearNode = startsOnLeft ? index + 1 : node.moreChild();
+            std::uint32_t farNode = startsOnLeft ? node.moreChild() : index + 1;
+
+            // a ray parallel to the boundary never crosses it
+            double tBoundary = (dir[dim] == 0)
+                ? std::numeric_limits<double>::infinity()
+                : (boundary - origin[dim]) / dir[dim];
+
+            // if the plane intersection occurs within the ray segment,
+            // the far half is visited after the near one
+            if ( tNear < tBoundary && tBoundary < tFar ) {
+                stack[stackSize].node = farNode;
+                stack[stackSize].tNear = tBoundary;
+                stack[stackSize].tFar = tFar;
+                ++stackSize;
+                tFar = tBoundary;
+            }
+
+            index = nearNode;
+            continue;
+        }
+
+        if (stackSize == 0) {
+            return;
+        }
+
+        --stackSize;
+        index = stack[stackSize].node;
+        tNear = stack[stackSize].tNear;
+        tFar = stack[stackSize].tFar;
+    }
 }
 
 void KDTree::traverse(Point3D const& origin,
@@ -186,7 +758,7 @@ void KDTree::traverse(Point3D const& origin,
         FaceIntersection& intersection) const {
 
     // if tree is empty, no intersection
-    if (!root_) {
+    if (nodes_.empty()) {
         return;
     }
 
@@ -197,280 +769,355 @@ void KDTree::traverse(Point3D const& origin,
         return;
     }
 
-    // now that we have tNear and tFar to restrict the ray segment
-    // to the bounding volume, we can start the recursion
-    traverse(root_.get(), origin, dir, tNear, tFar, intersection);
+    bool intersected = false;
+
+    walk(origin, dir, tNear, tFar,
+        [&](KDFlatNode const& node, double segmentEnd) {
+            // intersect all faces residing at this node
+            TriangleBlock const* blocks = blocks_.data() + node.firstBlock();
+            for (std::uint32_t b = 0; b < node.blockCount(); ++b) {
+                if (intersectBlock(blocks[b], *faces_, origin, dir, 0.0, intersection)) {
+                    intersected = true;
+                }
+            }
+
+            // nodes are visited front to back, and faces of the remaining
+            // nodes lie past this segment, so a hit within it is the closest
+            return node.isLeaf() && intersected
+                && intersection.t_value <= segmentEnd;
+        });
 }
 
-bool KDTree::traverse(KDNode* node, Point3D const& origin, Vector3D const& dir,
-                  double tNear, double tFar,
-                  FaceIntersection& intersection) const {
+bool KDTree::occluded(Point3D const& origin,
+        Vector3D const& dir,
+        double tMin, double tMax) const {
 
-    // if node is null, no intersections
-    if ( !node ) {
+    if (nodes_.empty()) {
         return false;
     }
 
-    // intersect all faces directly on the boundary
-    bool intersectedHere = false;
-    if (node->faces.size() > 0) {
-        if ( node->faceBound.fastIntersect(origin, dir) ) {
-            intersectedHere = node->intersectFaces(origin, dir, intersection);
-        }
+    // only the part of the segment within the bounding box matters
+    double tNear, tFar;
+    if ( !box_.fastIntersect(origin, dir, tNear, tFar) ) {
+        return false;
     }
-
-    // if this is a leaf, we are done
-    if ( node->isLeaf() ) {
-        return intersectedHere;
+    tNear = std::max(tNear, tMin);
+    tFar = std::min(tFar, tMax);
+    if (tNear > tFar) {
+        return false;
     }
 
-    // now we have to determine where the ray segment is situated,
-    // relative to the division boundary.
+    bool intersected = false;
 
-    // set up a few useful variables
-    Point3D startPoint = getInterPoint(tNear, origin, dir);
-    int const& dim = node->dim; // dimension of the boundary plane
-    double tBoundary = 0;   // t_value at boundary
-    bool rayCrosses;        // boolean whether ray crosses boundary plane
+    walk(origin, dir, tNear, tFar,
+        [&](KDFlatNode const& node, double) {
+            TriangleBlock const* blocks = blocks_.data() + node.firstBlock();
+            for (std::uint32_t b = 0; b < node.blockCount(); ++b) {
+                // only accept intersections within the segment
+                FaceIntersection intersection;
+                intersection.t_value = tMax;
 
-    // intersect the ray with the boundary plane
-    if (dir[dim] == 0) {
-        // if the ray is parallel to the boundary
-        // and is on the boundary then we are done, since
-        // all boundary faces have been intersected
-        if ( origin[dim] == node->boundaryValue ) {
-            return intersectedHere;
-        }
-        rayCrosses = false;
-    }
-    else {
-        tBoundary = (node->boundaryValue - origin[dim]) / dir[dim];
-        // determine whether the plane intersection occurs within or outside
-        // the ray segment
-        rayCrosses = ( tNear < tBoundary && tBoundary < tFar);
-    }
+                if (intersectBlock(blocks[b], *faces_, origin, dir, tMin, intersection)) {
+                    intersected = true;
+                    return true;
+                }
+            }
+            return false;
+        });
 
-    // see if the ray starts on the left or right side of the boundary
-    bool startsOnLeft = (startPoint[dim] < node->boundaryValue);
+    return intersected;
+}
 
-    // with the path of the ray determined, determine how to
-    // proceed with the recursion
+template <typename Visitor>
+void KDTree::walkPacket(RayPacket const& packet, LaneMask mask,
+                        double const* tNear, double const* tFar, Visitor visit) const {
+
+    // all lanes agree on which child of a node they reach first
+    const int first = firstLane(mask);
+    bool positive[3];
+    Double4 origin[3], invDir[3];
+    for (int dim = 0; dim < 3; ++dim) {
+        positive[dim] = packet.dir[dim][first] > 0;
+        origin[dim] = Double4::load(packet.origin[dim]);
+        invDir[dim] = Double4(1.0) / Double4::load(packet.dir[dim]);
+    }
 
-    // if the ray doesn't cross the boundary, we only
-    // have to look at one half of volume
-    if ( !rayCrosses ) {
-        if ( startsOnLeft && node->lessNode ) {
-            if (traverse(node->lessNode.get(), origin, dir, tNear, tFar, intersection) ) {
-                return true;
+    // far halves of nodes still to be visited, with the lanes
+    // reaching them, and their ray segments in them
+    struct StackEntry {
+        std::uint32_t node;
+        LaneMask mask;
+        Double4 tNear;
+        Double4 tFar;
+    };
+    StackEntry stack[MaxDepth];
+    int stackSize = 0;
+
+    std::uint32_t index = 0;
+    LaneMask active = mask; // lanes piercing the current node
+    LaneMask alive = mask;  // lanes not done yet
+    Double4 segmentNear = Double4::load(tNear);
+    Double4 segmentFar = Double4::load(tFar);
+
+    while (true) {
+        KDFlatNode const& node = nodes_[index];
+
+        alive &= ~visit(node, active, segmentFar);
+        active &= alive;
+
+        if ( active && !node.isLeaf() ) {
+            int const dim = node.dim();
+            Double4 tBoundary = (Double4(node.boundaryValue) - origin[dim]) * invDir[dim];
+
+            // lanes with part of their segment before the boundary visit
+            // the near child, lanes with part after it the far one
+            LaneMask toNear = active & (segmentNear < tBoundary);
+            LaneMask toFar = active & ((tBoundary < segmentFar) | ~toNear);
+
+            std::uint32_t nearNode = positive[dim] ? index + 1 : node.moreChild();
+            std::uint32_t farNode = positive[dim] ? node.moreChild() : index + 1;
+
+            if (!toNear) {
+                segmentNear = max(segmentNear, tBoundary);
+                active = toFar;
+                index = farNode;
+                continue;
             }
-        }
-        else if ( !startsOnLeft && node->moreNode ) {
-            if (traverse(node->moreNode.get(), origin, dir, tNear, tFar, intersection) ) {
-                return true;
-            }
-        }
-    }
-    else {
-        // at this point we know the ray has crossed the boundary
-        if ( startsOnLeft && node->lessNode ) {
-            if (traverse(node->lessNode.get(), origin, dir, tNear, tBoundary, intersection) ) {
-                return true;
+
+            if (toFar) {
+                stack[stackSize].node = farNode;
+                stack[stackSize].mask = toFar;
+                stack[stackSize].tNear = max(segmentNear, tBoundary);
+                stack[stackSize].tFar = segmentFar;
+                ++stackSize;
             }
-            return traverse(node->moreNode.get(), origin, dir, tBoundary, tFar, intersection)
-                || intersectedHere;
+
+            segmentFar = min(segmentFar, tBoundary);
+            active = toNear;
+            index = nearNode;
+            continue;
         }
-        else if ( !startsOnLeft && node->moreNode ) {
-            if (traverse(node->moreNode.get(), origin, dir, tNear, tBoundary, intersection) ) {
-                return true;
+
+        // skip queued nodes whose lanes are all done
+        do {
+            if (stackSize == 0) {
+                return;
             }
-            return traverse(node->lessNode.get(), origin, dir, tBoundary, tFar, intersection)
-                || intersectedHere;
+            --stackSize;
+            active = stack[stackSize].mask & alive;
+        } while (!active);
+
+        index = stack[stackSize].node;
+        segmentNear = stack[stackSize].tNear;
+        segmentFar = stack[stackSize].tFar;
+    }
+}
+
+void KDTree::traverse(RayPacket const& packet, LaneMask mask,
+        FaceIntersection* intersections) const {
+
+    if (nodes_.empty()) {
+        return;
+    }
+
+    // clip each lane to the overall bounding box
+    Point3D origin[PacketWidth];
+    Vector3D dir[PacketWidth];
+    double tNear[PacketWidth] = { 0 };
+    double tFar[PacketWidth] = { 0 };
+
+    LaneMask inside = 0;
+    for (LaneMask m = mask; m; m &= m - 1) {
+        int lane = firstLane(m);
+        origin[lane] = packet.originOf(lane);
+        dir[lane] = packet.dirOf(lane);
+        if ( box_.fastIntersect(origin[lane], dir[lane], tNear[lane], tFar[lane]) ) {
+            inside |= 1u << lane;
         }
     }
 
-    return intersectedHere;
-}
+    LaneMask intersected = 0;
+    FaceIntersectionPacket hits;
 
-// Move elements from the second vector into the first.
-// Second vector is empty after the tranfser
-template <typename T>
-void transferElements(std::vector<T>& accumulator, std::vector<T>& other) {
-    typedef typename std::vector<T>::const_iterator iter;
-    for (auto const& elem : other) {
-        accumulator.push_back(elem);
+    Double4 laneOrigin[3], laneDir[3];
+    for (int dim = 0; dim < 3; ++dim) {
+        laneOrigin[dim] = Double4::load(packet.origin[dim]);
+        laneDir[dim] = Double4::load(packet.dir[dim]);
     }
-    other.clear();
-}
 
-// computes figure of merit
-inline unsigned int computeFOM(unsigned int leftCount,
-                        unsigned int rightCount,
-                        unsigned int sharedCount) {
-    return abs(leftCount - rightCount) + sharedCount;
-}
+    while (inside) {
+        LaneMask group = packet.sameSigns(inside);
+        inside &= ~group;
 
-inline unsigned int KDTree::computeFOM(KDTree::PlaneEvaluation const& eval) {
-    return ::computeFOM(eval.leftFaces.size() + eval.extraLeftFaces,
-                        eval.rightFaces.size() + eval.extraRightFaces,
-                        eval.sharedFaces.size());
-}
+        // nothing to share the walk with
+        if ( (group & (group - 1)) == 0 ) {
+            int lane = firstLane(group);
+            traverse(origin[lane], dir[lane], intersections[lane]);
+            continue;
+        }
 
-// return the depth of the tree
-unsigned int KDTree::depth(KDNode* node) {
+        walkPacket(packet, group, tNear, tFar,
+            [&](KDFlatNode const& node, LaneMask active, Double4 const& segmentEnd) {
+                // intersect all faces residing at this node
+                std::uint32_t const end = node.faceOffset + node.faceCount;
+                for (std::uint32_t k = node.faceOffset; k < end; ++k) {
+                    intersected |= intersectBlockFace(blocks_[k / PacketWidth], k % PacketWidth,
+                                                      *faces_, laneOrigin, laneDir,
+                                                      Double4(0.0), active, hits);
+                }
 
-    if (!node) {
-        return 0;
+                // as for single rays, a hit within the segment of a leaf
+                // is the closest
+                if (!node.isLeaf()) {
+                    return LaneMask(0);
+                }
+                return active & intersected & (Double4::load(hits.t_value) <= segmentEnd);
+            });
+
+        for (LaneMask m = group & intersected; m; m &= m - 1) {
+            int lane = firstLane(m);
+            intersections[lane].face = hits.face[lane];
+            intersections[lane].t_value = hits.t_value[lane];
+            intersections[lane].s = hits.s[lane];
+            intersections[lane].t = hits.t[lane];
+        }
     }
-
-    return 1 + std::max(depth(node->lessNode.get()), depth(node->moreNode.get()));
 }
 
-// return the maximum number of objects at the leaves
-unsigned int KDTree::maxLeafObjects(KDNode* node) {
-    if (!node) {
-        return 0;
-    } 
-    
-//     std::cout << "faces at node: " << node->faces.size() << std::endl;
+LaneMask KDTree::occluded(RayPacket const& packet, LaneMask mask,
+        double const* tMin, double const* tMax) const {
 
-    // if this is a leaf return number of faces
-    if (node->isLeaf()) {
-        return node->faces.size();
+    if (nodes_.empty()) {
+        return 0;
     }
 
-    // otherwise recursively query children for maximum leaf objects
-    return std::max(maxLeafObjects(node->lessNode.get()), maxLeafObjects(node->moreNode.get()));
-}
-
-// merge the two PlaneEvaluation structs
-void KDTree::transferEvaluations(PlaneEvaluation& accumulator, PlaneEvaluation& other) {
-    accumulator.boundary = other.boundary;
-    transferElements( accumulator.leftFaces  , other.leftFaces   );
-    transferElements( accumulator.rightFaces , other.rightFaces  );
-    transferElements( accumulator.sharedFaces, other.sharedFaces );
-}
+    // only the part of each segment within the bounding box matters
+    Point3D origin[PacketWidth];
+    Vector3D dir[PacketWidth];
+    double tNear[PacketWidth] = { 0 };
+    double tFar[PacketWidth] = { 0 };
+
+    LaneMask inside = 0;
+    for (LaneMask m = mask; m; m &= m - 1) {
+        int lane = firstLane(m);
+        origin[lane] = packet.originOf(lane);
+        dir[lane] = packet.dirOf(lane);
+        if ( box_.fastIntersect(origin[lane], dir[lane], tNear[lane], tFar[lane]) ) {
+            tNear[lane] = std::max(tNear[lane], tMin[lane]);
+            tFar[lane] = std::min(tFar[lane], tMax[lane]);
+            if (tNear[lane] <= tFar[lane]) {
+                inside |= 1u << lane;
+            }
+        }
+    }
 
-KDTree::PlaneEvaluation KDTree::chooseDimPlane( int dim,
-                                     std::vector< FaceIter > const& faces,
-                                     unsigned int extraLeftFaces,
-                                     unsigned int extraRightFaces,
-                                     double min, double max ) {
+    LaneMask blocked = 0;
 
-//     std::cout << "choose dim plane called with min: " << min
-//               << " max: " << max 
-//               << " numfaces: " << faces.size()
-//               << std::endl;
+    // faces are only tested until the first hit of a lane,
+    // so its closest intersection stays at the end of its segment
+    FaceIntersectionPacket hits;
+    std::copy(tMax, tMax + PacketWidth, hits.t_value);
 
-    unsigned int fom = std::numeric_limits<unsigned int>::max();
+    Double4 laneOrigin[3], laneDir[3];
+    for (int dim = 0; dim < 3; ++dim) {
+        laneOrigin[dim] = Double4::load(packet.origin[dim]);
+        laneDir[dim] = Double4::load(packet.dir[dim]);
+    }
+    Double4 laneMin = Double4::load(tMin);
 
-    PlaneEvaluation eval;
-    eval.extraLeftFaces = extraLeftFaces;
-    eval.extraRightFaces = extraRightFaces;
+    while (inside) {
+        LaneMask group = packet.sameSigns(inside);
+        inside &= ~group;
 
-    // bisect volume in the current dimension
-    eval.boundary = (min + max) / 2.0;
+        if ( (group & (group - 1)) == 0 ) {
+            int lane = firstLane(group);
+            if (occluded(origin[lane], dir[lane], tMin[lane], tMax[lane])) {
+                blocked |= group;
+            }
+            continue;
+        }
 
-    evaluatePlane(dim, faces, eval);
-    fom = computeFOM(eval);
+        walkPacket(packet, group, tNear, tFar,
+            [&](KDFlatNode const& node, LaneMask active, Double4 const&) {
+                // only accept intersections within the segments
+                LaneMask found = 0;
+                std::uint32_t const end = node.faceOffset + node.faceCount;
+                for (std::uint32_t k = node.faceOffset; k < end && found != active; ++k) {
+                    found |= intersectBlockFace(blocks_[k / PacketWidth], k % PacketWidth,
+                                                *faces_, laneOrigin, laneDir, laneMin,
+                                                active & ~found, hits);
+                }
 
-    // Check which side we should bisect further
-    bool bisectRight = false;
-    if ( eval.rightCount() > eval.leftCount() ) {
-        bisectRight = true;
-        min = eval.boundary;
-    }
-    else {
-        max = eval.boundary; // left side
-    }
-
-    // resolution limit reached, or all faces on boundary,
-    // or figure of merit is lower than threshold, or perfect balance
-    if ( (fabs(max - min) < resolution_) || fom == faces.size()
-            || fom < fomThreshold_
-            || eval.rightFaces.size() == eval.leftFaces.size()) { 
-//         std::cout << "termination condition reached! "
-//                   << (fabs(max - min) < resolution_)
-//                   << (fom == faces.size())
-//                   << (fom < fomThreshold_)
-//                   << (eval.rightCount() == eval.leftCount()) << std::endl;
-        // we are done bisecting so
-        // return the separation of faces, and boundary value
-        return eval;
-    }
-
-//     std::cout << "sharedFaces: " << eval.sharedFaces.size()
-//               << " leftFaces: " << eval.leftFaces.size()
-//               << " rightFaces: " << eval.rightFaces.size()
-//               << " fom: " << fom
-//               << std::endl;
-
-    // otherwise, bisect the faces
-
-    // populate the faces that need to be further separated
-    std::vector< FaceIter > newFaces;
-    transferElements(newFaces, eval.sharedFaces);
-    if (bisectRight) {
-        extraLeftFaces = eval.leftCount();
-        transferElements(newFaces, eval.rightFaces);
+                blocked |= found;
+                return found;
+            });
     }
-    else {
-        extraRightFaces = eval.rightCount();
-        transferElements(newFaces, eval.leftFaces);
-    }
-
-    // recursively evaluate the smaller subset of faces
-    PlaneEvaluation newEval = chooseDimPlane(dim, newFaces,
-                                             extraLeftFaces,
-                                             extraRightFaces,
-                                             min, max);
-    // merge the evaluations
-    transferEvaluations(eval, newEval);
-    // and pass the combined result back up
-    return eval;
+
+    return blocked;
 }
 
-unsigned int KDTree::countTotalFaces() {
-    if (!root_) {
-        return 0;
+// return the depth of the tree
+unsigned int KDTree::depth(std::uint32_t index) const {
+    KDFlatNode const& node = nodes_[index];
+    if (node.isLeaf()) {
+        return 1;
     }
 
-    return count(root_.get());
+    return 1 + std::max(depth(index + 1), depth(node.moreChild()));
 }
 
-unsigned int KDTree::count(KDNode* node) {
-
-    unsigned int total = node->faces.size();
-
-    if (node->lessNode) {
-        total += count(node->lessNode.get());
-    }
+// return the maximum number of objects at the leaves
+unsigned int KDTree::maxLeafObjects(std::uint32_t index) const {
+    KDFlatNode const& node = nodes_[index];
 
-    if (node->moreNode) {
-        total += count(node->moreNode.get());
+    // if this is a leaf return number of faces
+    if (node.isLeaf()) {
+        return node.faceCount;
     }
 
-    return total;
+    // otherwise recursively query children for maximum leaf objects
+    return std::max(maxLeafObjects(index + 1), maxLeafObjects(node.moreChild()));
 }
-    
-void KDTree::evaluatePlane(int dim, std::vector< FaceIter > const& faces,
-                           PlaneEvaluation& eval ) {
 
-    // for each face, see which side of the boundary it is on
-    for (auto const& faceIter : faces) {
-        Face const& face = *faceIter;
+void KDTree::accumulateCost(std::uint32_t index, BoundingBox const& box,
+                            double& nodes, double& blocks) const {
+    KDFlatNode const& node = nodes_[index];
 
-        // count of vertices on the right side of boundary
-        int vertexCount = 0;
-        // look at each vertex
-        for (int i = 0; i < 3; ++i) {
-            if (face.vertices[i].point[dim] < eval.boundary) { vertexCount--; }
-            else { vertexCount++; }
-        }
+    // probability of a ray through the root also passing through this node
+    double rootArea = surfaceArea(box_);
+    double probability = rootArea > 0 ? surfaceArea(box) / rootArea : 1.0;
+
+    nodes += probability;
+    blocks += probability * node.blockCount();
+
+    if (!node.isLeaf()) {
+        Point3D maxPoint = box.maxPoint();
+        maxPoint[node.dim()] = node.boundaryValue;
+        accumulateCost(index + 1,
+                       BoundingBox(box.minPoint(), maxPoint), nodes, blocks);
 
-        // update lists
-        if      (vertexCount == 3)  { eval.rightFaces.push_back(faceIter); }
-        else if (vertexCount == -3) { eval.leftFaces.push_back(faceIter); }
-        else                        { eval.sharedFaces.push_back(faceIter); }
+        Point3D minPoint = box.minPoint();
+        minPoint[node.dim()] = node.boundaryValue;
+        accumulateCost(node.moreChild(),
+                       BoundingBox(minPoint, box.maxPoint()), nodes, blocks);
     }
 }
 
+void KDTree::printStatistics(std::ostream& out) const {
+    double nodes = 0;
+    double blocks = 0;
+    if (!nodes_.empty()) {
+        accumulateCost(0, box_, nodes, blocks);
+    }
+
+    out << "kd build ("
+        << (method_ == KDBuild_SurfaceArea ? "sah" : "fom") << "): "
+        << buildTime_ << "s"
+        << " nodes: " << nodes_.size()
+        << " (" << nodes_.size() * sizeof(KDFlatNode)
+                   + blocks_.size() * sizeof(TriangleBlock) << " bytes)"
+        << " expected per ray - nodes: " << nodes
+        << " blocks: " << blocks
+        << " cost: " << traversalCost*nodes + intersectionCost*blocks
+        << std::endl;
+}
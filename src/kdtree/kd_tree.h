@@ -1,41 +1,70 @@
 #ifndef _KD_TREE_H_
 #define _KD_TREE_H_
 
-#include "../mesh/obj_store.h"
+#include "../mesh/face.h"
 #include "../bounding_volume.h"
+#include "../ray_packet.h"
 #include <memory>
+#include <vector>
+#include <limits>
+#include <ostream>
+#include <cstdint>
 
-typedef std::vector< Face > FaceStorage;
 typedef FaceStorage::const_iterator FaceIter;
 
-// TODO: Binary tree, so could be stored in a vector for cache locality
-// TODO: move semantics
+/**
+ * Algorithms available for choosing the splitting planes of a KDTree.
+ */
+enum KDBuildMethod {
+    /**
+     * Minimize the expected cost of a ray traversing the tree, using the
+     * surface area heuristic. Faces straddling a plane are sent to both
+     * children, so only leaves hold faces.
+     */
+    KDBuild_SurfaceArea,
+    /**
+     * Bisect space, scoring planes by the balance of faces on either side
+     * plus the number of faces on the plane, which are kept at the
+     * interior node.
+     */
+    KDBuild_FigureOfMerit
+};
 
-struct KDNode {
-    KDNode();
-    ~KDNode();
+/**
+ * Compact node of a built kd tree, stored in a contiguous array
+ * in depth-first order. The less child of an interior node
+ * directly follows it, so only the index of the more child is kept.
+ */
+struct KDFlatNode {
+    static const std::uint32_t LeafAxis = 3;
 
-    bool isLeaf() { return !lessNode && !moreNode; }
-    bool intersectFaces(Point3D const& origin,
-                        Vector3D const& dir,
-                        FaceIntersection& intersection) const;
-    
-    std::vector< FaceIter > faces; ///< faces residing at this node
-    BoundingBox faceBound; ///< a bounding box around the faces at this node
-    
-    /**
-     * Value of separating boundary of this node in 
-     * the separating dimension dim */
-    double boundaryValue;
-    int dim; ///< dimension of separating boundary
+    float boundaryValue; ///< position of the separating plane
+
+    /** dimension of the plane in the low 2 bits (LeafAxis for leaves),
+     * index of the more child in the rest */
+    std::uint32_t axisAndChild;
 
-    // pointers to child nodes of the tree
     /**
-     * subtree holding all faces whose vertices' coordinates
-     * are smaller than the boundary value in dimension dim */
-    std::unique_ptr<KDNode> lessNode;
-    std::unique_ptr<KDNode> moreNode; ///< other subtree
+     * first face of the node: its position in the face index array while
+     * building, then its lane among all lanes of the triangle blocks
+     */
+    std::uint32_t faceOffset;
+    std::uint32_t faceCount;  ///< number of faces at this node
+
+    int dim() const { return axisAndChild & 3; }
+    bool isLeaf() const { return dim() == LeafAxis; }
+    std::uint32_t moreChild() const { return axisAndChild >> 2; }
 
+    /** index of the first triangle block holding the faces of the node */
+    std::uint32_t firstBlock() const { return faceOffset / PacketWidth; }
+
+    /**
+     * number of triangle blocks holding the faces of the node. The first
+     * and last of them may also hold faces of neighbouring leaves.
+     */
+    std::uint32_t blockCount() const {
+        return faceCount ? (faceOffset % PacketWidth + faceCount - 1) / PacketWidth + 1 : 0;
+    }
 };
 
 /**
@@ -51,10 +80,15 @@ public:
     ~KDTree();
 
     /**
-     * Given a container with Face objects, build a KD tree
-     * that holds vectors of iterators into that container
+     * Given a container with Face objects, with their vertices in
+     * @a vertices, build a KD tree that holds indices into that container.
+     * Only @a faces has to outlive the tree.
+     *
+     * The top of the tree is built in parallel tasks, so this should
+     * be called outside of a parallel region to make use of all cores.
      */
-    void build(FaceStorage const& faces, BoundingBox const& box);
+    void build(FaceStorage const& faces, VertexStorage const& vertices,
+               BoundingBox const& box, KDBuildMethod method = KDBuild_SurfaceArea);
 
     /**
      * Find closest intersection with a face in the KD tree.
@@ -63,132 +97,241 @@ public:
                   Vector3D const& dir,
                   FaceIntersection& intersection) const;
 
+    /**
+     * @Return true if any face is intersected with a t_value
+     * between @a tMin and @a tMax. Stops at the first one found.
+     */
+    bool occluded(Point3D const& origin,
+                  Vector3D const& dir,
+                  double tMin, double tMax) const;
+
+    /**
+     * Find the closest intersection with a face for each lane of @a packet
+     * in @a mask, storing it in @a intersections (one per lane).
+     *
+     * Lanes heading the same way through every dimension walk the tree
+     * together, others are traced one at a time.
+     */
+    void traverse(RayPacket const& packet, LaneMask mask,
+                  FaceIntersection* intersections) const;
+
+    /**
+     * @Return the lanes of @a mask whose rays intersect a face with a
+     * t_value between their @a tMin and @a tMax (one per lane).
+     */
+    LaneMask occluded(RayPacket const& packet, LaneMask mask,
+                      double const* tMin, double const* tMax) const;
+
     /**
      * @Return the total number of faces stored in the kd tree
      */
-    unsigned int countTotalFaces();
+    unsigned int countTotalFaces() const { return faceReferences_; }
 
     /**
      * @Return the depth of the tree
      */
-    unsigned int depth() { return depth(root_.get()); }
+    unsigned int depth() const { return nodes_.empty() ? 0 : depth(0); }
 
     /**
      * @Return the maximum number of objects at the leaves
      */
-    unsigned int maxLeafObjects() { return maxLeafObjects(root_.get()); }
+    unsigned int maxLeafObjects() const {
+        return nodes_.empty() ? 0 : maxLeafObjects(0);
+    }
 
     /**
      * clear the contents of the tree
      */
     void clear();
 
+    /**
+     * Print statistics of the tree to @a out: build time and the expected
+     * number of nodes visited and faces tested by a ray crossing the
+     * bounding box, assuming rays are distributed uniformly.
+     *
+     * Useful for comparing the quality of different build methods.
+     */
+    void printStatistics(std::ostream& out) const;
+
 private:
 
-    enum PlaneSide {
-        PlaneSide_Left,
-        PlaneSide_Right,
-        PlaneSide_Neither,
-    };
+    /**
+     * Visit the nodes pierced by the ray segment [@a tNear, @a tFar]
+     * front to back, calling @a visit with each node and the end of the
+     * segment within it. Stops once @a visit returns true.
+     */
+    template <typename Visitor>
+    void walk(Point3D const& origin, Vector3D const& dir,
+              double tNear, double tFar, Visitor visit) const;
 
+    /**
+     * Walk the lanes @a mask of @a packet through the tree together,
+     * each over its segment [@a tNear, @a tFar] (one per lane). A node is
+     * visited if any of the lanes pierces it: @a visit is called with the
+     * node, the lanes piercing it and the end of their segments within it,
+     * and returns the lanes that are done. Stops once all lanes are done.
+     *
+     * ASSUMPTION: the directions of the lanes have the same signs
+     * in every dimension, none of them zero.
+     */
+    template <typename Visitor>
+    void walkPacket(RayPacket const& packet, LaneMask mask,
+                    double const* tNear, double const* tFar, Visitor visit) const;
+
+    /**
+     * Result of evaluating a figure of merit plane:
+     * the number of faces on either side of it, and on it.
+     */
     struct PlaneEvaluation {
         PlaneEvaluation() : boundary(0),
-                            extraLeftFaces(0),
-                            extraRightFaces(0) { }
-
-        // implement move semantics
-        PlaneEvaluation(PlaneEvaluation && r)
-            : boundary(r.boundary),
-            leftFaces(std::move(r.leftFaces)),
-            sharedFaces(std::move(r.sharedFaces)),
-            rightFaces(std::move(r.rightFaces)),
-            extraLeftFaces(r.extraLeftFaces),
-            extraRightFaces(r.extraRightFaces) {
-
-        }
-
-        PlaneEvaluation& operator= (PlaneEvaluation && r) {
-            boundary = r.boundary;
-            leftFaces = std::move(r.leftFaces);
-            sharedFaces = std::move(r.sharedFaces);
-            rightFaces = std::move(r.rightFaces);
-            extraLeftFaces = r.extraLeftFaces;
-            extraRightFaces = r.extraRightFaces;
-            return *this;
-        }
-
-        unsigned int leftCount() const {
-            return leftFaces.size() + extraLeftFaces;
-        }
-        unsigned int rightCount() const {
-            return leftFaces.size() + extraRightFaces;
-        }
+                            leftCount(0),
+                            sharedCount(0),
+                            rightCount(0) { }
 
         double boundary;
-        std::vector< FaceIter > leftFaces;
-        std::vector< FaceIter > sharedFaces;
-        std::vector< FaceIter > rightFaces;
-
-        // counts of faces not within this segment (outside of segment)
-        // that should be taken into account for the figure of merit
-        unsigned int extraLeftFaces;
-        unsigned int extraRightFaces;
+        unsigned int leftCount;
+        unsigned int sharedCount;
+        unsigned int rightCount;
+    };
+
+    /**
+     * A splitting plane chosen by the surface area heuristic
+     */
+    struct SplitCandidate {
+        SplitCandidate() : dim(-1),
+                           boundary(0),
+                           planarLeft(true),
+                           cost(std::numeric_limits<double>::infinity()) { }
+
+        int dim;          ///< dimension of the splitting plane
+        double boundary;  ///< position of the plane in dimension dim
+        bool planarLeft;  ///< whether faces lying on the plane go to the left
+        double cost;      ///< expected cost of traversing the split node
     };
 
+    struct SplitEvent;
+    struct BuildContext;
+
+    /**
+     * Build the subtree over the face indices from @a begin to the end of
+     * the index stack of @a context, appending its nodes to the context.
+     * The indices are partitioned in place, and popped off the stack once
+     * the subtree is complete.
+     *
+     * Large subtrees are split off into parallel tasks, each with its own
+     * context, and merged back once complete.
+     */
+    void buildNode(BuildContext& context, size_t begin,
+                   BoundingBox const& box, int depth) const;
+
+    /** Split a node using the surface area heuristic */
+    void buildSAH(BuildContext& context, size_t begin,
+                  BoundingBox const& box, int depth) const;
+
+    /** Split a node using the figure of merit heuristic */
+    void buildFOM(BuildContext& context, size_t begin,
+                  BoundingBox const& box, int depth) const;
+
+    /**
+     * Make the node at @a node the parent of subtrees built from the
+     * ranges [@a begin, @a middle) and [@a middle, end of stack) of the
+     * index stack. The second range is built first, and must be on top.
+     *
+     * If the node is large enough, both ranges are copied and built in
+     * parallel.
+     */
+    void buildChildren(BuildContext& context, std::uint32_t node,
+                       size_t begin, size_t middle,
+                       BoundingBox const& lessBox, BoundingBox const& moreBox,
+                       int depth) const;
+
+    /** Turn the faces in the range starting at @a begin into a leaf */
+    void buildLeaf(BuildContext& context, size_t begin) const;
+
+    /**
+     * Store the faces of every node, given by @a faceIndices, in triangle
+     * blocks. A node shares the last block with the nodes before it if its
+     * faces fit, and otherwise starts a new block.
+     */
+    void buildBlocks(std::vector< std::uint32_t > const& faceIndices,
+                     VertexStorage const& vertices);
+
+    /**
+     * Append the nodes and faces of @a other to @a context,
+     * adjusting the indices within them.
+     */
+    static void appendContext(BuildContext& context, BuildContext const& other);
+
     /**
-     * Choose the best axis-aligned separating plane for the faces
-     * returns true if separability is satisfied
+     * Sweep over the bounds of the faces in dimension @a dim and
+     * @return the splitting plane with the lowest SAH cost.
      */
-    bool choosePlane( std::vector< FaceIter > const& faces,
-                      KDNode& node,
-                      BoundingBox const& vol);
+    SplitCandidate sweepSAH(int dim, std::uint32_t const* faces, size_t count,
+                            BoundingBox const& box,
+                            std::vector< SplitEvent >& events) const;
 
     /**
-     * Choose the best axis-aligned separating plane for the faces
-     * for a single dimension and @return the plane evaluation
+     * Choose the best separating plane for the faces from @a begin to @a end
+     * in a single dimension, bisecting the interval [@a min, @a max] towards
+     * the side with more faces, and @return the plane evaluation.
+     * The faces are reordered in the process.
+     *
+     * @a extraLeftFaces and @a extraRightFaces count faces outside the
+     * range that lie left or right of the interval.
      */
     PlaneEvaluation chooseDimPlane( int dim,
-                      std::vector< FaceIter > const& faces,
+                      std::uint32_t* begin, std::uint32_t* end,
                       unsigned int extraLeftFaces,
                       unsigned int extraRightFaces,
-                      double min, double max );
-
-    /** Traverse a node with a ray */
-    bool traverse(KDNode* node, Point3D const& origin, Vector3D const& dir,
-                  double tNear, double tFar,
-                  FaceIntersection& intersection) const;
+                      double min, double max ) const;
 
     /**
-     * Given separating plane, compute figure of merit
-     * return which side of plane has more objects 
+     * Partition faces into those left of the boundary, those
+     * straddling it, and those right of it, and @return the
+     * number of faces in the first two groups.
      */
-    void evaluatePlane(int dim,
-                       std::vector< FaceIter > const& faces,
-                       PlaneEvaluation& eval );
-
-    /** Recursive function for building the kd tree */
-    KDNode* buildHelper(std::vector< FaceIter > const& faces,
-                        BoundingBox const& box);
+    std::pair< size_t, size_t > partitionFaces(int dim, double boundary,
+                      std::uint32_t* begin, std::uint32_t* end) const;
 
     /** Helper method for compute figure of merit on a plane evaluation */
-    unsigned int computeFOM(PlaneEvaluation const& eval);
+    static unsigned int computeFOM(PlaneEvaluation const& eval);
 
-    /** Helper method for combining evaluations */
-    void transferEvaluations(PlaneEvaluation& accumulator, PlaneEvaluation& other);
+    /** @return the bounds of a face, computed before building */
+    BoundingBox const& faceBounds(std::uint32_t face) const {
+        return faceBounds_[face];
+    }
 
-    /** Recursive face counting method */
-    unsigned int count(KDNode* node);
+    /**
+     * Recursively accumulate the expected number of node visits
+     * and triangle block tests for the subtree at @a node with bounds
+     * @a box. Each node contributes in proportion to its surface area.
+     */
+    void accumulateCost(std::uint32_t node, BoundingBox const& box,
+                        double& nodes, double& blocks) const;
 
     /** Return the depth of the tree rooted at @a node */
-    unsigned int depth(KDNode* node);
+    unsigned int depth(std::uint32_t node) const;
 
     /** Return the maximum number of objects at the leaves */
-    unsigned int maxLeafObjects(KDNode* node);
+    unsigned int maxLeafObjects(std::uint32_t node) const;
+
+    /** deepest tree that can be traversed */
+    static const int MaxDepth = 64;
 
 private:
-    std::unique_ptr<KDNode> root_; ///< root of kd tree
+    std::vector< KDFlatNode > nodes_; ///< nodes in depth-first order, root first
+    std::vector< TriangleBlock > blocks_; ///< faces of all nodes, by node
+    unsigned int faceReferences_; ///< number of faces over all nodes
+    FaceStorage const* faces_; ///< faces the tree was built over
     BoundingBox box_; ///< overall bounding box of all faces in the kd tree
 
+    KDBuildMethod method_; ///< method the tree was built with
+    double buildTime_; ///< seconds spent building the tree
+
+    // only valid during a build
+    std::vector< BoundingBox > faceBounds_; ///< bounds of each face
+    int maxDepth_; ///< depth after which no more splits are made
+
     // various constants for plane classification
     unsigned int fomThreshold_; ///< figure of merit threshold
     int differenceThreshold_; ///< threshold for left/right object count difference
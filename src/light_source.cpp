@@ -1,49 +1,61 @@
 #include <cmath>
 #include "light_source.h"
-#include "texture/material.h"
+#include "bsdf.h"
+#include "scene.h"
 
 LightSource::~LightSource() { }
 
-void PointLight::shade( Ray3D& ray, Ray3D::intersection_func intersectCheck ) const {
+void LightSource::shade( Ray3D& ray, BSDF const& bsdf, Scene const& scene ) const {
+    Colour ambient;
+    Vector3D lightDir;
+    double distance;
+    Colour direct = illuminate(ray, bsdf, ambient, lightDir, distance);
+    ray.col += ambient;
+
+    // shadow check
+    // if we intersect an object between the light and point
+    // we are considering, then it is in shadow
+    if (!direct.isBlack()
+            && !scene.occluded(ray.intersection.point, lightDir, distance)) {
+        ray.col += direct;
+    }
+}
+
+double PointLight::power() const {
+    // ambient counts too, or lights with only ambient are never picked
+    Colour total = col_ambient_;
+    total += col_diffuse_;
+    total += col_specular_;
+    return (total[0] + total[1] + total[2]) / 3.0;
+}
+
+Colour PointLight::illuminate( Ray3D const& ray, BSDF const& bsdf, Colour& ambient,
+                               Vector3D& lightDir, double& distance ) const {
 
-    Material* mat = ray.intersection.mat;
-    
     // compute direction towards light
-    Vector3D lightDir = pos_ - ray.intersection.point;
-    double distance = lightDir.normalize();
-    ray.col += col_ambient_ * mat->ambient.at(ray.intersection.uv);
+    lightDir = pos_ - ray.intersection.point;
+    distance = lightDir.normalize();
+    ambient = col_ambient_ * bsdf.ambient;
 
     // cos of angle from normal to lightDir
-    double cosAngle = lightDir.dot(ray.intersection.normal);
+    double cosAngle = lightDir.dot(bsdf.frame.normal);
 
     if (cosAngle < 0) {
-        return;
-    }
-    // shadow check
-    else {
-        Ray3D lightRay(ray.intersection.point, lightDir);
-        intersectCheck(lightRay);
-
-        // if we intersect an object between the light and point
-        // we are considering, then it is in shadow
-        if (!lightRay.intersection.none && lightRay.intersection.t_value < distance ) {
-            return;
-        }
+        return Colour();
     }
 
     // diffuse
-    ray.col += col_diffuse_ * mat->diffuse.at(ray.intersection.uv) * cosAngle;
+    Colour col = col_diffuse_ * bsdf.diffuse * cosAngle;
 
-    // direction of reflection of light ray
-    Vector3D reflectDir = 2*cosAngle*ray.intersection.normal - lightDir;
-    reflectDir.normalize();
-    // cos of angle from reflection to ray back to viewer
-    double rv = -reflectDir.dot(ray.dir);
+    // cos of angle from light to the mirror direction of the viewer,
+    // the same as from the reflection of the light ray to the viewer
+    double rv = lightDir.dot(bsdf.mirror.normal);
 
     // specular
     if (rv > 0) {
-        ray.col += col_specular_ * mat->specular.at(ray.intersection.uv)
-                                 * pow(rv, mat->specular_exp);
+        col += col_specular_ * bsdf.specular * pow(rv, bsdf.exponent);
     }
+
+    return col;
 }
 
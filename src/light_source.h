@@ -5,6 +5,9 @@
 #include "math/math_types.h"
 #include "ray.h"
 
+class BSDF;
+class Scene;
+
 /**
  * Abstract Base class for a simple light source.
  */
@@ -13,12 +16,34 @@ public:
     virtual ~LightSource();
 
     /**
-     * Given a ray and an intersection closure, figure out final colour of ray,
-     * and assign to it.
+     * Given a ray and the BSDF at its intersection, figure out final
+     * colour of ray, and assign to it.
+     *
+     * The @a scene is used to check whether another object lies between
+     * the intersection and the light
+     */
+    void shade( Ray3D&, BSDF const& bsdf, Scene const& scene ) const;
+
+    /**
+     * Light from this source reflected towards the viewer at the
+     * intersection of @a ray, with @a bsdf, if nothing blocks the segment
+     * from the intersection along @a dir up to @a distance (both set here).
      *
-     * The closure allows checking whether a particular ray intersects another object
+     * Light that arrives regardless of shadows is assigned to @a ambient.
+     * Lets shadows be tested separately from shading, e.g. in batches.
+     */
+    virtual Colour illuminate( Ray3D const& ray, BSDF const& bsdf, Colour& ambient,
+                               Vector3D& dir, double& distance ) const = 0;
+
+    /**
+     * @Return the position of the light in world space
+     */
+    virtual Point3D position() const = 0;
+
+    /**
+     * @Return how bright the light is, relative to other lights
      */
-    virtual void shade( Ray3D&, Ray3D::intersection_func intersectCheck ) const = 0;
+    virtual double power() const = 0;
 };
 
 /**
@@ -36,7 +61,11 @@ public:
         : pos_(pos), col_ambient_(ambient), col_diffuse_(diffuse), 
         col_specular_(specular) {}
 
-    void shade( Ray3D&, Ray3D::intersection_func intersectCheck ) const ;
+    Colour illuminate( Ray3D const& ray, BSDF const& bsdf, Colour& ambient,
+                       Vector3D& dir, double& distance ) const;
+
+    Point3D position() const { return pos_; }
+    double power() const;
 
 private:
     Point3D pos_;
@@ -0,0 +1,246 @@
+#include "light_tree.h"
+
+#include <algorithm>
+#include <limits>
+
+namespace {
+
+    /**
+     * Smallest cone containing the cones of @a a and @a b.
+     * (Conty Estevez and Kulla, "Importance Sampling of Many Lights
+     * with Adaptive Tree Splitting")
+     */
+    void mergeCones(LightBounds const& a, LightBounds const& b,
+                    Vector3D& axis, double& cosCone) {
+        if (a.cosCone <= -1 || b.cosCone <= -1) {
+            axis = a.axis;
+            cosCone = -1;
+            return;
+        }
+
+        double thetaA = std::acos(a.cosCone);
+        double thetaB = std::acos(b.cosCone);
+        double thetaD = std::acos(std::max(-1.0, std::min(1.0, a.axis.dot(b.axis))));
+
+        // one cone already contains the other
+        if (std::min(thetaD + thetaB, M_PI) <= thetaA) {
+            axis = a.axis;
+            cosCone = a.cosCone;
+            return;
+        }
+        if (std::min(thetaD + thetaA, M_PI) <= thetaB) {
+            axis = b.axis;
+            cosCone = b.cosCone;
+            return;
+        }
+
+        double theta = (thetaA + thetaD + thetaB) / 2;
+        if (theta >= M_PI) {
+            axis = a.axis;
+            cosCone = -1;
+            return;
+        }
+
+        // rotate the axis of a towards the axis of b
+        double rotation = theta - thetaA;
+        Vector3D ortho = b.axis - a.axis.dot(b.axis) * a.axis;
+        ortho.normalize();
+        axis = std::cos(rotation) * a.axis + std::sin(rotation) * ortho;
+        axis.normalize();
+        cosCone = std::cos(theta);
+    }
+
+    /** cosine of the angle between two directions, reduced by @a reduction */
+    double reducedCos(double cosAngle, double reduction) {
+        double angle = std::acos(std::max(-1.0, std::min(1.0, cosAngle)));
+        return std::cos(std::max(0.0, angle - reduction));
+    }
+
+}
+
+LightTree::LightTree() { }
+LightTree::~LightTree() { }
+
+void LightTree::clear() {
+    nodes_.clear();
+}
+
+void LightTree::build(std::vector< LightBounds > const& lights) {
+    clear();
+
+    std::vector< BuildItem > items;
+    for (std::uint32_t i = 0; i < lights.size(); ++i) {
+        items.push_back(BuildItem{ lights[i], i });
+    }
+
+    if (items.empty()) {
+        return;
+    }
+
+    buildHelper(items, 0, items.size());
+}
+
+std::uint32_t LightTree::buildHelper(std::vector< BuildItem >& items,
+                                     size_t begin, size_t end) {
+    std::uint32_t index = nodes_.size();
+    nodes_.push_back(Node());
+
+    if (end - begin == 1) {
+        nodes_[index].bounds = items[begin].bounds;
+        nodes_[index].offset = items[begin].light;
+        nodes_[index].leaf = true;
+        return index;
+    }
+
+    // split the lights in half along the longest side of their centers
+    double minPoint[3], maxPoint[3];
+    std::fill_n(minPoint, 3, std::numeric_limits<double>::infinity());
+    std::fill_n(maxPoint, 3, -std::numeric_limits<double>::infinity());
+    for (size_t i = begin; i < end; ++i) {
+        for (int dim = 0; dim < 3; ++dim) {
+            minPoint[dim] = std::min(minPoint[dim], items[i].bounds.center[dim]);
+            maxPoint[dim] = std::max(maxPoint[dim], items[i].bounds.center[dim]);
+        }
+    }
+
+    int splitDim = 0;
+    for (int dim = 1; dim < 3; ++dim) {
+        if (maxPoint[dim] - minPoint[dim] > maxPoint[splitDim] - minPoint[splitDim]) {
+            splitDim = dim;
+        }
+    }
+
+    size_t middle = (begin + end) / 2;
+    std::nth_element(items.begin() + begin, items.begin() + middle, items.begin() + end,
+        [splitDim](BuildItem const& a, BuildItem const& b) {
+            return a.bounds.center[splitDim] < b.bounds.center[splitDim];
+        });
+
+    buildHelper(items, begin, middle);
+    std::uint32_t right = buildHelper(items, middle, end);
+
+    LightBounds const& leftBounds = nodes_[index + 1].bounds;
+    LightBounds const& rightBounds = nodes_[right].bounds;
+
+    // sphere around both children, centered between the centers
+    Node node;
+    node.bounds.center = Point3D((minPoint[0] + maxPoint[0]) / 2,
+                                 (minPoint[1] + maxPoint[1]) / 2,
+                                 (minPoint[2] + maxPoint[2]) / 2);
+    node.bounds.radius = 0;
+    for (size_t i = begin; i < end; ++i) {
+        Vector3D offset = items[i].bounds.center - node.bounds.center;
+        node.bounds.radius = std::max(node.bounds.radius,
+                                      offset.norm() + items[i].bounds.radius);
+    }
+
+    node.bounds.power = leftBounds.power + rightBounds.power;
+    mergeCones(leftBounds, rightBounds, node.bounds.axis, node.bounds.cosCone);
+    node.offset = right;
+    node.leaf = false;
+
+    nodes_[index] = node;
+    return index;
+}
+
+double LightTree::importance(LightBounds const& bounds,
+                             Point3D const& p, Vector3D const& normal) {
+    Vector3D toLight = bounds.center - p;
+    double distanceSquared = toLight.squaredNorm();
+    double radiusSquared = bounds.radius * bounds.radius;
+
+    // inside the sphere the lights could be in any direction
+    if (distanceSquared <= radiusSquared) {
+        return bounds.power / std::max(radiusSquared, std::numeric_limits<double>::min());
+    }
+
+    double distance = toLight.normalize();
+
+    // half angle of the cone of directions towards the sphere
+    double sinBound = bounds.radius / distance;
+    double bound = std::asin(sinBound);
+
+    // light arriving at the surface, at the most favourable angle
+    double cosSurface = 1.0;
+    if (!normal.v.isZero()) {
+        cosSurface = reducedCos(normal.dot(toLight), bound);
+        if (cosSurface <= 0) {
+            return 0;
+        }
+    }
+
+    // light leaving the lights towards the point: none outside their
+    // cone, and otherwise at the most favourable angle to their normals,
+    // which lie within the cone narrowed by the hemisphere each emits into
+    double cosEmitted = 1.0;
+    if (bounds.cosCone > -1) {
+        double cone = std::acos(bounds.cosCone);
+        double cosAxis = -toLight.dot(bounds.axis);
+        if (reducedCos(cosAxis, bound) < bounds.cosCone) {
+            return 0;
+        }
+        cosEmitted = reducedCos(cosAxis, bound + std::max(0.0, cone - M_PI / 2));
+    }
+
+    return bounds.power * cosSurface * cosEmitted / distanceSquared;
+}
+
+bool LightTree::hitsSphere(LightBounds const& bounds,
+                           Point3D const& p, Vector3D const& dir) {
+    Vector3D toCenter = bounds.center - p;
+    double radiusSquared = bounds.radius * bounds.radius;
+    double distanceSquared = toCenter.squaredNorm();
+
+    // from inside, every direction hits
+    if (distanceSquared <= radiusSquared) {
+        return true;
+    }
+
+    // sphere is behind the point
+    double along = dir.dot(toCenter);
+    if (along < 0) {
+        return false;
+    }
+
+    return distanceSquared - along*along <= radiusSquared;
+}
+
+int LightTree::sample(Point3D const& p, Vector3D const& normal,
+                      double& u, double& probability) const {
+    probability = 0;
+    if (nodes_.empty()) {
+        return -1;
+    }
+
+    probability = 1.0;
+    std::uint32_t index = 0;
+    while (!nodes_[index].leaf) {
+        std::uint32_t left = index + 1;
+        std::uint32_t right = nodes_[index].offset;
+        double leftImportance = importance(nodes_[left].bounds, p, normal);
+        double rightImportance = importance(nodes_[right].bounds, p, normal);
+        double total = leftImportance + rightImportance;
+        if (total <= 0) {
+            probability = 0;
+            return -1;
+        }
+
+        // choose a child, and stretch the part of [0,1) that
+        // chose it back to [0,1)
+        double leftProbability = leftImportance / total;
+        if (u < leftProbability) {
+            u = u / leftProbability;
+            probability *= leftProbability;
+            index = left;
+        }
+        else {
+            u = (u - leftProbability) / (1 - leftProbability);
+            probability *= 1 - leftProbability;
+            index = right;
+        }
+
+        u = std::min(u, 1.0 - std::numeric_limits<double>::epsilon());
+    }
+
+    return nodes_[index].offset;
+}
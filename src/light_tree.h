@@ -0,0 +1,169 @@
+#ifndef _LIGHT_TREE_H_
+#define _LIGHT_TREE_H_
+
+#include "math/math_types.h"
+
+#include <vector>
+#include <cstdint>
+
+/**
+ * A light, as far as the LightTree is concerned: a sphere containing it,
+ * how much power it emits, and a cone containing the directions it
+ * emits in.
+ */
+struct LightBounds {
+    LightBounds() : radius(0), power(0), axis(0, 0, 1), cosCone(-1) { }
+
+    Point3D center;
+    double radius;
+    double power;   ///< relative power, only compared between lights
+    Vector3D axis;  ///< axis of the cone of emitted directions
+    double cosCone; ///< cosine of the half angle of the cone, 0 for a hemisphere, -1 for all directions
+};
+
+/**
+ * A hierarchy over many lights, for picking one light to sample
+ * from a point, with a probability that follows its estimated
+ * contribution at that point.
+ *
+ * Every node bounds its lights with a sphere, a cone of emitted
+ * directions, and their total power. Picking walks from the root,
+ * choosing between the two children in proportion to their importance
+ * (power, falling off with distance, and with the angle to the point
+ * and to its normal). Cost is logarithmic in the number of lights.
+ */
+class LightTree {
+
+public:
+    LightTree();
+    ~LightTree();
+
+    /**
+     * Build the hierarchy over @a lights. Lights are then referred to
+     * by their index in @a lights.
+     */
+    void build(std::vector< LightBounds > const& lights);
+
+    void clear();
+
+    /** @return whether the hierarchy holds any lights */
+    bool empty() const { return nodes_.empty(); }
+
+    /**
+     * Pick a light to sample from point @a p, on a surface with normal
+     * @a normal, using the uniform number @a u.
+     *
+     * Lights entirely below the surface are never picked. If @a normal
+     * is zero, lights are not culled by the surface.
+     *
+     * @a u is rescaled to a fresh uniform number in [0,1), and
+     * @a probability set to the chance of picking the light.
+     *
+     * @return index of the light picked, or -1 if no light can
+     * contribute at @a p.
+     */
+    int sample(Point3D const& p, Vector3D const& normal,
+               double& u, double& probability) const;
+
+    /**
+     * Call @a visit(light, probability) for every light whose sphere is
+     * hit by the ray from @a p along @a dir, with the probability that
+     * sample() picks it from the same point and normal.
+     *
+     * Subtrees the ray misses are skipped, so only a few paths of the
+     * tree are visited.
+     * ASSUMPTION: dir is unit length.
+     */
+    template <typename Visitor>
+    void visitHit(Point3D const& p, Vector3D const& normal,
+                  Vector3D const& dir, Visitor visit) const;
+
+private:
+    /**
+     * A node of the hierarchy, stored in depth-first order.
+     * The left child of an interior node directly follows it.
+     */
+    struct Node {
+        LightBounds bounds;
+        std::uint32_t offset; ///< index of the light of a leaf, or of the right child
+        bool leaf;
+    };
+
+    /** A light being placed in the hierarchy */
+    struct BuildItem {
+        LightBounds bounds;
+        std::uint32_t light;
+    };
+
+    /**
+     * Recursively build the subtree over @a items in [@a begin, @a end),
+     * and @return the index of its root.
+     */
+    std::uint32_t buildHelper(std::vector< BuildItem >& items,
+                              size_t begin, size_t end);
+
+    /**
+     * Estimate of the light arriving at @a p on a surface with
+     * @a normal, from the lights in @a bounds.
+     */
+    static double importance(LightBounds const& bounds,
+                             Point3D const& p, Vector3D const& normal);
+
+    /** @return whether the ray from @a p along @a dir hits the sphere of @a bounds */
+    static bool hitsSphere(LightBounds const& bounds,
+                           Point3D const& p, Vector3D const& dir);
+
+    /** deepest hierarchy that can be traversed */
+    static const int MaxDepth = 64;
+
+    std::vector< Node > nodes_; ///< nodes in depth-first order, root first
+};
+
+template <typename Visitor>
+void LightTree::visitHit(Point3D const& p, Vector3D const& normal,
+                         Vector3D const& dir, Visitor visit) const {
+    if (nodes_.empty()) {
+        return;
+    }
+
+    struct Entry {
+        std::uint32_t node;
+        double probability;
+    };
+
+    Entry stack[MaxDepth + 1];
+    int size = 0;
+    stack[size++] = Entry{ 0, 1.0 };
+
+    while (size > 0) {
+        Entry entry = stack[--size];
+        Node const& node = nodes_[entry.node];
+
+        if (!hitsSphere(node.bounds, p, dir)) {
+            continue;
+        }
+
+        if (node.leaf) {
+            visit(node.offset, entry.probability);
+            continue;
+        }
+
+        std::uint32_t left = entry.node + 1;
+        std::uint32_t right = node.offset;
+        double leftImportance = importance(nodes_[left].bounds, p, normal);
+        double rightImportance = importance(nodes_[right].bounds, p, normal);
+        double total = leftImportance + rightImportance;
+        if (total <= 0) {
+            continue;
+        }
+
+        if (rightImportance > 0) {
+            stack[size++] = Entry{ right, entry.probability * rightImportance / total };
+        }
+        if (leftImportance > 0) {
+            stack[size++] = Entry{ left, entry.probability * leftImportance / total };
+        }
+    }
+}
+
+#endif // _LIGHT_TREE_H_
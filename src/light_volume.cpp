@@ -1,11 +1,154 @@
 #include "light_volume.h"
 
+#include <limits>
+
 
 LightVolume::LightVolume(Point3D const& p) : BoundingVolume(p) { }
 LightVolume::LightVolume() : BoundingVolume() { }
 
 LightVolume::~LightVolume() { }
 
+void LightVolume::setTransform(AffineTrans3D const& modelToWorld, double factor) {
+    pos = modelToWorld.t;
+    scale = factor;
+}
+
+namespace {
+
+    /**
+     * A rectangle as seen from a view point, set up for sampling
+     * directions uniformly in its solid angle.
+     * (Urena, Fajardo and King, "An Area-Preserving Parametrization
+     * for Spherical Rectangles")
+     */
+    class SphericalRectangle {
+
+    public:
+        SphericalRectangle() : solidAngle_(0.0) { }
+
+        /**
+         * Rectangle at @a corner spanned by orthogonal @a edgeX and
+         * @a edgeY, seen from @a viewPoint
+         */
+        SphericalRectangle(Point3D const& viewPoint, Point3D const& corner,
+                           Vector3D const& edgeX, Vector3D const& edgeY)
+                : viewPoint_(viewPoint), solidAngle_(0.0) {
+
+            // local frame with the rectangle in front of the view point,
+            // on the plane z = z0 < 0
+            x_ = edgeX;
+            double lengthX = x_.normalize();
+            y_ = edgeY;
+            double lengthY = y_.normalize();
+            z_ = x_.cross(y_);
+
+            Vector3D toCorner = corner - viewPoint;
+            x0_ = toCorner.dot(x_);
+            y0_ = toCorner.dot(y_);
+            z0_ = toCorner.dot(z_);
+            if (z0_ > 0) {
+                z0_ = -z0_;
+                z_ = -z_;
+            }
+            x1_ = x0_ + lengthX;
+            y1_ = y0_ + lengthY;
+
+            // seen edge on
+            if (z0_ > -1e-12) {
+                return;
+            }
+
+            // normals of the planes through the view point and each edge
+            Vector3D n0(0, z0_, -y0_);
+            Vector3D n1(-z0_, 0, x1_);
+            Vector3D n2(0, -z0_, y1_);
+            Vector3D n3(z0_, 0, -x0_);
+            n0.normalize(); n1.normalize(); n2.normalize(); n3.normalize();
+
+            // internal angles of the spherical rectangle
+            double g0 = std::acos(clamp(-n0.dot(n1)));
+            double g1 = std::acos(clamp(-n1.dot(n2)));
+            double g2 = std::acos(clamp(-n2.dot(n3)));
+            double g3 = std::acos(clamp(-n3.dot(n0)));
+
+            b0_ = n0[2];
+            b1_ = n2[2];
+            k_ = 2 * M_PI - g2 - g3;
+            solidAngle_ = std::max(0.0, g0 + g1 - k_);
+        }
+
+        double solidAngle() const { return solidAngle_; }
+
+        /**
+         * Given unit uniformly distributed @a u and @a v, set @a dir to
+         * a direction towards the rectangle.
+         */
+        void sample(double u, double v, Vector3D& dir) const {
+            // x coordinate of the sample, splitting the solid angle by u
+            double au = u * solidAngle_ + k_;
+            double sinAu = std::sin(au);
+            double fu = (std::cos(au) * b0_ - b1_) / (std::abs(sinAu) > 1e-12 ? sinAu : 1e-12);
+            double cu = clamp(std::copysign(1.0, fu) / std::sqrt(fu*fu + b0_*b0_));
+            double xu = -(cu * z0_) / std::max(std::sqrt(1 - cu*cu), 1e-12);
+            xu = std::min(std::max(xu, x0_), x1_);
+
+            // y coordinate, splitting the column at xu by v
+            double d = std::sqrt(xu*xu + z0_*z0_);
+            double h0 = y0_ / std::sqrt(d*d + y0_*y0_);
+            double h1 = y1_ / std::sqrt(d*d + y1_*y1_);
+            double hv = h0 + v * (h1 - h0);
+            double hv2 = hv * hv;
+            double yv = (hv2 < 1 - 1e-12) ? hv * d / std::sqrt(1 - hv2) : y1_;
+
+            dir = xu * x_ + yv * y_ + z0_ * z_;
+            dir.normalize();
+        }
+
+    private:
+        static double clamp(double c) {
+            return std::min(std::max(c, -1.0), 1.0);
+        }
+
+        Point3D viewPoint_;
+        Vector3D x_, y_, z_; ///< local frame
+        double x0_, y0_, z0_, x1_, y1_; ///< rectangle in the local frame
+        double b0_, b1_, k_;
+        double solidAngle_;
+    };
+
+    /** @return whether the edges are orthogonal, and not degenerate */
+    bool orthogonal(Vector3D const& a, Vector3D const& b) {
+        double lengths = a.norm() * b.norm();
+        return lengths > 0 && std::abs(a.dot(b)) <= 1e-9 * lengths;
+    }
+
+    /**
+     * Set up the faces of the box at @a corner spanned by @a edges,
+     * that are visible from @a viewPoint, and @return how many there
+     * are (none if the view point is inside).
+     */
+    int visibleFaces(Point3D const& viewPoint, Point3D const& corner,
+                     std::array<Vector3D, 3> const& edges,
+                     SphericalRectangle faces[3]) {
+        int count = 0;
+        Vector3D toViewPoint = viewPoint - corner;
+        for (int dim = 0; dim < 3; ++dim) {
+            // position along the edge, 0 at the corner and 1 at the far face
+            double position = toViewPoint.dot(edges[dim]) / edges[dim].squaredNorm();
+            if (position >= 0 && position <= 1) {
+                continue;
+            }
+
+            Point3D faceCorner = (position > 1) ? Point3D(corner + edges[dim]) : corner;
+            faces[count++] = SphericalRectangle(viewPoint, faceCorner,
+                                                edges[(dim + 1) % 3], edges[(dim + 2) % 3]);
+        }
+
+        return count;
+    }
+
+}
+
 
 /***************************************************************************
  *                               LightSphere                               *
@@ -85,3 +228,223 @@ double LightSphere::getCosThetaMax(Vector3D& toCenter) const {
     return sqrt( 1 - sinThetaMax*sinThetaMax);
 }
 
+
+/***************************************************************************
+ *                              LightRectangle                             *
+ ***************************************************************************/
+
+LightRectangle::LightRectangle(Point3D const& corner,
+                               Vector3D const& edgeX, Vector3D const& edgeY) :
+    // sphere around the model space origin, containing every corner
+    LightSphere(std::max(std::max(Vector3D(corner - Point3D()).norm(),
+                                  Vector3D(corner + edgeX - Point3D()).norm()),
+                         std::max(Vector3D(corner + edgeY - Point3D()).norm(),
+                                  Vector3D(corner + edgeX + edgeY - Point3D()).norm()))),
+    corner_(corner), edgeX_(edgeX), edgeY_(edgeY),
+    worldCorner_(corner), worldEdgeX_(edgeX), worldEdgeY_(edgeY),
+    rectangular_(orthogonal(edgeX, edgeY)) { }
+
+void LightRectangle::setTransform(AffineTrans3D const& modelToWorld, double factor) {
+    LightSphere::setTransform(modelToWorld, factor);
+
+    worldCorner_ = modelToWorld.transformPoint(corner_.v);
+    worldEdgeX_ = modelToWorld.transformVector(edgeX_.v);
+    worldEdgeY_ = modelToWorld.transformVector(edgeY_.v);
+    rectangular_ = orthogonal(worldEdgeX_, worldEdgeY_);
+}
+
+void LightRectangle::getSubtendedDir(Point3D const& viewPoint,
+                                     double uniformX, double uniformY,
+                                     Vector3D& dir) const {
+    if (!rectangular_) {
+        LightSphere::getSubtendedDir(viewPoint, uniformX, uniformY, dir);
+        return;
+    }
+
+    SphericalRectangle rectangle(viewPoint, worldCorner_, worldEdgeX_, worldEdgeY_);
+
+    // seen edge on, no direction reaches the rectangle
+    if (rectangle.solidAngle() <= 0) {
+        dir = worldCorner_ + 0.5 * (worldEdgeX_ + worldEdgeY_) - viewPoint;
+        dir.normalize();
+        return;
+    }
+
+    rectangle.sample(uniformX, uniformY, dir);
+}
+
+// ASSUMPTION: dir is normalized
+bool LightRectangle::isSubtended(Point3D const& viewPoint, Vector3D const& dir) const {
+    if (!rectangular_) {
+        return LightSphere::isSubtended(viewPoint, dir);
+    }
+
+    Vector3D normal = worldEdgeX_.cross(worldEdgeY_);
+    normal.normalize();
+
+    // seen edge on, like the solid angle
+    Vector3D toCorner = worldCorner_ - viewPoint;
+    double distance = toCorner.dot(normal);
+    if (std::abs(distance) <= 1e-12) {
+        return false;
+    }
+
+    double along = dir.dot(normal);
+    double t = distance / along;
+    if (along == 0 || t <= 0) {
+        return false;
+    }
+
+    // position of the hit along each edge
+    Vector3D offset = t * dir - toCorner;
+    double x = offset.dot(worldEdgeX_) / worldEdgeX_.squaredNorm();
+    double y = offset.dot(worldEdgeY_) / worldEdgeY_.squaredNorm();
+
+    return x >= 0 && x <= 1 && y >= 0 && y <= 1;
+}
+
+double LightRectangle::subtendedProbability(Point3D const& viewPoint) const {
+    if (!rectangular_) {
+        return LightSphere::subtendedProbability(viewPoint);
+    }
+
+    // relative to uniformly sampling the hemisphere
+    double solidAngle = SphericalRectangle(viewPoint, worldCorner_,
+                                           worldEdgeX_, worldEdgeY_).solidAngle();
+    return solidAngle > 0 ? 2 * M_PI / solidAngle : 0.0;
+}
+
+
+/***************************************************************************
+ *                                 LightBox                                *
+ ***************************************************************************/
+
+namespace {
+
+    /** distance from the model space origin to the farthest corner of the box */
+    double farthestCorner(Point3D const& corner, std::array<Vector3D, 3> const& edges) {
+        double distance = 0.0;
+        for (int i = 0; i < 8; ++i) {
+            Vector3D toCorner = corner - Point3D();
+            for (int dim = 0; dim < 3; ++dim) {
+                if (i & (1 << dim)) {
+                    toCorner += edges[dim];
+                }
+            }
+            distance = std::max(distance, toCorner.norm());
+        }
+        return distance;
+    }
+
+}
+
+LightBox::LightBox(Point3D const& corner, std::array<Vector3D, 3> const& edges) :
+    LightSphere(farthestCorner(corner, edges)),
+    corner_(corner), edges_(edges),
+    worldCorner_(corner), worldEdges_(edges),
+    rectangular_(orthogonal(edges[0], edges[1]) && orthogonal(edges[1], edges[2])
+                 && orthogonal(edges[2], edges[0])) { }
+
+void LightBox::setTransform(AffineTrans3D const& modelToWorld, double factor) {
+    LightSphere::setTransform(modelToWorld, factor);
+
+    worldCorner_ = modelToWorld.transformPoint(corner_.v);
+    for (int dim = 0; dim < 3; ++dim) {
+        worldEdges_[dim] = modelToWorld.transformVector(edges_[dim].v);
+    }
+    rectangular_ = orthogonal(worldEdges_[0], worldEdges_[1])
+                   && orthogonal(worldEdges_[1], worldEdges_[2])
+                   && orthogonal(worldEdges_[2], worldEdges_[0]);
+}
+
+void LightBox::getSubtendedDir(Point3D const& viewPoint,
+                               double uniformX, double uniformY,
+                               Vector3D& dir) const {
+    if (!rectangular_) {
+        LightSphere::getSubtendedDir(viewPoint, uniformX, uniformY, dir);
+        return;
+    }
+
+    SphericalRectangle faces[3];
+    int count = visibleFaces(viewPoint, worldCorner_, worldEdges_, faces);
+
+    // from inside, the box is in every direction
+    if (count == 0) {
+        double cosTheta = 1 - 2 * uniformX;
+        double sinTheta = sqrt(std::max(0.0, 1 - cosTheta * cosTheta));
+        double fi = 2 * M_PI * uniformY;
+        dir = Vector3D(cos(fi) * sinTheta, sin(fi) * sinTheta, cosTheta);
+        return;
+    }
+
+    double solidAngle = 0.0;
+    for (int i = 0; i < count; ++i) {
+        solidAngle += faces[i].solidAngle();
+    }
+
+    // choose a face in proportion to its solid angle, and stretch the
+    // part of uniformX that chose it back to [0,1)
+    double target = uniformX * solidAngle;
+    int face = 0;
+    while (face < count - 1 && target >= faces[face].solidAngle()) {
+        target -= faces[face].solidAngle();
+        ++face;
+    }
+
+    double faceAngle = faces[face].solidAngle();
+    double u = faceAngle > 0 ? std::min(target / faceAngle, 1.0) : 0.5;
+    faces[face].sample(u, uniformY, dir);
+}
+
+// ASSUMPTION: dir is normalized
+bool LightBox::isSubtended(Point3D const& viewPoint, Vector3D const& dir) const {
+    if (!rectangular_) {
+        return LightSphere::isSubtended(viewPoint, dir);
+    }
+
+    // slabs along each edge, with the box between 0 and 1
+    double tNear = -std::numeric_limits<double>::infinity();
+    double tFar = std::numeric_limits<double>::infinity();
+
+    Vector3D toViewPoint = viewPoint - worldCorner_;
+    for (int dim = 0; dim < 3; ++dim) {
+        double lengthSquared = worldEdges_[dim].squaredNorm();
+        double origin = toViewPoint.dot(worldEdges_[dim]) / lengthSquared;
+        double along = dir.dot(worldEdges_[dim]) / lengthSquared;
+
+        if (along == 0) {
+            if (origin < 0 || origin > 1) {
+                return false;
+            }
+            continue;
+        }
+
+        double t0 = -origin / along;
+        double t1 = (1 - origin) / along;
+        tNear = std::max(tNear, std::min(t0, t1));
+        tFar = std::min(tFar, std::max(t0, t1));
+    }
+
+    return tNear <= tFar && tFar > 0;
+}
+
+double LightBox::subtendedProbability(Point3D const& viewPoint) const {
+    if (!rectangular_) {
+        return LightSphere::subtendedProbability(viewPoint);
+    }
+
+    SphericalRectangle faces[3];
+    int count = visibleFaces(viewPoint, worldCorner_, worldEdges_, faces);
+
+    // from inside, directions are uniform over the sphere
+    if (count == 0) {
+        return 0.5;
+    }
+
+    // relative to uniformly sampling the hemisphere
+    double solidAngle = 0.0;
+    for (int i = 0; i < count; ++i) {
+        solidAngle += faces[i].solidAngle();
+    }
+    return solidAngle > 0 ? 2 * M_PI / solidAngle : 0.0;
+}
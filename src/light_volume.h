@@ -15,6 +15,13 @@ public:
     LightVolume(Point3D const& pos);
     virtual ~LightVolume();
 
+    /**
+     * Place the volume in world space, given the transformation
+     * @a modelToWorld of the object it contains, and the largest
+     * scaling @a factor in it.
+     */
+    virtual void setTransform(AffineTrans3D const& modelToWorld, double factor);
+
     /**
      * Given view point, and unit unformly distributed random values x y,
      * return a direction towards the bounding volume
@@ -42,6 +49,11 @@ public:
      */
     virtual double subtendedProbability(Point3D const& viewPoint) const = 0;
 
+    /**
+     * @Return the radius of a sphere around pos that contains the volume
+     */
+    virtual double boundingRadius() const = 0;
+
     /**
      * Fast intersection method that is equivalent to isSubtended
      */
@@ -68,6 +80,7 @@ public:
 
     bool isSubtended(Point3D const& viewPoint, Vector3D const& dir) const;
     double subtendedProbability(Point3D const& viewPoint) const;
+    double boundingRadius() const { return radius_ * this->scale; }
 
 private:
     double getCosThetaMax(Vector3D& toCenter) const;
@@ -77,4 +90,83 @@ private:
 
 };
 
+/**
+ * A rectangle that is an emitting object, such as a quad light.
+ *
+ * Directions are sampled uniformly in the solid angle of the rectangle
+ * itself, rather than of a sphere around it, so no samples miss.
+ * If the transformation shears the rectangle into a parallelogram, the
+ * surrounding sphere is sampled instead.
+ */
+class LightRectangle : public LightSphere {
+
+public:
+    /**
+     * Rectangle in model space at @a corner, spanned by the orthogonal
+     * edges @a edgeX and @a edgeY.
+     */
+    LightRectangle(Point3D const& corner, Vector3D const& edgeX, Vector3D const& edgeY);
+
+    void setTransform(AffineTrans3D const& modelToWorld, double factor);
+
+    void getSubtendedDir(Point3D const& viewPoint,
+                         double uniformX, double uniformY,
+                         Vector3D& dir) const;
+
+    bool isSubtended(Point3D const& viewPoint, Vector3D const& dir) const;
+    double subtendedProbability(Point3D const& viewPoint) const;
+
+private:
+    // in model space
+    Point3D corner_;
+    Vector3D edgeX_;
+    Vector3D edgeY_;
+
+    // in world space
+    Point3D worldCorner_;
+    Vector3D worldEdgeX_;
+    Vector3D worldEdgeY_;
+
+    bool rectangular_; ///< whether the edges are orthogonal in world space
+
+};
+
+/**
+ * A box that is an emitting object.
+ *
+ * Directions are sampled uniformly in the solid angle of the faces
+ * visible from the view point. If the transformation shears the box,
+ * the surrounding sphere is sampled instead.
+ */
+class LightBox : public LightSphere {
+
+public:
+    /**
+     * Box in model space at @a corner, spanned by the orthogonal
+     * @a edges.
+     */
+    LightBox(Point3D const& corner, std::array<Vector3D, 3> const& edges);
+
+    void setTransform(AffineTrans3D const& modelToWorld, double factor);
+
+    void getSubtendedDir(Point3D const& viewPoint,
+                         double uniformX, double uniformY,
+                         Vector3D& dir) const;
+
+    bool isSubtended(Point3D const& viewPoint, Vector3D const& dir) const;
+    double subtendedProbability(Point3D const& viewPoint) const;
+
+private:
+    // in model space
+    Point3D corner_;
+    std::array<Vector3D, 3> edges_;
+
+    // in world space
+    Point3D worldCorner_;
+    std::array<Vector3D, 3> worldEdges_;
+
+    bool rectangular_; ///< whether the edges are orthogonal in world space
+
+};
+
 #endif // _LIGHT_VOLUME_H_
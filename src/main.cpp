@@ -4,17 +4,56 @@
 
 #include "texture/image_io.h"
 #include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+// parse a non-negative number given on the command line
+bool parseNumber(char const* text, double& value) {
+    char* end;
+    value = std::strtod(text, &end);
+    return end != text && *end == '\0' && value >= 0;
+}
 
 int main(int argc, char* argv[])
 {
+    // options that control the passes made over the image
+    double timeLimit = 0;
+    double sampleTarget = 0;
+    double checkpointInterval = 0;
+    std::vector<std::string> sceneFilenames;
+
+    for (int i = 1; i < argc; ++i) {
+        double* option = nullptr;
+        if (std::strcmp(argv[i], "--time-limit") == 0) {
+            option = &timeLimit;
+        }
+        else if (std::strcmp(argv[i], "--spp") == 0) {
+            option = &sampleTarget;
+        }
+        else if (std::strcmp(argv[i], "--checkpoint") == 0) {
+            option = &checkpointInterval;
+        }
+        else {
+            sceneFilenames.push_back(argv[i]);
+            continue;
+        }
 
-    // init random number generator for distribution rendering
-    std::srand(int(time(nullptr)));
+        if (i + 1 >= argc || !parseNumber(argv[i + 1], *option)) {
+            std::cerr << argv[i] << " needs a non-negative number." << std::endl;
+            return 1;
+        }
+        ++i;
+    }
 
-    if (argc <= 1) {
+    if (sceneFilenames.empty()) {
         std::cerr << "No Scene XML specified. If more than one XML spceified, scenes and settings will be combined into one." << std::endl;
         std::cerr << "    Usage:" << std::endl;
-        std::cerr << "    ./raytracer <path to xml> ..." << std::endl;
+        std::cerr << "    ./raytracer [options] <path to xml> ..." << std::endl;
+        std::cerr << "    Options:" << std::endl;
+        std::cerr << "    --time-limit <seconds>  keep rendering passes until time runs out" << std::endl;
+        std::cerr << "    --spp <samples>         keep rendering passes until pixels have this many samples" << std::endl;
+        std::cerr << "    --checkpoint <seconds>  save the image (and raw data) this often while rendering" << std::endl;
         return 0;
     }
 
@@ -27,15 +66,24 @@ int main(int argc, char* argv[])
 
     // parse all scene info
     SceneXmlParser xmlParser(raytracer, scene, cameras);
-    for (int i = 1; i < argc; ++i) {
-        std::string sceneFilename(argv[i]);
-
+    for (auto const& sceneFilename : sceneFilenames) {
         if(!xmlParser.parseSceneDefinition(sceneFilename) ) {
             std::cerr << "Parsing failed... Exiting." << std::endl;
             return 1;
         }
     }
 
+    // command line options override the scene settings
+    if (timeLimit > 0) {
+        raytracer.setTimeLimit(timeLimit);
+    }
+    if (sampleTarget > 0) {
+        raytracer.setSampleTarget(sampleTarget);
+    }
+    if (checkpointInterval > 0) {
+        raytracer.setCheckpointInterval(checkpointInterval);
+    }
+
     // preprocess the scene before rendering
     scene.preprocess();
 
@@ -53,9 +101,13 @@ int main(int argc, char* argv[])
         if (rawFile.good()) {
             Image<SensorPixel> accummulatedSensor = readImageFromFile<Image<SensorPixel> >(rawFile);
 
-            if (accummulatedSensor) {
+            if (!accummulatedSensor) {
+                std::cerr << "Ignoring unreadable raw data in " << rawFileName << std::endl;
+            } else if (cam->mergeSensor(accummulatedSensor)) {
                 std::cout << "Reusing previously rendered data for iterative raytacing." << std::endl;
-                cam->mergeSensor(accummulatedSensor);
+            } else {
+                std::cerr << "Ignoring raw data in " << rawFileName
+                          << ", its size differs from the camera's" << std::endl;
             }
 
             rawFile.close();
@@ -65,8 +117,10 @@ int main(int argc, char* argv[])
         raytracer.render(*cam.get());
         cam->dumpToBMP(cam->name + bmpSuffix);
 
-        // if raytracer flag says to also dump raw, do so
-        if (raytracer.dumpRaw) {
+        // if raytracer flag says to also dump raw, do so. Also keep the
+        // raw data of checkpointed renders up to date, so they continue
+        // from the final image.
+        if (raytracer.dumpRaw || raytracer.checkpointInterval() > 0) {
             cam->dumpRawData(rawFileName);
         }
     }
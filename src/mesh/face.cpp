@@ -1,56 +1,190 @@
 #include "face.h"
 
-bool intersectFace(Face const& face,
-                   Point3D const& origin,
-                   Vector3D const& dir,
-                   FaceIntersection& intersection) {
+#include <algorithm>
 
-    // backface culling
-    if (dir.dot(face.normal) >= 0) {
-        return false;
+TriangleBlock::TriangleBlock() {
+    for (int dim = 0; dim < 3; ++dim) {
+        std::fill_n(vertex[dim], PacketWidth, 0.0);
+        std::fill_n(edge1[dim], PacketWidth, 0.0);
+        std::fill_n(edge2[dim], PacketWidth, 0.0);
     }
+    std::fill_n(face, PacketWidth, 0);
+    swapped = 0;
+}
 
-    // intersect with plane to get point
-    Point3D planeOrigin = face.vertices[0].point;
+void TriangleBlock::setFace(int lane, FaceStorage const& faces, std::uint32_t index,
+                            VertexStorage const& vertices) {
+    Face const& f = faces[index];
+    Point3D const& p0 = vertices[f.vertices[0]].point;
+    Vector3D e1(vertices[f.vertices[1]].point - p0);
+    Vector3D e2(vertices[f.vertices[2]].point - p0);
 
-    double t_value = - (face.normal.dot(origin - planeOrigin)/face.normal.dot(dir));
+    // make the outward normal point along edge2 x edge1
+    Vector3D n(e2.cross(e1));
+    if (n.dot(f.normal) < 0) {
+        std::swap(e1, e2);
+        swapped |= 1u << lane;
+    }
+    else {
+        swapped &= ~(1u << lane);
+    }
 
-    // don't check bounds, if intersection is further than the current best or
-    // behind ray origin
-    if (t_value > intersection.t_value || t_value < 0) {
-        return false;
+    for (int dim = 0; dim < 3; ++dim) {
+        vertex[dim][lane] = p0[dim];
+        edge1[dim][lane] = e1[dim];
+        edge2[dim][lane] = e2[dim];
     }
+    face[lane] = index;
+}
 
-    // ray-triangle instersection adapted from
-    // http://www.softsurfer.com/Archive/algorithm_0105/algorithm_0105.htm
-    Point3D p = getInterPoint(t_value, origin, dir);
+namespace {
+    /** Cross product of vectors given per dimension */
+    inline void cross(Double4 const* a, Double4 const* b, Double4* result) {
+        result[0] = a[1]*b[2] - a[2]*b[1];
+        result[1] = a[2]*b[0] - a[0]*b[2];
+        result[2] = a[0]*b[1] - a[1]*b[0];
+    }
 
-    Vector3D u(face.vertices[1].point - face.vertices[0].point);
-    Vector3D v(face.vertices[2].point - face.vertices[0].point);
-    // position of p relative to first vertex
-    Vector3D w(p - face.vertices[0].point);
+    inline Double4 dot(Double4 const* a, Double4 const* b) {
+        return a[0]*b[0] + a[1]*b[1] + a[2]*b[2];
+    }
 
-    auto uu = u.squaredNorm();
-    auto uv = u.dot(v);
-    auto vv = v.squaredNorm();
-    auto wu = w.dot(u);
-    auto wv = w.dot(v);
-    double denominator = uv*uv - uu*vv;
+    /**
+     * Moller-Trumbore intersection of rays and triangles, lane by lane,
+     * with each given per dimension. Stores the t_value and the position
+     * within the triangle (@a s along edge1, @a t along edge2), and
+     * @return the lanes intersecting between @a tMin and @a tMax.
+     */
+    inline LaneMask intersectLanes(Double4 const* origin, Double4 const* dir,
+                                   Double4 const* vertex, Double4 const* edge1,
+                                   Double4 const* edge2,
+                                   Double4 const& tMin, Double4 const& tMax,
+                                   Double4& t_value, Double4& s, Double4& t) {
+        const Double4 zero(0.0);
+        const Double4 one(1.0);
 
-    // calculate s,t: parameterization of point p in terms of u,v
-    // if values outside [0,1], then p is outside of triangle bounds
-    double s = (uv*wv - vv*wu) / denominator;
-    if (s < 0.0 || s > 1.0) {
-        return false;
+        Double4 p[3];
+        cross(dir, edge2, p);
+        Double4 determinant = dot(edge1, p);
+
+        // backface culling: the determinant is the dot product of the
+        // direction with edge2 x edge1, the outward normal. Degenerate
+        // triangles (and unused lanes) have none.
+        LaneMask reject = zero <= determinant;
+        if (reject == AllLanes) {
+            return 0;
+        }
+
+        Double4 invDeterminant = one / determinant;
+
+        Double4 toOrigin[3];
+        for (int dim = 0; dim < 3; ++dim) {
+            toOrigin[dim] = origin[dim] - vertex[dim];
+        }
+
+        s = dot(toOrigin, p) * invDeterminant;
+
+        Double4 q[3];
+        cross(toOrigin, edge1, q);
+        t = dot(dir, q) * invDeterminant;
+        t_value = dot(edge2, q) * invDeterminant;
+
+        reject |= (s < zero) | (one < s) | (t < zero) | (one < s + t)
+                | (t_value < tMin) | (tMax < t_value);
+
+        return AllLanes & ~reject;
+    }
+}
+
+bool intersectBlock(TriangleBlock const& block,
+                    FaceStorage const& faces,
+                    Point3D const& origin,
+                    Vector3D const& dir,
+                    double tMin,
+                    FaceIntersection& intersection) {
+
+    Double4 rayOrigin[3], rayDir[3];
+    Double4 vertex[3], edge1[3], edge2[3];
+    for (int dim = 0; dim < 3; ++dim) {
+        rayOrigin[dim] = Double4(origin[dim]);
+        rayDir[dim] = Double4(dir[dim]);
+        vertex[dim] = Double4::load(block.vertex[dim]);
+        edge1[dim] = Double4::load(block.edge1[dim]);
+        edge2[dim] = Double4::load(block.edge2[dim]);
     }
-    double t = (uv*wu - uu*wv) / denominator;
-    if (t < 0.0 || t+s > 1.0) {
+
+    Double4 t_value, s, t;
+    LaneMask hit = intersectLanes(rayOrigin, rayDir, vertex, edge1, edge2,
+                                  Double4(tMin), Double4(intersection.t_value),
+                                  t_value, s, t);
+    if (!hit) {
         return false;
     }
 
-    intersection.face = &face;
-    intersection.t_value = t_value;
-    intersection.s = s;
-    intersection.t = t;
+    // the closest of the faces hit
+    double tLanes[PacketWidth];
+    t_value.store(tLanes);
+
+    int closest = firstLane(hit);
+    for (LaneMask m = hit & (hit - 1); m; m &= m - 1) {
+        int lane = firstLane(m);
+        if (tLanes[lane] < tLanes[closest]) {
+            closest = lane;
+        }
+    }
+
+    double sLanes[PacketWidth], stLanes[PacketWidth];
+    s.store(sLanes);
+    t.store(stLanes);
+
+    // s and t are along the edges of the face as given, not as stored
+    bool swapped = block.swapped & (1u << closest);
+
+    intersection.face = &faces[block.face[closest]];
+    intersection.t_value = tLanes[closest];
+    intersection.s = swapped ? stLanes[closest] : sLanes[closest];
+    intersection.t = swapped ? sLanes[closest] : stLanes[closest];
     return true;
 }
+
+LaneMask intersectBlockFace(TriangleBlock const& block,
+                            int lane,
+                            FaceStorage const& faces,
+                            Double4 const* origin,
+                            Double4 const* dir,
+                            Double4 const& tMin,
+                            LaneMask mask,
+                            FaceIntersectionPacket& intersections) {
+
+    Double4 vertex[3], edge1[3], edge2[3];
+    for (int dim = 0; dim < 3; ++dim) {
+        vertex[dim] = Double4(block.vertex[dim][lane]);
+        edge1[dim] = Double4(block.edge1[dim][lane]);
+        edge2[dim] = Double4(block.edge2[dim][lane]);
+    }
+
+    Double4 t_value, s, t;
+    LaneMask hit = mask & intersectLanes(origin, dir, vertex, edge1, edge2, tMin,
+                                         Double4::load(intersections.t_value),
+                                         t_value, s, t);
+    if (hit) {
+        // s and t are along the edges of the face as given, not as stored
+        if (block.swapped & (1u << lane)) {
+            std::swap(s, t);
+        }
+
+        double tLanes[PacketWidth], sLanes[PacketWidth], stLanes[PacketWidth];
+        t_value.store(tLanes);
+        s.store(sLanes);
+        t.store(stLanes);
+        for (LaneMask m = hit; m; m &= m - 1) {
+            int ray = firstLane(m);
+            intersections.face[ray] = &faces[block.face[lane]];
+            intersections.t_value[ray] = tLanes[ray];
+            intersections.s[ray] = sLanes[ray];
+            intersections.t[ray] = stLanes[ray];
+        }
+    }
+
+    return hit;
+}
@@ -3,7 +3,10 @@
 
 #include "../math/math_types.h"
 #include "../intersection.h"
+#include "../simd.h"
 #include <array>
+#include <cstdint>
+#include <vector>
 
 /**
  * A single vertex on a mesh face.
@@ -18,16 +21,21 @@ struct Vertex {
  * of vertices in some other container
  */
 typedef std::array<size_t, 3> TriangleIndices;
-typedef std::array<Vertex, 3> TriangleVertices;
 
 /**
  * A structure that represents a triangular face on a mesh.
+ *
+ * Vertices are shared between the faces of a mesh, so a face only
+ * refers to them.
  */
 struct Face {
-    TriangleVertices vertices;  ///< array of vertices
-    Vector3D normal;            ///< outward normal to the plane of the triangle
+    std::array<std::uint32_t, 3> vertices; ///< indices into the vertices of the mesh
+    Vector3D normal;                       ///< outward normal to the plane of the triangle
 };
 
+typedef std::vector< Vertex > VertexStorage;
+typedef std::vector< Face > FaceStorage;
+
 /**
  * Intersection struct used for faces. After the best is found,
  * there is enough information to do extra calculations, like smooth
@@ -48,15 +56,88 @@ struct FaceIntersection {
 };
 
 /**
- * Intersect ray starting at @a origin, extending in direction @a dir,
- * with a triangle @a face.
+ * Closest face intersections of the lanes of a ray packet,
+ * with the members of a FaceIntersection per lane.
+ */
+struct FaceIntersectionPacket {
+    FaceIntersectionPacket() {
+        std::fill_n(face, PacketWidth, nullptr);
+        std::fill_n(t_value, PacketWidth, std::numeric_limits<double>::infinity());
+        std::fill_n(s, PacketWidth, 0.0);
+        std::fill_n(t, PacketWidth, 0.0);
+    }
+
+    Face const* face[PacketWidth];
+    double t_value[PacketWidth];
+    double s[PacketWidth];
+    double t[PacketWidth];
+};
+
+/**
+ * Up to PacketWidth faces, precomputed for intersection (Moller-Trumbore)
+ * and stored per coordinate, so a ray is tested against all of them at
+ * once, or one of them against all rays of a packet.
+ *
+ * The edges of every face are ordered so that its outward normal points
+ * along edge2 x edge1, which is all backface culling needs to know.
+ * Unused lanes hold degenerate triangles, which are never intersected.
+ */
+struct TriangleBlock {
+    TriangleBlock();
+
+    /**
+     * Put the face at @a index of @a faces into lane @a lane, with its
+     * vertices taken from @a vertices
+     */
+    void setFace(int lane, FaceStorage const& faces, std::uint32_t index,
+                 VertexStorage const& vertices);
+
+    double vertex[3][PacketWidth]; ///< first vertex of each face, by dimension
+    double edge1[3][PacketWidth];  ///< from the first to the second (or third) vertex
+    double edge2[3][PacketWidth];  ///< from the first to the third (or second) vertex
+
+    std::uint32_t face[PacketWidth]; ///< index of the face in each lane
+
+    /** lanes with edges to the third, then second vertex */
+    LaneMask swapped;
+};
+
+/**
+ * Intersect the ray starting at @a origin, extending in direction @a dir,
+ * with all faces of @a block at once. Faces seen from behind and
+ * intersections before @a tMin are ignored.
+ *
+ * @return true if a face is intersected closer than the t_value of
+ * @a intersection, and store the closest such in it. Face indices of the
+ * block refer to @a faces.
+ */
+bool intersectBlock(TriangleBlock const& block,
+                    FaceStorage const& faces,
+                    Point3D const& origin,
+                    Vector3D const& dir,
+                    double tMin,
+                    FaceIntersection& intersection);
+
+/**
+ * Intersect the rays in the lanes @a mask of a packet, starting at
+ * @a origin and extending in direction @a dir (given per dimension),
+ * with the face in lane @a lane of @a block, testing all rays at once.
+ * Rejects intersections before @a tMin, as intersectBlock does.
+ *
+ * This is the test of intersectBlock with the lanes holding rays instead
+ * of faces: a packet visits the faces of a block one at a time, so it
+ * only pays off for packets with most of their lanes active.
  *
- * @return true if an intersection exist, and populate the @a intersection structure.
- * @return false otherwise.
+ * @return the lanes intersecting the face closer than their t_value
+ * in @a intersections, which are updated.
  */
-bool intersectFace(Face const& face,
-                   Point3D const& origin,
-                   Vector3D const& dir,
-                   FaceIntersection& intersection);
+LaneMask intersectBlockFace(TriangleBlock const& block,
+                            int lane,
+                            FaceStorage const& faces,
+                            Double4 const* origin,
+                            Double4 const* dir,
+                            Double4 const& tMin,
+                            LaneMask mask,
+                            FaceIntersectionPacket& intersections);
 
 #endif // _FACE_H_
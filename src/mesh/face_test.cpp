@@ -0,0 +1,255 @@
+/***********************************************************
+    Checks of the triangle block intersection against a
+    plain Moller-Trumbore test of one ray and one face.
+    Build and run with "make check"; prints any failures
+    and returns non-zero.
+***********************************************************/
+
+#include "face.h"
+#include "../rng.h"
+
+#include <cmath>
+#include <iostream>
+#include <limits>
+
+namespace {
+
+    int failures = 0;
+
+    void check(bool condition, char const* what) {
+        if (!condition) {
+            std::cerr << "FAILED: " << what << std::endl;
+            ++failures;
+        }
+    }
+
+    bool near(double a, double b) {
+        return std::abs(a - b) <= 1e-9 * (1.0 + std::abs(a));
+    }
+
+    Point3D randomPoint(qnd::Rng& rng, double extent) {
+        return Point3D(rng.uniform(-extent, extent), rng.uniform(-extent, extent),
+                       rng.uniform(-extent, extent));
+    }
+
+    /**
+     * Intersection of one ray with one face, along the edges from its
+     * first vertex as given. Faces seen from behind are missed.
+     */
+    bool intersectFace(Face const& face, VertexStorage const& vertices,
+                       Point3D const& origin, Vector3D const& dir,
+                       double tMin, double tMax, FaceIntersection& intersection) {
+        if (dir.dot(face.normal) >= 0) {
+            return false;
+        }
+
+        Point3D const& p0 = vertices[face.vertices[0]].point;
+        Vector3D edge1(vertices[face.vertices[1]].point - p0);
+        Vector3D edge2(vertices[face.vertices[2]].point - p0);
+
+        Vector3D p(dir.cross(edge2));
+        double invDeterminant = 1.0 / edge1.dot(p);
+
+        Vector3D toOrigin(origin - p0);
+        double s = toOrigin.dot(p) * invDeterminant;
+        Vector3D q(toOrigin.cross(edge1));
+        double t = dir.dot(q) * invDeterminant;
+        double t_value = edge2.dot(q) * invDeterminant;
+
+        if (s < 0 || s > 1 || t < 0 || s + t > 1 || t_value < tMin || t_value > tMax) {
+            return false;
+        }
+
+        intersection.face = &face;
+        intersection.t_value = t_value;
+        intersection.s = s;
+        intersection.t = t;
+        return true;
+    }
+
+    bool sameIntersection(FaceIntersection const& a, FaceIntersection const& b) {
+        if (a.face != b.face) {
+            return false;
+        }
+        return !a.face || (near(a.t_value, b.t_value) && near(a.s, b.s) && near(a.t, b.t));
+    }
+
+    /**
+     * Random triangles, about half of them with the outward normal along
+     * edge1 x edge2 (stored swapped in a block), half along edge2 x edge1
+     */
+    void randomFaces(qnd::Rng& rng, int count, VertexStorage& vertices, FaceStorage& faces) {
+        for (int f = 0; f < count; ++f) {
+            Face face;
+            for (int i = 0; i < 3; ++i) {
+                Vertex vertex;
+                vertex.point = randomPoint(rng, 1.0);
+                face.vertices[i] = vertices.size();
+                vertices.push_back(vertex);
+            }
+
+            Point3D const& p0 = vertices[face.vertices[0]].point;
+            Vector3D edge1(vertices[face.vertices[1]].point - p0);
+            Vector3D edge2(vertices[face.vertices[2]].point - p0);
+            Vector3D normal(edge2.cross(edge1));
+            face.normal = rng.uniform() < 0.5 ? normal : Vector3D(-normal);
+            faces.push_back(face);
+        }
+    }
+
+    /**
+     * A ray from the box [-3,3]^3, aimed at a random point of one of the
+     * faces or, to pass through the degenerate triangles of unused lanes,
+     * at the origin
+     */
+    void randomRay(qnd::Rng& rng, VertexStorage const& vertices, FaceStorage const& faces,
+                   Point3D& origin, Vector3D& dir) {
+        origin = randomPoint(rng, 3.0);
+
+        Point3D target(0, 0, 0);
+        if (rng.uniform() < 0.8) {
+            Face const& face = faces[int(rng.uniform() * faces.size())];
+            // barycentric coordinates slightly beyond the face, to miss it at times
+            double s = rng.uniform(-0.2, 1.0);
+            double t = rng.uniform(-0.2, 1.0);
+            Point3D const& p0 = vertices[face.vertices[0]].point;
+            target = p0 + s * (vertices[face.vertices[1]].point - p0)
+                        + t * (vertices[face.vertices[2]].point - p0);
+        }
+
+        dir = target - origin;
+        dir.normalize();
+    }
+
+    // faces per block: full blocks and blocks with unused lanes
+    const int faceCounts[] = { 1, 2, 3, PacketWidth };
+
+    void testBlock() {
+        qnd::Rng rng;
+        int hits = 0, culled = 0;
+        for (int faceCount : faceCounts) {
+            for (int trial = 0; trial < 2000; ++trial) {
+                VertexStorage vertices;
+                FaceStorage faces;
+                randomFaces(rng, faceCount, vertices, faces);
+
+                TriangleBlock block;
+                for (int lane = 0; lane < faceCount; ++lane) {
+                    block.setFace(lane, faces, lane, vertices);
+                }
+
+                for (int ray = 0; ray < 8; ++ray) {
+                    Point3D origin;
+                    Vector3D dir;
+                    randomRay(rng, vertices, faces, origin, dir);
+                    double tMin = rng.uniform() < 0.5 ? 0.0 : rng.uniform(0.0, 3.0);
+                    double tMax = rng.uniform() < 0.5 ? std::numeric_limits<double>::infinity()
+                                                      : rng.uniform(0.0, 6.0);
+
+                    FaceIntersection expected;
+                    expected.t_value = tMax;
+                    for (Face const& face : faces) {
+                        intersectFace(face, vertices, origin, dir, tMin, expected.t_value, expected);
+                        culled += dir.dot(face.normal) >= 0;
+                    }
+
+                    FaceIntersection found;
+                    found.t_value = tMax;
+                    bool hit = intersectBlock(block, faces, origin, dir, tMin, found);
+
+                    hits += hit;
+                    check(hit == (expected.face != nullptr), "block hits where a face is hit");
+                    check(sameIntersection(found, expected), "block finds the closest face");
+                    check(hit || found.t_value == tMax, "block misses leave the intersection alone");
+                }
+            }
+        }
+        check(hits > 5000 && culled > 20000, "block checks cover hits and backfaces");
+    }
+
+    void testBlockFace() {
+        qnd::Rng rng;
+        int hits = 0;
+        for (int faceCount : faceCounts) {
+            for (int trial = 0; trial < 2000; ++trial) {
+                VertexStorage vertices;
+                FaceStorage faces;
+                randomFaces(rng, faceCount, vertices, faces);
+
+                TriangleBlock block;
+                for (int lane = 0; lane < faceCount; ++lane) {
+                    block.setFace(lane, faces, lane, vertices);
+                }
+
+                Point3D origins[PacketWidth];
+                Vector3D dirs[PacketWidth];
+                double origin[3][PacketWidth], dir[3][PacketWidth], tMin[PacketWidth];
+                FaceIntersectionPacket found;
+                FaceIntersection expected[PacketWidth];
+                for (int ray = 0; ray < PacketWidth; ++ray) {
+                    randomRay(rng, vertices, faces, origins[ray], dirs[ray]);
+                    for (int dim = 0; dim < 3; ++dim) {
+                        origin[dim][ray] = origins[ray][dim];
+                        dir[dim][ray] = dirs[ray][dim];
+                    }
+                    tMin[ray] = rng.uniform() < 0.5 ? 0.0 : rng.uniform(0.0, 3.0);
+                    if (rng.uniform() < 0.5) {
+                        found.t_value[ray] = expected[ray].t_value = rng.uniform(0.0, 6.0);
+                    }
+                }
+
+                Double4 packetOrigin[3], packetDir[3];
+                for (int dim = 0; dim < 3; ++dim) {
+                    packetOrigin[dim] = Double4::load(origin[dim]);
+                    packetDir[dim] = Double4::load(dir[dim]);
+                }
+                LaneMask mask = LaneMask(rng.uniform() * (AllLanes + 1));
+
+                // all lanes of the block, the unused ones included
+                for (int lane = 0; lane < PacketWidth; ++lane) {
+                    LaneMask expectedHits = 0;
+                    if (lane < faceCount) {
+                        for (int ray = 0; ray < PacketWidth; ++ray) {
+                            if ((mask & (1u << ray))
+                                && intersectFace(faces[lane], vertices, origins[ray], dirs[ray],
+                                                 tMin[ray], expected[ray].t_value, expected[ray])) {
+                                expectedHits |= 1u << ray;
+                            }
+                        }
+                    }
+
+                    LaneMask hit = intersectBlockFace(block, lane, faces, packetOrigin, packetDir,
+                                                      Double4::load(tMin), mask, found);
+                    hits += __builtin_popcount(hit);
+                    check(hit == expectedHits, "packet hits the rays a face is hit by");
+                    check(lane < faceCount || !hit, "unused lanes are never hit");
+                }
+
+                for (int ray = 0; ray < PacketWidth; ++ray) {
+                    FaceIntersection result;
+                    result.face = found.face[ray];
+                    result.t_value = found.t_value[ray];
+                    result.s = found.s[ray];
+                    result.t = found.t[ray];
+                    check(sameIntersection(result, expected[ray]), "packet finds the closest face of each ray");
+                }
+            }
+        }
+        check(hits > 1000, "packet checks cover hits");
+    }
+
+}
+
+int main (int argc, char* argv[]) {
+
+    testBlock();
+    testBlockFace();
+
+    if (failures) {
+        std::cerr << failures << " check(s) failed" << std::endl;
+        return 1;
+    }
+
+    std::cout << "All face intersection checks passed" << std::endl;
+    return 0;
+}
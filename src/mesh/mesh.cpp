@@ -1,42 +1,120 @@
 #include "mesh.h"
 #include "obj_store.h"
 #include "../light_volume.h"
-#include <iostream>
-
-Mesh::Mesh(ObjStore* obj) : BoundedObject(new LightSphere(obj->largestCoord())),
-                            obj_(obj),
-                            boxBound_(obj->minPoint(), obj->maxPoint()),
-                            smoothNormals_(obj->smoothNormals) {
-
-    // preprocess OBJ data to generate face structs
-    obj_->generateFaces();
-
-    // build a KD tree from the faces of the mesh
-    kd_.build(obj->getFaces(), boxBound_);
-
-    // TODO: assert?
-    std::cout << "Total faces: " << obj->numFaces()
-              << " kd faces: " << kd_.countTotalFaces()
-              << " depth: " << kd_.depth()
-              << " max leaf faces: " << kd_.maxLeafObjects()
-              << std::endl;
-                            
-}
+#include "../sampling_strategy.h"
+#include "../ray_packet.h"
+
+#include <algorithm>
+#include <cmath>
+
+Mesh::Mesh(ObjStore* obj) : Mesh(obj->getGeometry()) { }
+
+Mesh::Mesh(std::shared_ptr< MeshGeometry const > geometry)
+                : BoundedObject(new LightSphere(geometry->largestCoord())),
+                  geometry_(geometry) { }
+
 Mesh::~Mesh() { }
 
+SamplingStrategy* Mesh::createLightStrategy( AffineTrans3D const& modelToWorld,
+                                             AffineTrans3D const& worldToModel ) const {
+    MeshLightStrategy* strategy = new MeshLightStrategy(geometry_, modelToWorld, worldToModel);
+
+    // nothing to sample on
+    if (!(strategy->area() > 0)) {
+        delete strategy;
+        return nullptr;
+    }
+
+    return strategy;
+}
+
+double Mesh::getEmissionCone( AffineTrans3D const& worldToModel, Vector3D& axis ) const {
+    FaceStorage const& faces = geometry_->faces();
+
+    // axis along the mean of the face normals in world space
+    Vector3D sum(0.0, 0.0, 0.0);
+    for (Face const& face : faces) {
+        Vector3D normal(worldToModel.invTransNorm(face.normal.v));
+        if (normal.normalize() > 0) {
+            sum += normal;
+        }
+    }
+    if (!(sum.norm() > 1e-6 * faces.size())) {
+        return -1.0;
+    }
+    axis = sum;
+    axis.normalize();
+
+    // widest angle between the axis and a face normal
+    double cosNormals = 1.0;
+    for (Face const& face : faces) {
+        Vector3D normal(worldToModel.invTransNorm(face.normal.v));
+        if (normal.normalize() > 0) {
+            cosNormals = std::min(cosNormals, axis.dot(normal));
+        }
+    }
+
+    double spread = std::acos(std::max(-1.0, cosNormals)) + M_PI / 2;
+    return spread < M_PI ? std::cos(spread) : -1.0;
+}
+
+bool Mesh::getModelBound( Point3D& minPoint, Point3D& maxPoint ) const {
+    minPoint = geometry_->bound().minPoint();
+    maxPoint = geometry_->bound().maxPoint();
+    return true;
+}
+
 
 void Mesh::doIntersect( Point3D origin, Vector3D dir, Intersection& intersection ) const {
 
     // check model-space tight bound
     double length = dir.normalize();
-    if ( !boxBound_.fastIntersect(origin, dir) ) {
+    if ( !geometry_->bound().fastIntersect(origin, dir) ) {
         return;
     }
     
     FaceIntersection faceInter;
 
     // traverse the kd tree to find suitable intersections
-    kd_.traverse(origin, dir, faceInter);
+    geometry_->kdTree().traverse(origin, dir, faceInter);
+
+    fillIntersection(faceInter, origin, dir, length, intersection);
+}
+
+void Mesh::doIntersectPacket( RayPacket const& packet, LaneMask mask,
+                              Intersection* intersections ) const {
+
+    // normalize the lanes as single rays are, and keep those
+    // within the model-space tight bound
+    RayPacket unit;
+    double length[PacketWidth];
+    for (LaneMask m = mask; m; m &= m - 1) {
+        int lane = firstLane(m);
+        Point3D origin = packet.originOf(lane);
+        Vector3D dir = packet.dirOf(lane);
+        length[lane] = dir.normalize();
+        if ( geometry_->bound().fastIntersect(origin, dir) ) {
+            unit.setRay(lane, origin, dir);
+        }
+    }
+
+    if (!unit.active) {
+        return;
+    }
+
+    FaceIntersection faceInter[PacketWidth];
+    geometry_->kdTree().traverse(unit, unit.active, faceInter);
+
+    for (LaneMask m = unit.active; m; m &= m - 1) {
+        int lane = firstLane(m);
+        fillIntersection(faceInter[lane], unit.originOf(lane), unit.dirOf(lane),
+                         length[lane], intersections[lane]);
+    }
+}
+
+void Mesh::fillIntersection( FaceIntersection const& faceInter,
+                             Point3D const& origin, Vector3D const& dir,
+                             double length, Intersection& intersection ) const {
 
     // since no intersection, exit early
     if (!faceInter.face) {
@@ -52,10 +130,11 @@ void Mesh::doIntersect( Point3D origin, Vector3D dir, Intersection& intersection
 
     // Find normal at intersection point
     Face const& face = *faceInter.face;
-    if (smoothNormals_) {
-        Vector3D const& n0 = face.vertices[0].normal;
-        Vector3D const& n1 = face.vertices[1].normal;
-        Vector3D const& n2 = face.vertices[2].normal;
+    if (geometry_->smoothNormals()) {
+        VertexStorage const& vertices = geometry_->vertices();
+        Vector3D const& n0 = vertices[face.vertices[0]].normal;
+        Vector3D const& n1 = vertices[face.vertices[1]].normal;
+        Vector3D const& n2 = vertices[face.vertices[2]].normal;
 
         // will be renormalized later when needed
         intersection.normal = n0 + faceInter.s * (n1 - n0) + faceInter.t * (n2 - n0);
@@ -70,3 +149,40 @@ void Mesh::doIntersect( Point3D origin, Vector3D dir, Intersection& intersection
     intersection.t_value /= length;
 }
 
+
+bool Mesh::doOccluded( Point3D origin, Vector3D dir, double tMin, double tMax ) const {
+
+    // check model-space tight bound
+    double length = dir.normalize();
+    if ( !geometry_->bound().fastIntersect(origin, dir) ) {
+        return false;
+    }
+
+    // t_values scale along with the normalized dir vector
+    return geometry_->kdTree().occluded(origin, dir, tMin * length, tMax * length);
+}
+
+LaneMask Mesh::doOccludedPacket( RayPacket const& packet, LaneMask mask,
+                                 double const* tMin, double const* tMax ) const {
+
+    RayPacket unit;
+    double unitMin[PacketWidth] = { 0 };
+    double unitMax[PacketWidth] = { 0 };
+    for (LaneMask m = mask; m; m &= m - 1) {
+        int lane = firstLane(m);
+        Point3D origin = packet.originOf(lane);
+        Vector3D dir = packet.dirOf(lane);
+        double length = dir.normalize();
+        if ( geometry_->bound().fastIntersect(origin, dir) ) {
+            unit.setRay(lane, origin, dir);
+            unitMin[lane] = tMin[lane] * length;
+            unitMax[lane] = tMax[lane] * length;
+        }
+    }
+
+    if (!unit.active) {
+        return 0;
+    }
+
+    return geometry_->kdTree().occluded(unit, unit.active, unitMin, unitMax);
+}
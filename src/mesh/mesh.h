@@ -2,27 +2,52 @@
 #define _MESH_H_
 
 #include "../scene_object.h"
-#include "../bounding_volume.h"
-#include "../kdtree/kd_tree.h"
+#include "mesh_geometry.h"
+
+#include <memory>
 
 class ObjStore;
-class Face;
 
 /**
  * A mesh object that can be placed in a scene.
+ *
+ * Only refers to the geometry of the mesh, which is shared between
+ * all Mesh instances created from the same ObjStore.
  */
 class Mesh : public BoundedObject {
 
 public:
     /**
-     * Construct a mesh from an OBJ representation
+     * Construct a mesh from an OBJ representation.
+     *
+     * The geometry is only built for the first instance of @a obj.
      */
     Mesh(ObjStore* obj);
+
+    /**
+     * Construct another instance of already built @a geometry.
+     */
+    Mesh(std::shared_ptr< MeshGeometry const > geometry);
     ~Mesh();
 
     // TODO: determine solidness? perhaps argument of constructor?
     bool isSolid() const { return false; }
 
+    bool getModelBound( Point3D& minPoint, Point3D& maxPoint ) const;
+
+    /**
+     * Sample points on the faces of the mesh, rather than
+     * the sphere around it.
+     */
+    SamplingStrategy* createLightStrategy( AffineTrans3D const& modelToWorld,
+                                           AffineTrans3D const& worldToModel ) const;
+
+    /**
+     * Faces are only intersected from the front, so the cone bounds the
+     * hemispheres around their normals. Closed meshes emit all around.
+     */
+    double getEmissionCone( AffineTrans3D const& worldToModel, Vector3D& axis ) const;
+
 private:
     /**
      * Carry out the intersctin with the mesh in model space.
@@ -31,11 +56,36 @@ private:
                       Vector3D dir,
                       Intersection& intersection ) const;
 
+    /**
+     * Check for any face intersected along the segment in model space,
+     * without computing normals for it.
+     */
+    bool doOccluded( Point3D origin,
+                     Vector3D dir,
+                     double tMin, double tMax ) const;
+
+    /**
+     * Intersect the lanes of the packet in model space, walking the
+     * kd tree with all of them at once.
+     */
+    void doIntersectPacket( RayPacket const& packet, LaneMask mask,
+                            Intersection* intersections ) const;
+
+    LaneMask doOccludedPacket( RayPacket const& packet, LaneMask mask,
+                               double const* tMin, double const* tMax ) const;
+
+    /**
+     * Fill in @a intersection from the closest face hit @a faceInter
+     * along the ray from @a origin in unit direction @a dir, whose
+     * original length was @a length.
+     */
+    void fillIntersection( FaceIntersection const& faceInter,
+                           Point3D const& origin, Vector3D const& dir,
+                           double length, Intersection& intersection ) const;
+
 private:
-    ObjStore* obj_; ///< holds vertex/face data parsed from OBJ
-    BoundingBox boxBound_; ///< internal tight model-space bound
-    KDTree  kd_;    ///< kd tree built up from the faces
-    bool smoothNormals_; ///< keeps track whether to smooth normals or not.
+    /** faces and kd tree, shared with other instances of the mesh */
+    std::shared_ptr< MeshGeometry const > geometry_;
 };
 
 #endif // _MESH_H_
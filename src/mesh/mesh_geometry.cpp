@@ -0,0 +1,26 @@
+#include "mesh_geometry.h"
+#include <iostream>
+
+MeshGeometry::MeshGeometry(VertexStorage&& vertices, FaceStorage&& faces,
+                           BoundingBox const& box,
+                           double largestCoord, bool smoothNormals,
+                           KDBuildMethod method)
+                                : vertices_(std::move(vertices)),
+                                  faces_(std::move(faces)),
+                                  box_(box),
+                                  largest_(largestCoord),
+                                  smoothNormals_(smoothNormals) {
+
+    // build a KD tree from the faces of the mesh
+    kd_.build(faces_, vertices_, box_, method);
+
+    // TODO: assert?
+    std::cout << "Total faces: " << faces_.size()
+              << " kd face references: " << kd_.countTotalFaces()
+              << " depth: " << kd_.depth()
+              << " max leaf faces: " << kd_.maxLeafObjects()
+              << std::endl;
+    kd_.printStatistics(std::cout);
+}
+
+MeshGeometry::~MeshGeometry() { }
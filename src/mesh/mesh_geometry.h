@@ -0,0 +1,51 @@
+#ifndef _MESH_GEOMETRY_H_
+#define _MESH_GEOMETRY_H_
+
+#include "face.h"
+#include "../bounding_volume.h"
+#include "../kdtree/kd_tree.h"
+
+#include <boost/noncopyable.hpp>
+
+/**
+ * The immutable part of a mesh: its vertices and faces, a tight
+ * model-space bound, and the KD tree built over the faces.
+ *
+ * Built once per ObjStore and shared read-only by every Mesh
+ * instancing it, so placing the same mesh in many nodes costs
+ * only a transformation and a material per node.
+ */
+class MeshGeometry : boost::noncopyable {
+
+public:
+    /**
+     * Take ownership of the @a faces between @a vertices, bounded by
+     * @a box, and build the acceleration structure over them using
+     * @a method.
+     */
+    MeshGeometry(VertexStorage&& vertices, FaceStorage&& faces, BoundingBox const& box,
+                 double largestCoord, bool smoothNormals,
+                 KDBuildMethod method = KDBuild_SurfaceArea);
+    ~MeshGeometry();
+
+    VertexStorage const& vertices() const { return vertices_; }
+    FaceStorage const& faces() const { return faces_; }
+    BoundingBox const& bound() const { return box_; }
+    KDTree const& kdTree() const { return kd_; }
+
+    /** @return the absolute largest coordinate of any vertex */
+    double largestCoord() const { return largest_; }
+
+    /** @return whether normals should be interpolated across faces */
+    bool smoothNormals() const { return smoothNormals_; }
+
+private:
+    VertexStorage vertices_; ///< vertices shared by the faces
+    FaceStorage faces_; ///< final face collection, referenced by the kd tree
+    BoundingBox box_;   ///< tight model-space bound around all faces
+    KDTree kd_;         ///< kd tree built up from the faces
+    double largest_;    ///< largest distance of a vertex from the origin
+    bool smoothNormals_;
+};
+
+#endif // _MESH_GEOMETRY_H_
@@ -1,4 +1,5 @@
 #include "obj_store.h"
+#include "mesh_geometry.h"
 
 namespace {
     const double inf = std::numeric_limits<double>::infinity();
@@ -6,6 +7,7 @@ namespace {
 
 ObjStore::ObjStore() : invertNormals(false),
                        smoothNormals(false),
+                       kdBuildMethod(KDBuild_SurfaceArea),
                        minPoint_(inf, inf, inf),
                        maxPoint_(-inf, -inf, -inf),
                        largest_(0) {
@@ -68,6 +70,15 @@ void ObjStore::generateFaces() {
     // clear any faces that were generated previously
     faces_.clear();
 
+    // vertices are shared by the faces
+    meshVertices_.clear();
+    for (unsigned int vertexIndex = 0; vertexIndex < vertices_.size(); ++vertexIndex) {
+        Vertex vertex;
+        vertex.point = vertices_[vertexIndex].point;
+        vertex.normal = vertexNormals_[vertexIndex];
+        meshVertices_.push_back(vertex);
+    }
+
     // given that we know normals for each face as well as
     // normals for each point, it should be trivial to combine
     // the data into the final Face struct
@@ -80,18 +91,35 @@ void ObjStore::generateFaces() {
         // fetch the normal precalculated for that face
         face.normal = faceNormals_[faceIndex];
 
-        // and find the points and normals for the vertices
-        // of the face
+        // and refer to the vertices of the face, in order
         for (int i = 0; i < 3; ++i) {
-            int vertexIndex = getVertexIndex(f, i);
-            face.vertices[i].point = vertices_[vertexIndex].point;
-            face.vertices[i].normal = vertexNormals_[vertexIndex];
+            face.vertices[i] = getVertexIndex(f, i);
         }
 
         faces_.push_back(face);
     }
 }
 
+std::shared_ptr< MeshGeometry const > ObjStore::getGeometry() {
+    if (!geometry_) {
+        generateFaces();
+
+        // hand the vertices and faces over to the geometry, and free
+        // the intermediate normals which are no longer needed
+        geometry_ = std::make_shared< MeshGeometry const >(std::move(meshVertices_),
+                                             std::move(faces_),
+                                             BoundingBox(minPoint_, maxPoint_),
+                                             largest_, smoothNormals,
+                                             kdBuildMethod);
+        meshVertices_.clear();
+        faces_.clear();
+        std::vector< Vector3D >().swap(faceNormals_);
+        std::vector< Vector3D >().swap(vertexNormals_);
+    }
+
+    return geometry_;
+}
+
 void ObjStore::generateNormals() {
     faceNormals_.clear(); vertexNormals_.clear();
 
@@ -2,9 +2,13 @@
 #define _OBJ_STORE_H_
 
 #include "face.h"
+#include "../kdtree/kd_tree.h"
 
 #include <vector>
 #include <array>
+#include <memory>
+
+class MeshGeometry;
 
 /**
  * Stores data from an OBJ file
@@ -43,9 +47,14 @@ public:
     void generateFaces();
 
     /**
-     * @return a vector of all faces (after being generated).
+     * @return the shared geometry of this mesh, ready for intersection.
+     *
+     * Faces and the acceleration structure are generated on the first
+     * call only. Every later call returns the same geometry, so all
+     * instances of the mesh share a single copy.
+     * Call this after all vertices/faces have been added.
      */
-    std::vector< Face > const& getFaces() { return faces_; }
+    std::shared_ptr< MeshGeometry const > getGeometry();
 
     // Useful functions to determine bounds of the mesh
     Point3D const& minPoint() { return minPoint_; }
@@ -74,6 +83,7 @@ public:
 
     bool invertNormals; ///< controls whether normals are inverted or not
     bool smoothNormals; ///< controls whether normals are smoothed (phong)
+    KDBuildMethod kdBuildMethod; ///< how the kd tree over the faces is built
 
 private:
 
@@ -108,8 +118,12 @@ private:
 
     std::vector< Vector3D > faceNormals_;   ///< collection of normals for each face
     std::vector< Vector3D > vertexNormals_; ///< interpolated normals of parent faces
+    VertexStorage meshVertices_;            ///< final vertex collection, shared by faces
     std::vector< Face > faces_;             ///< final face collection
 
+    /** geometry shared by all instances, faces are moved into it */
+    std::shared_ptr< MeshGeometry const > geometry_;
+
     Point3D sum_;       ///< sum of all vertices
     Point3D minPoint_;  ///< a point in space with the smallest coefficients of all vertices
     Point3D maxPoint_;  ///< a point in space with the largest coefficients of all vertices
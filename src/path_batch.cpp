@@ -0,0 +1,58 @@
+#include "path_batch.h"
+
+PathBatch::PathBatch(ScratchArena& scratch, std::size_t capacity)
+    : scratch(scratch),
+      origin(scratch, capacity),
+      dir(scratch, capacity),
+      hit(scratch, capacity),
+      sampler(scratch, capacity),
+      col(scratch, capacity),
+      throughput(scratch, capacity),
+      diffuseBounces(scratch, capacity),
+      specularBounces(scratch, capacity),
+      countEmission(scratch, capacity),
+      lightProbability(scratch, capacity),
+      diffuseProbability(scratch, capacity),
+      active(scratch, capacity) { }
+
+void PathBatch::addPath(Point3D const& o, Vector3D const& d, PixelSampler& s) {
+    active.push_back(size());
+
+    origin.push_back(o);
+    dir.push_back(d);
+    hit.push_back(Intersection());
+    sampler.push_back(&s);
+
+    // the integrator sets the bounces the path may take
+    col.push_back(Colour(0.0, 0.0, 0.0));
+    throughput.push_back(Colour(1.0, 1.0, 1.0));
+    diffuseBounces.push_back(0);
+    specularBounces.push_back(0);
+    countEmission.push_back(true);
+    lightProbability.push_back(0.0);
+    diffuseProbability.push_back(0.0);
+}
+
+LightRayQueue::LightRayQueue(ScratchArena& scratch, std::size_t capacity)
+    : path(scratch, capacity),
+      origin(scratch, capacity),
+      dir(scratch, capacity),
+      tMax(scratch, capacity),
+      weight(scratch, capacity) { }
+
+void LightRayQueue::push(std::uint32_t p, Point3D const& o, Vector3D const& d,
+                         double t, Colour const& w) {
+    path.push_back(p);
+    origin.push_back(o);
+    dir.push_back(d);
+    tMax.push_back(t);
+    weight.push_back(w);
+}
+
+void LightRayQueue::clear() {
+    path.clear();
+    origin.clear();
+    dir.clear();
+    tMax.clear();
+    weight.clear();
+}
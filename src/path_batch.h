@@ -0,0 +1,94 @@
+#ifndef _PATH_BATCH_H_
+#define _PATH_BATCH_H_
+
+#include "math/math_types.h"
+#include "colour.h"
+#include "intersection.h"
+#include "scratch_arena.h"
+
+#include <cstdint>
+
+class PixelSampler;
+
+/**
+ * Paths of the path integrator, traced together breadth-first: every
+ * stage (intersect, shade, trace light rays) runs over all live paths
+ * before the next one starts.
+ *
+ * Ray, hit and path data are kept in structure-of-arrays form, indexed
+ * by path, in memory from a ScratchArena.
+ */
+struct PathBatch {
+    /**
+     * An empty batch with room for @a capacity paths, taking its memory
+     * (and that of its tracing) from @a scratch.
+     */
+    PathBatch(ScratchArena& scratch, std::size_t capacity);
+
+    /**
+     * Add a path starting along the ray from @a origin in direction
+     * @a dir, drawing its random numbers from @a sampler.
+     *
+     * ASSUMPTION: the batch is not full
+     */
+    void addPath(Point3D const& origin, Vector3D const& dir, PixelSampler& sampler);
+
+    std::size_t size() const { return origin.size(); }
+
+    ScratchArena& scratch; ///< memory for the tracing of the batch
+
+    // current ray of each path, and its intersection once traced
+    ScratchArray< Point3D > origin;
+    ScratchArray< Vector3D > dir;
+    ScratchArray< Intersection > hit;
+    ScratchArray< PixelSampler* > sampler;
+
+    // state of each path between its vertices
+    ScratchArray< Colour > col;         ///< light gathered so far, the result once traced
+    ScratchArray< Colour > throughput;  ///< weight of light arriving along the current ray
+    ScratchArray< int > diffuseBounces;
+    ScratchArray< int > specularBounces;
+
+    /**
+     * Whether emission hit by the current ray is unaccounted for by
+     * direct sampling (camera rays, and rays after specular bounces)
+     */
+    ScratchArray< bool > countEmission;
+
+    // probabilities of the last diffuse direction under the emitter and
+    // diffuse strategies respectively
+    ScratchArray< double > lightProbability;
+    ScratchArray< double > diffuseProbability;
+
+    ScratchArray< std::uint32_t > active; ///< paths still being traced
+};
+
+/**
+ * Rays towards lights, queued while shading the vertices of a PathBatch,
+ * and traced together afterwards. Light found along ray k is scaled by
+ * weight[k], and added to path[k].
+ */
+struct LightRayQueue {
+    LightRayQueue(ScratchArena& scratch, std::size_t capacity);
+
+    /**
+     * Queue a ray of path @a p from @a origin in direction @a dir,
+     * up to @a tMax along it.
+     *
+     * ASSUMPTION: the queue is not full
+     */
+    void push(std::uint32_t p, Point3D const& origin, Vector3D const& dir,
+              double tMax, Colour const& weight);
+
+    void clear();
+
+    std::size_t size() const { return path.size(); }
+
+    ScratchArray< std::uint32_t > path;
+    ScratchArray< Point3D > origin;
+    ScratchArray< Vector3D > dir;
+    ScratchArray< double > tMax;
+    ScratchArray< Colour > weight;
+};
+
+#endif // _PATH_BATCH_H_
@@ -0,0 +1,61 @@
+#include "pixel_sampler.h"
+
+namespace {
+
+    // a random permutation of [0, count), chosen by seed. Permutes the
+    // next power of two, and walks the cycle until the index is in range.
+    std::uint32_t permuteIndex(std::uint32_t index, std::uint32_t count,
+                               std::uint32_t seed) {
+        std::uint32_t mask = count - 1;
+        mask |= mask >> 1;
+        mask |= mask >> 2;
+        mask |= mask >> 4;
+        mask |= mask >> 8;
+        mask |= mask >> 16;
+
+        do {
+            index = qnd::laineKarrasPermutation(index, seed) & mask;
+        } while (index >= count);
+
+        return index;
+    }
+
+}
+
+PixelSampler::PixelSampler(qnd::Rng& rng, ScratchArena& scratch)
+    : sequence_(nullptr),
+      index_(0),
+      key_(0),
+      dimension_(0),
+      rng_(&rng),
+      scratch_(&scratch) { }
+
+PixelSampler::PixelSampler(UVSampler const& sequence, std::uint32_t index,
+                           std::uint32_t key, qnd::Rng& rng, ScratchArena& scratch)
+    : sequence_(&sequence),
+      index_(index),
+      key_(key),
+      dimension_(0),
+      rng_(&rng),
+      scratch_(&scratch) { }
+
+uv_sample PixelSampler::get2D() {
+    if (!sequence_) {
+        uv_sample result = { { rng_->uniform(), rng_->uniform() } };
+        return result;
+    }
+
+    // every pair of dimensions visits the sequence in its own order,
+    // with its own scrambling. The order is shuffled within each pass of
+    // n samples, so passes together still make up the start of the sequence.
+    std::uint64_t hash = qnd::mixBits((std::uint64_t(key_) << 32) | dimension_++);
+    std::uint32_t scramble[2] = { std::uint32_t(hash), std::uint32_t(hash >> 32) };
+
+    const std::uint32_t n = sequence_->n();
+    const std::uint32_t pass = index_ / n;
+    std::uint32_t shuffled = pass*n + permuteIndex(index_ % n, n,
+                                                   std::uint32_t(qnd::mixBits(hash + pass)));
+
+    return *uv_iterator(shuffled, sequence_->n(), sequence_->sequence(),
+                        scramble, *rng_);
+}
@@ -0,0 +1,91 @@
+#ifndef _PIXEL_SAMPLER_H_
+#define _PIXEL_SAMPLER_H_
+
+#include "uv_sampler.h"
+#include "rng.h"
+#include "scratch_arena.h"
+
+#include <cstdint>
+
+/**
+ * Source of the random numbers, and scratch memory, for a single
+ * camera sample.
+ *
+ * Hands out the dimensions of the sample in pairs, in the order they
+ * are asked for (e.g. position in the pixel, position on the lens,
+ * light sample, bounce direction...).
+ *
+ * Either the dimensions are independent random numbers, or every pair
+ * of dimensions is a point from a sequence shared by all the samples of
+ * a pixel. In the latter case each pair is well distributed over the
+ * samples of the pixel, so every effect converges evenly as samples are
+ * added. Pairs are decorrelated from each other by shuffling the order
+ * the sequence is visited in, and scrambling the points.
+ */
+class PixelSampler {
+
+public:
+    /**
+     * Hand out independent random numbers from @a rng, and memory
+     * from @a scratch
+     */
+    PixelSampler(qnd::Rng& rng, ScratchArena& scratch);
+
+    /**
+     * Hand out dimensions of sample @a index of the pixel, taken from
+     * @a sequence. Samples past the count of @a sequence continue it in
+     * further passes of the same count. The @a key of the pixel
+     * randomizes the sequence, and should be the same for all samples
+     * of the pixel.
+     *
+     * @a rng is used where the sequence itself needs random numbers.
+     */
+    PixelSampler(UVSampler const& sequence, std::uint32_t index,
+                 std::uint32_t key, qnd::Rng& rng, ScratchArena& scratch);
+
+    /**
+     * @Return the next two dimensions of the sample
+     */
+    uv_sample get2D();
+
+    /**
+     * @Return the next dimension of the sample
+     */
+    double get1D() {
+        return get2D()[0];
+    }
+
+    /**
+     * Whether dimensions come from a sequence shared by the samples
+     * of a pixel, i.e. every camera sample should only take one
+     * sample of every effect.
+     */
+    bool fromSequence() const {
+        return sequence_ != nullptr;
+    }
+
+    /**
+     * Generator for independent random numbers
+     */
+    qnd::Rng& rng() {
+        return *rng_;
+    }
+
+    /**
+     * Memory for state of the shading, allocated within a
+     * ScratchArena::Scope
+     */
+    ScratchArena& scratch() {
+        return *scratch_;
+    }
+
+private:
+    UVSampler const* sequence_;
+    std::uint32_t index_;
+    std::uint32_t key_;
+    std::uint32_t dimension_; ///< index of the next pair of dimensions
+    qnd::Rng* rng_;
+    ScratchArena* scratch_;
+};
+
+#endif // _PIXEL_SAMPLER_H_
@@ -3,11 +3,9 @@
 bool consolidateRayInter(Ray3D& r, Intersection& i) {
     if (i.none) return false;
 
-    if (i.t_value < 15000*std::numeric_limits<double>::epsilon()) {
+    if (i.t_value < rayEpsilon) {
         // reject intersection if it happens in the backwards
-        // direction
-        // large "fudge factor" since secondary rays start at intersection
-        // points, and may cause self-intersection. It is still ~10^-9
+        // direction, or too close to the origin
         i.none = true;
     }
     else if (r.intersection.none) {
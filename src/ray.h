@@ -3,7 +3,7 @@
 
 #include "intersection.h"
 #include "colour.h"
-#include <functional>
+#include <limits>
 
 // ===========================================
 /**
@@ -12,11 +12,6 @@
  */
 struct Ray3D {
 
-    /**
-     * A closure that accepts a ray and performs an intersection check.
-     */
-    typedef std::function<void (Ray3D&)> intersection_func;
-
     /**
      * Create a new ray starting at point @a p, extending in direction @a v
      */
@@ -45,6 +40,14 @@ struct Ray3D {
 };
 // ===========================================
 
+/**
+ * Intersections closer than this along a ray are rejected.
+ *
+ * Large "fudge factor" since secondary rays start at intersection
+ * points, and may cause self-intersection. It is still ~10^-9
+ */
+const double rayEpsilon = 15000*std::numeric_limits<double>::epsilon();
+
 /**
  * Given a Ray with potentially another intersection, and a new Intersection,
  * update Ray with new one if better, otherwise set none = true on new
@@ -0,0 +1,36 @@
+#include "ray_packet.h"
+#include "ray.h"
+
+void RayPacket::setRay(int lane, Ray3D& r) {
+    setRay(lane, r.origin, r.dir);
+    ray[lane] = &r;
+}
+
+LaneMask RayPacket::sameSigns(LaneMask mask) const {
+    // signs of a lane as two bits per dimension: negative, positive
+    auto signs = [this](int lane) {
+        unsigned int bits = 0;
+        for (int dim = 0; dim < 3; ++dim) {
+            double d = dir[dim][lane];
+            bits |= (d < 0 ? 1u : d > 0 ? 2u : 0u) << (2*dim);
+        }
+        return bits;
+    };
+
+    int first = firstLane(mask);
+    unsigned int firstSigns = signs(first);
+
+    // a zero component has neither bit set
+    const unsigned int nonZero = 0x15;
+    if (((firstSigns | firstSigns >> 1) & nonZero) != nonZero) {
+        return 1u << first;
+    }
+
+    LaneMask same = 0;
+    for (int lane = first; lane < PacketWidth; ++lane) {
+        if ((mask & (1u << lane)) && signs(lane) == firstSigns) {
+            same |= 1u << lane;
+        }
+    }
+    return same;
+}
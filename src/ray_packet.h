@@ -0,0 +1,62 @@
+#ifndef _RAY_PACKET_H_
+#define _RAY_PACKET_H_
+
+#include "math/math_types.h"
+#include "simd.h"
+
+#include <algorithm>
+
+struct Ray3D;
+
+/**
+ * Up to PacketWidth rays traced through the scene together, one per lane.
+ *
+ * Origins and directions are kept per dimension, so a lane-wise operation
+ * on them (e.g. the distance to a plane) is a single Double4 operation.
+ * In world space each lane refers to the Ray3D receiving its intersection.
+ */
+struct RayPacket {
+    RayPacket() : active(0) {
+        std::fill_n(&origin[0][0], 3*PacketWidth, 0.0);
+        std::fill_n(&dir[0][0], 3*PacketWidth, 0.0);
+        std::fill_n(ray, PacketWidth, nullptr);
+    }
+
+    /**
+     * Make lane @a lane trace @a r, whose intersection is updated by
+     * the scene.
+     */
+    void setRay(int lane, Ray3D& r);
+
+    /** Set the origin and direction of lane @a lane, without a Ray3D */
+    void setRay(int lane, Point3D const& o, Vector3D const& d) {
+        for (int dim = 0; dim < 3; ++dim) {
+            origin[dim][lane] = o[dim];
+            dir[dim][lane] = d[dim];
+        }
+        active |= 1u << lane;
+    }
+
+    Point3D originOf(int lane) const {
+        return Point3D(origin[0][lane], origin[1][lane], origin[2][lane]);
+    }
+
+    Vector3D dirOf(int lane) const {
+        return Vector3D(dir[0][lane], dir[1][lane], dir[2][lane]);
+    }
+
+    /**
+     * @return the lanes of @a mask whose directions have the same sign as
+     * those of the first lane in it, in every dimension. Lanes with a zero
+     * component only match themselves.
+     */
+    LaneMask sameSigns(LaneMask mask) const;
+
+    double origin[3][PacketWidth]; ///< origin of each lane, by dimension
+    double dir[3][PacketWidth];    ///< direction of each lane, by dimension
+
+    Ray3D* ray[PacketWidth]; ///< ray of each lane, in world space
+    LaneMask active;         ///< lanes holding a ray
+};
+
+#endif // _RAY_PACKET_H_
@@ -8,57 +8,90 @@
 #include "sampling_strategy.h"
 #include "fresnel.h"
 #include "texture/material.h"
+#include "bsdf.h"
+#include "pixel_sampler.h"
+#include "ray_packet.h"
 
 #include <omp.h>
+#include <algorithm>
 #include <cmath>
 #include <functional>
+#include <iostream>
+#include <limits>
 
 Raytracer::Raytracer() : sceneSignature(false), 
                          dumpRaw(false), 
+                         tileReport(false),
+                         integrator_(Integrator_Classic),
+                         stochasticSpecular_(false),
+                         wavefront_(false),
                          maxDiffuse_(2),
                          maxSpecular_(3),
+                         rouletteDepth_(3),
+                         seed_(0),
+                         adaptiveThreshold_(0),
+                         maxPasses_(16),
+                         timeLimit_(0),
+                         sampleTarget_(0),
+                         useLightTree_(false),
                          lightStrategies_(9),
                          diffuseStrategies_(16),
+                         causticStrategies_(9),
                          scene_(nullptr) {
 }
 
 Raytracer::~Raytracer() { }
 
 // given params, calculate outgoing light after a reflection from surface
-Colour Raytracer::calculateRadiance( Ray3D const& rayFromSurface, Ray3D const& rayFromViewer) const {
+Colour Raytracer::calculateRadiance( Ray3D const& rayFromSurface, BSDF const& bsdf ) const {
 
-    double cosIn = rayFromSurface.dir.dot(rayFromViewer.intersection.normal);
+    double cosIn = rayFromSurface.dir.dot(bsdf.frame.normal);
 
     // only calculate radiance if light is not arriving from behind the
     // surface
     if (cosIn > 0) {
         // multiplication by 2 is normalization for cos factor.
         // this is the integrand of the rendering equation
-        return 2 * cosIn * rayFromSurface.col *
-               rayFromViewer.intersection.mat->phongBRDF(rayFromSurface.dir,
-                                                         -rayFromViewer.dir,
-                                                         rayFromViewer.intersection.normal,
-                                                         rayFromViewer.intersection.uv);
+        return 2 * cosIn * rayFromSurface.col * bsdf.eval(rayFromSurface.dir);
     }
 
     return Colour();
 }
 
-void Raytracer::lightShading( Ray3D& ray, int diffuseBounces, int specularBounces) const {
+void Raytracer::lightShading( Ray3D& ray, BSDF const& bsdf, PixelSampler& pixelSampler,
+                              int diffuseBounces, int specularBounces) const {
+    // shade with a single light, picked from the tree, and scale by the
+    // chance of picking it. The surface normal is not used for picking,
+    // as lights behind the surface still contribute ambient light.
+    LightTree const& tree = scene_->pointLightTree();
+    if (useLightTree_ && !tree.empty()) {
+        double u = pixelSampler.get1D();
+        double probability;
+        int light = tree.sample(ray.intersection.point, Vector3D(0, 0, 0), u, probability);
+        if (light < 0) {
+            return;
+        }
+
+        Ray3D lightRay = ray;
+        lightRay.col = Colour();
+        scene_->light_begin()[light]->shade(lightRay, bsdf, *scene_);
+        ray.col += lightRay.col / probability;
+        return;
+    }
+
     // go through lights
     for (Scene::light_iter curLight = scene_->light_begin();
             curLight != scene_->light_end(); ++curLight) {
-        // Each lightSource provides its own shading function.
-
-        // pass intersection function so light can test for shadows
-        (*curLight)->shade(ray, scene_->getIntersectionFunction());
+        // Each lightSource provides its own shading function,
+        // and tests for shadows with the scene
+        (*curLight)->shade(ray, bsdf, *scene_);
     }
 
 }
 
 // main function that handles recursive raytracing, and choosing
 // appropriate techniques based on material and scene
-Colour Raytracer::shadeRay( Ray3D& ray, int diffuseBounces, int specularBounces ) const {
+Colour Raytracer::shadeRay( Ray3D& ray, PixelSampler& pixelSampler, int diffuseBounces, int specularBounces ) const {
     Colour col(0.0, 0.0, 0.0); 
 
     // if we reach a certain recursion depth, stop.
@@ -79,10 +112,13 @@ Colour Raytracer::shadeRay( Ray3D& ray, int diffuseBounces, int specularBounces
         // normalize the direction for lighting calculations
         ray.renormalize();
 
+        // look up the material at the intersection once, for all
+        // the shading below
+        BSDF bsdf(ray);
+
         // if material emits light, colour the ray with that colour
-        Colour emittance = ray.intersection.mat->emittance.at(ray.intersection.uv);
-        if (!emittance.isBlack()) {
-            col += emittance;
+        if (!bsdf.emittance.isBlack()) {
+            col += bsdf.emittance;
         }
         // if material refracts
         else if (ray.intersection.mat->isTransmissive) {
@@ -101,14 +137,13 @@ Colour Raytracer::shadeRay( Ray3D& ray, int diffuseBounces, int specularBounces
             Fresnel refraction(index1, index2,
                     ray.intersection.normal, ray.dir);
 
-            // Compute reflected colour
+            // Compute reflected ray
             Ray3D reflectedRay(ray.intersection.point,
                     reflectedDir(ray.dir, ray.intersection.normal));
-            Colour reflectedColour = shadeRay(reflectedRay, diffuseBounces, specularBounces-1);
 
             // if total internal reflection, just use reflected colour
             if (refraction.totalReflection()) {
-                col += reflectedColour;
+                col += shadeRay(reflectedRay, pixelSampler, diffuseBounces, specularBounces-1);
             }
             // otherwise send another ray in transmitted direction
             else {
@@ -128,9 +163,22 @@ Colour Raytracer::shadeRay( Ray3D& ray, int diffuseBounces, int specularBounces
                 // form new transmission ray
                 Ray3D transmittedRay(ray.intersection.point, transDir);
 
-                // mix transmitted and reflected colours
-                col += rCoeff*reflectedColour +
-                    tCoeff*shadeRay(transmittedRay, diffuseBounces, specularBounces-1);
+                if (stochasticSpecular_) {
+                    // follow only one of the rays, chosen with the probability
+                    // of its coefficient, which then cancels out of the weight
+                    if (pixelSampler.get1D() < rCoeff) {
+                        col += shadeRay(reflectedRay, pixelSampler, diffuseBounces, specularBounces-1);
+                    }
+                    else {
+                        col += shadeRay(transmittedRay, pixelSampler, diffuseBounces, specularBounces-1);
+                    }
+                }
+                else {
+                    // mix transmitted and reflected colours
+                    Colour reflectedColour = shadeRay(reflectedRay, pixelSampler, diffuseBounces, specularBounces-1);
+                    col += rCoeff*reflectedColour +
+                        tCoeff*shadeRay(transmittedRay, pixelSampler, diffuseBounces, specularBounces-1);
+                }
 
                 // absorption of medium is handled at bottom of function
             }
@@ -139,37 +187,62 @@ Colour Raytracer::shadeRay( Ray3D& ray, int diffuseBounces, int specularBounces
         // do the 
         else if (diffuseBounces > 0) {
 
-            // gather sampling strategies
-            std::vector< CachedSamplingStrategy > strategies;
-
-            // get light source strategies
-            for (SamplingStrategy* strategy : lightStrategies_) {
-                strategies.push_back(CachedSamplingStrategy(strategy, ray));
+            // if surface reflects light like a perfect mirror
+            const double reflectance = bsdf.reflectance;
+            double diffuseWeight = 1.0 - reflectance;
+            double mirrorWeight = reflectance;
+
+            // pick either the mirror or the diffuse part of the surface,
+            // with the probability of its weight
+            if (stochasticSpecular_ && reflectance > 0.0) {
+                const bool mirror = pixelSampler.get1D() < reflectance;
+                diffuseWeight = mirror ? 0.0 : 1.0;
+                mirrorWeight = mirror ? 1.0 : 0.0;
             }
 
-            // strategies for sampling the hemisphere (uniform or BRDFs)
-            if (diffuseBounces > 1) {
-                for (SamplingStrategy* strategy : diffuseStrategies_) {
-                    strategies.push_back(CachedSamplingStrategy(strategy, ray));
+            if (diffuseWeight > 0.0) {
+                // gather sampling strategies, in memory released once
+                // this hit is shaded
+                ScratchArena& scratch = pixelSampler.scratch();
+                ScratchArena::Scope scope(scratch);
+
+                ScratchArray< CachedSamplingStrategy > lights(scratch, lightStrategies_.size());
+                ScratchArray< CachedSamplingStrategy > others(scratch,
+                        causticStrategies_.size() + diffuseStrategies_.size());
+
+                // get light source strategies
+                for (SamplingStrategy* strategy : lightStrategies_) {
+                    lights.push_back(CachedSamplingStrategy(strategy, ray, bsdf));
                 }
-            }
 
-            // calculate estimate using all strategies
-            lightWithStrategies(ray, strategies, diffuseBounces, specularBounces);
+                // strategies for refractive objects, which find light
+                // through specular bounces
+                for (SamplingStrategy* strategy : causticStrategies_) {
+                    others.push_back(CachedSamplingStrategy(strategy, ray, bsdf));
+                }
 
-            // shade with point lights
-            lightShading(ray, diffuseBounces, specularBounces); 
+                // strategies for sampling the hemisphere (uniform or BRDFs)
+                if (diffuseBounces > 1) {
+                    for (SamplingStrategy* strategy : diffuseStrategies_) {
+                        others.push_back(CachedSamplingStrategy(strategy, ray, bsdf));
+                    }
+                }
 
-            // if surface reflects light like a perfect mirror
-            const double reflectance = ray.intersection.mat->reflectance.at(ray.intersection.uv);
-            col = ray.col * (1.0 - reflectance);
+                // calculate estimate using all strategies
+                lightWithStrategies(ray, bsdf, pixelSampler, lights, others, diffuseBounces, specularBounces);
+
+                // shade with point lights
+                lightShading(ray, bsdf, pixelSampler, diffuseBounces, specularBounces); 
+
+                col = ray.col * diffuseWeight;
+            }
 
-            if (reflectance > 0.0) {
+            if (mirrorWeight > 0.0) {
                 // do reflection
                 Ray3D reflectedRay(ray.intersection.point,
-                        reflectedDir(ray.dir, ray.intersection.normal));
+                        bsdf.mirror.normal);
 
-                col += reflectance * shadeRay(reflectedRay, diffuseBounces, specularBounces-1);
+                col += mirrorWeight * shadeRay(reflectedRay, pixelSampler, diffuseBounces, specularBounces-1);
 
             }
         }
@@ -192,54 +265,583 @@ Colour Raytracer::shadeRay( Ray3D& ray, int diffuseBounces, int specularBounces
 }
 
 // Computes the probability of a direction in the regime of each sampling
-// strategy, and sums to get the normalization term.
-double strategyNormalization ( std::vector< CachedSamplingStrategy > const& strategies,
-                               Vector3D const& dir) {
+// strategy, and sums to get the normalization term. Unless @a oneSampleEach,
+// every strategy takes the number of samples of its own sampler.
+double strategyNormalization ( ScratchArray< CachedSamplingStrategy > const& strategies,
+                               Vector3D const& dir, bool oneSampleEach ) {
     double normalization = 0.0;
     for( auto const& cachedStrategy : strategies) {
         // have to multiply by the number of samples to be taken from
         // each strategy
-        normalization += cachedStrategy.dirProbability(dir)*cachedStrategy.strategy->sampler->n();
+        int samples = oneSampleEach ? 1 : cachedStrategy.strategy->sampler->n();
+        normalization += cachedStrategy.dirProbability(dir)*samples;
     }
 
     return normalization;
 }
 
+// Take samples from each of the strategies, and pass them to @a shade.
+// Unless @a oneSampleEach, every strategy takes the number of samples of
+// its own sampler. Templated on the shading function so it is called
+// directly, and can be inlined.
+template<typename ShadeFunc>
+void sampleAll( ScratchArray< CachedSamplingStrategy > const& strategies,
+                PixelSampler& pixelSampler, bool oneSampleEach,
+                ShadeFunc const& shade ) {
+    for( auto const& cachedStrategy : strategies) {
+
+        if (oneSampleEach) {
+            shade(pixelSampler.get2D(), cachedStrategy);
+            continue;
+        }
+
+        // set up a sampler from [0,1]x[0,1] and use it to obtain
+        // samples from the strategy
+        UVSampler const& sampler = *(cachedStrategy.strategy->sampler);
+        for (auto const& sample : sampler(pixelSampler.rng()))
+        {
+            shade(sample, cachedStrategy);
+        }
+    }
+}
+
 // Using the different sampling techniques provided by the sampling strategies,
 // use multiple importance sampling to compute an estimate of the radiance in
 // the direction of the ray.
-void Raytracer::lightWithStrategies( Ray3D& ray,
-                              std::vector< CachedSamplingStrategy > const& strategies,
+//
+// The light arriving from a direction is split in two: light emitted by the
+// first surface hit, which every strategy can find, and light reflected or
+// transmitted by it, which only the others can. Each part is weighted
+// against the strategies that can find it (balance heuristic).
+void Raytracer::lightWithStrategies( Ray3D& ray, BSDF const& bsdf, PixelSampler& pixelSampler,
+                              ScratchArray< CachedSamplingStrategy > const& lights,
+                              ScratchArray< CachedSamplingStrategy > const& others,
                               int diffuseBounces, int specularBounces ) const {
 
-    Vector3D sampleDir;
-    // sample from each strategy
+    // when the samples of the pixel are drawn from a sequence, every
+    // camera sample takes a single sample of each strategy
+    const bool oneSampleEach = pixelSampler.fromSequence();
+
+    // samples of lights only look for emitted light: a single ray to
+    // the first surface in the sampled direction
+    auto lightSample = [&]( uv_sample const& sample, CachedSamplingStrategy const& cachedStrategy ) {
+        Vector3D sampleDir;
+        cachedStrategy.getSample(sample[0], sample[1], sampleDir);
+
+        // light arriving from behind the surface does not contribute
+        if (sampleDir.dot(bsdf.frame.normal) <= 0) {
+            return;
+        }
+
+        Ray3D rayFromSurface(ray.intersection.point, sampleDir);
+        rayFromSurface.col = emission(rayFromSurface);
+        if (rayFromSurface.col.isBlack()) {
+            return;
+        }
+
+        double normalization = strategyNormalization(lights, sampleDir, oneSampleEach)
+                             + strategyNormalization(others, sampleDir, oneSampleEach);
+        if (normalization > 0) {
+            ray.col += calculateRadiance(rayFromSurface, bsdf)/normalization;
+        }
+    };
+
+    // samples of other strategies are shaded fully
+    auto shadeSample = [&]( uv_sample const& sample, CachedSamplingStrategy const& cachedStrategy ) {
+        Vector3D sampleDir;
+        // obtain a direction in the hemisphere from the strategy
+        cachedStrategy.getSample(sample[0], sample[1], sampleDir);
+
+        // shade the ray in the sampled direction
+        Ray3D rayFromSurface(ray.intersection.point, sampleDir);
+        rayFromSurface.col = shadeRay( rayFromSurface, pixelSampler, diffuseBounces - 1, specularBounces);
+
+        // get normalization factor across the strategies that could have
+        // found this light (balance heuristic for multiple importance sampling)
+        double normalization = strategyNormalization(others, sampleDir, oneSampleEach);
+
+        const bool hitEmitter = !rayFromSurface.intersection.none
+            && !rayFromSurface.intersection.mat->emittance.at(rayFromSurface.intersection.uv).isBlack();
+        if (hitEmitter) {
+            normalization += strategyNormalization(lights, sampleDir, oneSampleEach);
+        }
+
+        // calculate final outgoing radiance towards eye
+        if (normalization > 0) {
+            ray.col += calculateRadiance(rayFromSurface, bsdf)/normalization;
+        }
+    };
+
+    sampleAll(lights, pixelSampler, oneSampleEach, lightSample);
+    sampleAll(others, pixelSampler, oneSampleEach, shadeSample);
+}
+
+Colour Raytracer::emission( Ray3D& ray ) const {
+    scene_->traverse(ray);
+    if (ray.intersection.none) {
+        return Colour();
+    }
+
+    return ray.intersection.mat->emittance.at(ray.intersection.uv);
+}
+
+// Probability of a direction when one of the strategies is chosen
+// uniformly at random and sampled once.
+double mixtureProbability ( ScratchArray< CachedSamplingStrategy > const& strategies,
+                            Vector3D const& dir) {
+    if (strategies.empty()) {
+        return 0.0;
+    }
+
+    double probability = 0.0;
     for( auto const& cachedStrategy : strategies) {
-        
-        // set up a sampler from [0,1]x[0,1] and use it to obtain
-        // samples from the strategy
-        UVSampler const& sampler = *(cachedStrategy.strategy->sampler);
-        for (auto const& sample : sampler)
-        {
-            // obtain a direction in the hemisphere from the strategy
-            cachedStrategy.getSample(sample[0], sample[1], sampleDir);
-            // get normalization factor across all strategies
-            // (balance heuristic for multiple importance sampling)
-            double normalization = strategyNormalization(strategies, sampleDir);
+        probability += cachedStrategy.dirProbability(dir);
+    }
+
+    return probability / strategies.size();
+}
+
+// Pick one of the strategies uniformly at random
+CachedSamplingStrategy const& chooseStrategy ( ScratchArray< CachedSamplingStrategy > const& strategies,
+                                               PixelSampler& pixelSampler ) {
+    std::size_t index = pixelSampler.get1D() * strategies.size();
+    return strategies[std::min(index, strategies.size() - 1)];
+}
+
+void Raytracer::queueEmitterRay( PathBatch& paths, std::uint32_t p,
+                                 Ray3D const& ray, BSDF const& bsdf,
+                                 ScratchArray< CachedSamplingStrategy > const& lights,
+                                 ScratchArray< CachedSamplingStrategy > const& diffuse,
+                                 LightRayQueue& emitterRays ) const {
+    PixelSampler& pixelSampler = *paths.sampler[p];
+
+    Vector3D sampleDir;
+    CachedSamplingStrategy const& light = chooseStrategy(lights, pixelSampler);
+    uv_sample sample = pixelSampler.get2D();
+    light.getSample(sample[0], sample[1], sampleDir);
+
+    // light arriving from behind the surface does not contribute
+    if (sampleDir.dot(bsdf.frame.normal) <= 0) {
+        return;
+    }
+
+    // balance heuristic between the light sample, and the chance of the
+    // diffuse strategies finding the light themselves
+    double normalization = mixtureProbability(lights, sampleDir)
+                         + mixtureProbability(diffuse, sampleDir);
+
+    // as in lightWithStrategies, a sample no strategy could have made
+    // (e.g. at the edge of a light) contributes nothing
+    if (!(normalization > 0)) {
+        return;
+    }
+
+    // the ray is checked for hitting an emitter first later. Other
+    // emitters along the way are also valid hits, as the probability
+    // above accounts for all of them.
+    Ray3D rayFromSurface(ray.intersection.point, sampleDir);
+    rayFromSurface.col = paths.throughput[p];
+    emitterRays.push(p, rayFromSurface.origin, sampleDir,
+                     std::numeric_limits<double>::infinity(),
+                     calculateRadiance(rayFromSurface, bsdf)/normalization);
+}
+
+void Raytracer::queuePointLights( PathBatch& paths, std::uint32_t p,
+                                  Ray3D const& ray, BSDF const& bsdf,
+                                  LightRayQueue& shadowRays ) const {
+    Colour const& throughput = paths.throughput[p];
+
+    // light that arrives regardless of shadows is added right away
+    auto shade = [&]( LightSource const& light, double probability ) {
+        Colour ambient;
+        Vector3D lightDir;
+        double distance;
+        Colour direct = light.illuminate(ray, bsdf, ambient, lightDir, distance);
+
+        paths.col[p] += throughput * (ambient / probability);
+        if (!direct.isBlack()) {
+            shadowRays.push(p, ray.intersection.point, lightDir, distance,
+                            throughput * (direct / probability));
+        }
+    };
+
+    // shade with a single light, picked from the tree, and scale by the
+    // chance of picking it (see lightShading)
+    LightTree const& tree = scene_->pointLightTree();
+    if (useLightTree_ && !tree.empty()) {
+        double u = paths.sampler[p]->get1D();
+        double probability;
+        int light = tree.sample(ray.intersection.point, Vector3D(0, 0, 0), u, probability);
+        if (light >= 0) {
+            shade(*scene_->light_begin()[light], probability);
+        }
+        return;
+    }
+
+    for (Scene::light_iter curLight = scene_->light_begin();
+            curLight != scene_->light_end(); ++curLight) {
+        shade(**curLight, 1.0);
+    }
+}
+
+Colour Raytracer::tracePath( Ray3D& ray, PixelSampler& pixelSampler ) const {
+    ScratchArena& scratch = pixelSampler.scratch();
+    ScratchArena::Scope scope(scratch);
+
+    PathBatch paths(scratch, 1);
+    paths.addPath(ray.origin, ray.dir, pixelSampler);
+    tracePaths(paths);
+
+    return paths.col[0];
+}
+
+// Follows the paths from the camera, one vertex of every path at a time.
+// At every diffuse vertex emitters are sampled directly, and a single
+// direction is chosen to continue the path in. Emission found by the
+// continuing direction is weighted against the direct sample (balance
+// heuristic), so light is not counted twice. Specular surfaces pick
+// reflection or transmission at random, in proportion to their
+// coefficients.
+//
+// Each round runs in stages over all live paths: intersect their rays,
+// shade the hits (queueing rays towards lights), and trace the queued
+// rays. Paths draw their random numbers from their own samplers, so the
+// result does not depend on how many are traced together.
+void Raytracer::tracePaths( PathBatch& paths ) const {
+    ScratchArena::Scope scope(paths.scratch);
+
+    for (std::size_t p = 0; p < paths.size(); ++p) {
+        paths.diffuseBounces[p] = maxDiffuse_;
+        paths.specularBounces[p] = maxSpecular_;
+    }
+
+    // a vertex queues at most one ray towards the emitters, and a shadow
+    // ray for each point light it is shaded with
+    const bool pickLight = useLightTree_ && !scene_->pointLightTree().empty();
+    const std::size_t lightsPerVertex = pickLight ? 1 : scene_->light_end() - scene_->light_begin();
+
+    LightRayQueue emitterRays(paths.scratch, paths.size());
+    LightRayQueue shadowRays(paths.scratch, paths.size() * lightsPerVertex);
+
+    // only the camera rays start out coherent
+    bool coherent = true;
+    while (!paths.active.empty()) {
+        intersectPaths(paths, coherent);
+        shadePaths(paths, emitterRays, shadowRays);
+        traceLightRays(paths, emitterRays, shadowRays);
+        coherent = false;
+    }
+}
+
+void Raytracer::intersectPaths( PathBatch& paths, bool coherent ) const {
+    if (!coherent || paths.active.size() == 1) {
+        for (std::uint32_t p : paths.active) {
+            Ray3D ray(paths.origin[p], paths.dir[p]);
+            scene_->traverse(ray);
+
+            paths.dir[p] = ray.dir;
+            paths.hit[p] = ray.intersection;
+        }
+        return;
+    }
+
+    // neighbouring paths are samples of the same or adjacent pixels
+    ScratchArena::Scope scope(paths.scratch);
+    ScratchArray< Ray3D > rays(paths.scratch, PacketWidth);
+
+    for (std::size_t k = 0; k < paths.active.size(); k += PacketWidth) {
+        std::size_t lanes = std::min<std::size_t>(PacketWidth, paths.active.size() - k);
+
+        rays.clear();
+        RayPacket packet;
+        for (std::size_t lane = 0; lane < lanes; ++lane) {
+            std::uint32_t p = paths.active[k + lane];
+            rays.push_back(Ray3D(paths.origin[p], paths.dir[p]));
+            packet.setRay(lane, rays[lane]);
+        }
+
+        scene_->traverse(packet);
+
+        for (std::size_t lane = 0; lane < lanes; ++lane) {
+            std::uint32_t p = paths.active[k + lane];
+            paths.dir[p] = rays[lane].dir;
+            paths.hit[p] = rays[lane].intersection;
+        }
+    }
+}
+
+void Raytracer::shadePaths( PathBatch& paths, LightRayQueue& emitterRays,
+                            LightRayQueue& shadowRays ) const {
+    // keep the paths that continue, in order
+    std::size_t live = 0;
+    for (std::size_t k = 0; k < paths.active.size(); ++k) {
+        std::uint32_t p = paths.active[k];
+        if (shadePathVertex(paths, p, emitterRays, shadowRays)) {
+            paths.active[live++] = p;
+        }
+    }
+
+    paths.active.truncate(live);
+}
+
+void Raytracer::traceLightRays( PathBatch& paths, LightRayQueue& emitterRays,
+                                LightRayQueue& shadowRays ) const {
+    for (std::size_t k = 0; k < emitterRays.size(); ++k) {
+        Ray3D ray(emitterRays.origin[k], emitterRays.dir[k]);
+        Colour emitted = emission(ray);
+        if (!emitted.isBlack()) {
+            paths.col[emitterRays.path[k]] += emitted * emitterRays.weight[k];
+        }
+    }
 
-            // shade the ray in the sampled direction
-            Ray3D rayFromSurface(ray.intersection.point, sampleDir);
-            rayFromSurface.col = shadeRay( rayFromSurface, diffuseBounces - 1, specularBounces);
+    // visibility of the shadow rays, so their light is added
+    // in the order they were queued
+    ScratchArena::Scope scope(paths.scratch);
+    ScratchArray< bool > visible(paths.scratch, shadowRays.size());
+    for (std::size_t k = 0; k < shadowRays.size(); ++k) {
+        visible.push_back(false);
+    }
+
+    // a packet being filled for each octant, with the
+    // queued rays in its lanes
+    RayPacket packets[8];
+    double tMax[8][PacketWidth];
+    std::size_t queued[8][PacketWidth];
+    int count[8] = { 0 };
+
+    auto tracePacket = [&]( int octant ) {
+        RayPacket& packet = packets[octant];
+        if (count[octant] == 1) {
+            std::size_t k = queued[octant][0];
+            visible[k] = !scene_->occluded(shadowRays.origin[k], shadowRays.dir[k], shadowRays.tMax[k]);
+        }
+        else {
+            LaneMask blocked = scene_->occluded(packet, tMax[octant]);
+            for (int lane = 0; lane < count[octant]; ++lane) {
+                visible[queued[octant][lane]] = !(blocked & (1u << lane));
+            }
+        }
+
+        packet = RayPacket();
+        count[octant] = 0;
+    };
+
+    for (std::size_t k = 0; k < shadowRays.size(); ++k) {
+        Vector3D const& dir = shadowRays.dir[k];
+        int octant = (dir[0] < 0) | (dir[1] < 0) << 1 | (dir[2] < 0) << 2;
+
+        int lane = count[octant]++;
+        packets[octant].setRay(lane, shadowRays.origin[k], dir);
+        tMax[octant][lane] = shadowRays.tMax[k];
+        queued[octant][lane] = k;
+
+        if (count[octant] == PacketWidth) {
+            tracePacket(octant);
+        }
+    }
+
+    for (int octant = 0; octant < 8; ++octant) {
+        if (count[octant] > 0) {
+            tracePacket(octant);
+        }
+    }
+
+    for (std::size_t k = 0; k < shadowRays.size(); ++k) {
+        if (visible[k]) {
+            paths.col[shadowRays.path[k]] += shadowRays.weight[k];
+        }
+    }
+
+    emitterRays.clear();
+    shadowRays.clear();
+}
+
+bool Raytracer::shadePathVertex( PathBatch& paths, std::uint32_t p,
+                                 LightRayQueue& emitterRays, LightRayQueue& shadowRays ) const {
+    PixelSampler& pixelSampler = *paths.sampler[p];
+    Colour& col = paths.col[p];
+    Colour& throughput = paths.throughput[p];
+    int& diffuseBounces = paths.diffuseBounces[p];
+    int& specularBounces = paths.specularBounces[p];
+
+    Ray3D current(paths.origin[p], paths.dir[p]);
+    current.intersection = paths.hit[p];
+
+    if (current.intersection.none) {
+        return false;
+    }
+
+    Material const* mat = current.intersection.mat;
+    if (sceneSignature) { // no need to shade if just scene signature
+        col = mat->diffuse.at(0, 0);
+        return false;
+    }
+
+    // normalize the direction for lighting calculations
+    current.renormalize();
+
+    // if we are inside a medium, and it absorbs light
+    // the whole remaining path is attenuated
+    if (current.intersection.inside && !mat->absorption.isBlack()) {
+        throughput = attenuateByAbsorption(throughput,
+                current.intersection.t_value,
+                mat->absorption);
+    }
+
+    // look up the material at the intersection once, for all
+    // the shading below
+    BSDF bsdf(current);
+
+    // emitters end the path
+    Colour emittance = bsdf.emittance;
+    if (!emittance.isBlack()) {
+        if (!paths.countEmission[p]) {
+            emittance = emittance * paths.diffuseProbability[p]
+                        / (paths.diffuseProbability[p] + paths.lightProbability[p]);
+        }
+        col += throughput * emittance;
+        return false;
+    }
+
+    Vector3D nextDir;
+
+    if (mat->isTransmissive) {
+        if (--specularBounces < 0) {
+            return false;
+        }
+
+        double index1 = 1.0;
+        double index2 = mat->refractiveIndex;
+        if (current.intersection.inside) {
+            std::swap(index1, index2);
+        }
+
+        Fresnel refraction(index1, index2,
+                current.intersection.normal, current.dir);
+
+        // choose between reflection and transmission in proportion
+        // to how much light each carries
+        if (refraction.totalReflection()
+                || pixelSampler.get1D() < refraction.reflectionCoefficient()) {
+            nextDir = reflectedDir(current.dir, current.intersection.normal);
+        }
+        else if (current.intersection.isSolid) {
+            nextDir = refraction.transmittedDir();
+        }
+        else {
+            nextDir = current.dir;
+        }
+
+        paths.countEmission[p] = true;
+    }
+    else {
+        if (diffuseBounces <= 0) {
+            return false;
+        }
+
+        // perfect mirrors are chosen in proportion to their reflectance
+        const double reflectance = bsdf.reflectance;
+        if (reflectance > 0.0 && pixelSampler.get1D() < reflectance) {
+            if (--specularBounces < 0) {
+                return false;
+            }
+
+            nextDir = bsdf.mirror.normal;
+            paths.countEmission[p] = true;
+        }
+        else {
+            // only continue diffusely if there are bounces left,
+            // otherwise just gather direct light
+            const bool bounce = diffuseBounces > 1;
+
+            // strategies of this vertex, in memory released
+            // before the next
+            ScratchArena& scratch = pixelSampler.scratch();
+            ScratchArena::Scope scope(scratch);
+
+            ScratchArray< CachedSamplingStrategy > lights(scratch, lightStrategies_.size());
+            for (SamplingStrategy* strategy : lightStrategies_) {
+                lights.push_back(CachedSamplingStrategy(strategy, current, bsdf));
+            }
+
+            ScratchArray< CachedSamplingStrategy > diffuse(scratch, diffuseStrategies_.size());
+            if (bounce) {
+                for (SamplingStrategy* strategy : diffuseStrategies_) {
+                    diffuse.push_back(CachedSamplingStrategy(strategy, current, bsdf));
+                }
+            }
+
+            // next event estimation
+            if (!lights.empty()) {
+                queueEmitterRay(paths, p, current, bsdf, lights, diffuse, emitterRays);
+            }
+
+            // shade with point lights
+            queuePointLights(paths, p, current, bsdf, shadowRays);
+
+            if (!bounce || diffuse.empty()) {
+                return false;
+            }
+            --diffuseBounces;
+
+            CachedSamplingStrategy const& strategy = chooseStrategy(diffuse, pixelSampler);
+            uv_sample sample = pixelSampler.get2D();
+            strategy.getSample(sample[0], sample[1], nextDir);
+
+            double diffuseProbability = mixtureProbability(diffuse, nextDir);
+            paths.diffuseProbability[p] = diffuseProbability;
+            paths.lightProbability[p] = mixtureProbability(lights, nextDir);
+            if (!(diffuseProbability > 0)) {
+                return false;
+            }
+
+            // weight the path by the integrand over the probability
+            Ray3D rayFromSurface(current.intersection.point, nextDir);
+            rayFromSurface.col = throughput;
+            throughput = calculateRadiance(rayFromSurface, bsdf)/diffuseProbability;
+            if (throughput.isBlack()) {
+                return false;
+            }
+
+            paths.countEmission[p] = false;
+
+            // russian roulette: terminate dim paths at random, and boost
+            // the survivors so the estimate stays unbiased
+            if (maxDiffuse_ - diffuseBounces >= rouletteDepth_) {
+                double survival = std::min(0.95,
+                        std::max(throughput[0], std::max(throughput[1], throughput[2])));
 
-            // calculate final outgoing radiance towards eye
-            ray.col += calculateRadiance(rayFromSurface, ray)/normalization;
+                if (pixelSampler.get1D() >= survival) {
+                    return false;
+                }
+                throughput /= survival;
+            }
         }
     }
 
+    paths.origin[p] = current.intersection.point;
+    paths.dir[p] = nextDir;
+    return true;
 }
 
 Camera::sampling_func Raytracer::getSamplingFunction() const {
-    return std::bind(&Raytracer::shadeRay, this, std::placeholders::_1, maxDiffuse_, maxSpecular_);
+    using namespace std::placeholders;
+
+    if (integrator_ == Integrator_Path) {
+        return std::bind(&Raytracer::tracePath, this, _1, _2);
+    }
+
+    return std::bind(&Raytracer::shadeRay, this, _1, _2, maxDiffuse_, maxSpecular_);
+}
+
+Camera::batch_sampling_func Raytracer::getBatchSamplingFunction() const {
+    using namespace std::placeholders;
+
+    if (wavefront_ && integrator_ == Integrator_Path) {
+        return std::bind(&Raytracer::tracePaths, this, _1);
+    }
+
+    return Camera::batch_sampling_func();
 }
 
 void Raytracer::setScene(Scene const* scene) {
@@ -248,54 +850,142 @@ void Raytracer::setScene(Scene const* scene) {
 
 void Raytracer::setupStrategies() {
     lightStrategies_.clearStrategies();
+    causticStrategies_.clearStrategies();
 
     // strategies for sampling directions where most light could come from
     // only use these if area lights are present, otherwise have no use
     if (scene_->hasAreaLights()) {
         for (Scene::emissive_iter i = scene_->emissive_begin(); i != scene_->emissive_end(); ++i) {
-            lightStrategies_.addStrategy(new LightVolumeStrategy(*(*i)->lightBound));
+            // objects that emit light themselves are sampled directly,
+            // the rest focus light from behind them
+            bool emitter = std::find(scene_->emitter_begin(), scene_->emitter_end(), *i)
+                           != scene_->emitter_end();
+
+            if (!emitter) {
+                causticStrategies_.addStrategy(new LightVolumeStrategy(*(*i)->lightBound));
+            }
+            else if (!useLightTree_) {
+                lightStrategies_.addStrategy((*i)->createLightStrategy());
+            }
+        }
+
+        // a single strategy picks among all the emitters
+        if (useLightTree_ && !scene_->emitterTree().empty()) {
+            std::vector< SamplingStrategy* > strategies;
+            for (Scene::emissive_iter i = scene_->emitter_begin(); i != scene_->emitter_end(); ++i) {
+                strategies.push_back((*i)->createLightStrategy());
+            }
+            lightStrategies_.addStrategy(new LightTreeStrategy(scene_->emitterTree(), strategies));
         }
     }
 
-    // strategy for uniformly sampling the hemisphere
+    // strategy for sampling the hemisphere according to the BRDF
     diffuseStrategies_.clearStrategies();
-    diffuseStrategies_.addStrategy(new HemisphereStrategy());
+    diffuseStrategies_.addStrategy(new BRDFStrategy());
 }
 
 void Raytracer::render( Camera& cam ) {
     // let the camera know to use this raytracer for probing the scene
     cam.setSamplingFunc(getSamplingFunction());
+    cam.setBatchSamplingFunc(getBatchSamplingFunction());
+
+    if (wavefront_ && (integrator_ != Integrator_Path || cam.pixelSamples() == 0)) {
+        std::cerr << "Wavefront tracing needs the path integrator and fixed pixel samples, "
+                  << "tracing one path at a time." << std::endl;
+    }
     
     // based on settings, set up sampling strategies
     setupStrategies();
 
-    // initialize random state for all threads
-    qnd::init_threadrand();
+    // random numbers are derived from the seed and the pixel being
+    // sampled, so renders do not depend on the number of threads
+    cam.setSeed(seed_);
 
-    // initialize some variables used for tracking progress (notifies every 5%)
-    const int increment = cam.height()*cam.width()/20;
-    int i, j, progress;
+    // split the image into tiles and deal them out, hottest first
+    const int numThreads = omp_get_max_threads();
+    std::cout << "Threads: " << numThreads << std::endl;
+    scheduler_.prepare(cam, numThreads);
 
-    #pragma omp parallel private(i, j, progress)
-    {
-        if(omp_get_thread_num() == 0) {
-            std::cout << "Threads: " << omp_get_num_threads() << std::endl;
+    double start = omp_get_wtime();
+    checkpoints_.start();
+    renderPass(cam, true);
+    double passTime = omp_get_wtime() - start;
+
+    // keep rendering further passes into the same sensor, either only
+    // where the image has not converged, or over the whole image until
+    // a budget of time or samples is used up
+    const bool adaptive = adaptiveThreshold_ > 0;
+    const bool progressive = timeLimit_ > 0 || sampleTarget_ > 0;
+
+    for (int pass = 1; adaptive || progressive; ++pass) {
+        checkpoints_.offer(cam);
+
+        if (adaptive && pass >= maxPasses_) {
+            break;
         }
 
-        // Construct a ray for each pixel. Split the jobs among threads
-        #pragma omp for schedule(dynamic, 8)
-        for (i = 0; i < cam.height(); ++i) {
-            for (j = 0; j < cam.width(); ++j) {
+        if (timeLimit_ > 0 && omp_get_wtime() - start + passTime > timeLimit_) {
+            std::cout << "Time limit reached" << std::endl;
+            break;
+        }
 
-                cam.computePixel(i, j);
+        if (sampleTarget_ > 0 && cam.meanSamples() >= sampleTarget_) {
+            break;
+        }
 
-                // report progress
-                progress = i*cam.width() + j;
-                if (progress % increment == 0) {
-                    std::cout << (progress/increment)*5 << "\% Complete thread:" << omp_get_thread_num() << std::endl;
-                }
+        if (adaptive) {
+            int remaining = scheduler_.refine(cam, numThreads, adaptiveThreshold_);
+            if (remaining == 0) {
+                break;
             }
+
+            std::cout << "Pass " << pass + 1 << ": " << remaining << " of "
+                      << scheduler_.tiles().size() << " tiles above error threshold"
+                      << std::endl;
+        }
+        else {
+            scheduler_.prepare(cam, numThreads);
+        }
+
+        double passStart = omp_get_wtime();
+        renderPass(cam, !progressive);
+        passTime = omp_get_wtime() - passStart;
+
+        if (progressive) {
+            std::cout << "Pass " << pass + 1 << " in " << passTime << "s, "
+                      << cam.meanSamples() << " samples per pixel" << std::endl;
         }
     }
+
+    checkpoints_.finish();
+
+    std::cout << "Rendered in " << omp_get_wtime() - start << "s" << std::endl;
+    scheduler_.report(std::cout, tileReport);
 }
 
+void Raytracer::renderPass( Camera& cam, bool reportProgress ) {
+    // progress is reported every 5%
+    int reported = 0;
+
+    #pragma omp parallel
+    {
+        const int thread = omp_get_thread_num();
+
+        // memory for the shading of this thread, kept for all its tiles
+        ScratchArena scratch;
+
+        int tile;
+        while (scheduler_.next(thread, tile)) {
+            scheduler_.render(cam, tile, scratch);
+
+            // report progress
+            if (reportProgress && thread == 0) {
+                int percent = int(scheduler_.progress()*20)*5;
+                if (percent > reported) {
+                    reported = percent;
+                    std::cout << percent << "\% Complete" << std::endl;
+                }
+            }
+        }
+    }
+}
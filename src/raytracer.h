@@ -6,9 +6,22 @@
 #include "sampling_strategy_group.h"
 #include "sampling_strategy.h"
 #include "cached_sampling_strategy.h"
+#include "scratch_arena.h"
+#include "path_batch.h"
+#include "tile_scheduler.h"
+#include "checkpoint_writer.h"
 
 class Ray3D;
 class Scene;
+class BSDF;
+
+/**
+ * Ways of estimating the light arriving along camera rays
+ */
+enum IntegratorType {
+    Integrator_Classic, ///< recursive ray tree, all strategies sampled at every bounce
+    Integrator_Path     ///< a single path per camera sample, ended by russian roulette
+};
 
 /**
  * Represents a raytracer that can render scenes
@@ -37,6 +50,9 @@ public:
      * 1 : only direct lighting
      * 2 : difuse interreflection
      * 3+ : good luck waiting for the raytracer to finish :P
+     *
+     * The path integrator follows a single ray per bounce, so
+     * 5-10 bounces are affordable there.
      */
     void setMaxDiffuse(int maxDiffuse) { maxDiffuse_ = maxDiffuse; }
 
@@ -49,32 +65,137 @@ public:
     void setMaxSpecular(int maxSpecular) { maxSpecular_ = maxSpecular; }
 
     /**
-     * Set the number of samples to take from an area light source
+     * Set the number of samples to take from an area light source,
+     * and the @a sequence they are taken from.
      *
      * With antialiasing, 4 seems a good number
      */
-    void setLightSamples(int num) { 
-        lightStrategies_.sampler = UVSampler(num); 
+    void setLightSamples(int num, SampleSequence sequence = Sequence_Stratified) { 
+        lightStrategies_.sampler = UVSampler(num, sequence); 
+        causticStrategies_.sampler = UVSampler(num, sequence); 
     }
 
     /**
      * Set the number of samples to take when boucing diffuse rays.
-     * These spread out in the hemisphere around the intersection point.
+     * These spread out in the hemisphere around the intersection point,
+     * following the diffuse and specular lobes of the surface's BRDF.
      *
      * Should be more than light samples, as sampling domain is larger.
      * 9 seems a good number.
+     */
+    void setDiffuseSamples(int num, SampleSequence sequence = Sequence_Stratified) { 
+        diffuseStrategies_.sampler = UVSampler(num, sequence); 
+    }
+
+    /**
+     * Set whether lights are picked from a LightTree, for scenes with
+     * many lights.
+     *
+     * Instead of sampling every emitter and shading with every point
+     * light at each hit, a single emitter is sampled per light sample,
+     * and a single point light is shaded, each picked in proportion to
+     * its estimated contribution. The light samples are then the total
+     * per hit, rather than per emitter.
+     */
+    void setLightTree(bool useTree) { useLightTree_ = useTree; }
+
+    /**
+     * Choose how light along camera rays is estimated.
      *
-     * TODO: adding BRDF importance sampling should improve diffuse quality
+     * The classic integrator spawns rays for every sample of every strategy
+     * at each diffuse bounce, so cost grows geometrically with bounces.
+     * The path integrator instead follows one path per camera sample.
      */
-    void setDiffuseSamples(int num) { 
-        diffuseStrategies_.sampler = UVSampler(num); 
+    void setIntegrator(IntegratorType type) { integrator_ = type; }
+
+    /**
+     * Set whether specular surfaces follow a single ray, instead of
+     * both the reflected and transmitted one (or both the mirror and
+     * diffuse part of a surface).
+     *
+     * The branch is chosen at random, with the probability of its
+     * coefficient, so the cost of specular chains grows linearly with
+     * depth instead of exponentially, at the price of some noise.
+     * The path integrator always does this.
+     */
+    void setStochasticSpecular(bool stochastic) { stochasticSpecular_ = stochastic; }
+
+    /**
+     * Set whether the path integrator traces the camera samples of many
+     * pixels together breadth-first (a wavefront), instead of one path
+     * at a time.
+     *
+     * Every stage then runs as a tight loop over the whole batch, with
+     * ray and hit data in structure-of-arrays form. The image is the
+     * same either way. Needs a flat budget of pixel samples.
+     */
+    void setWavefront(bool wavefront) { wavefront_ = wavefront; }
+
+    /**
+     * Set the number of diffuse bounces after which the path integrator
+     * starts terminating paths at random, based on their throughput.
+     */
+    void setRouletteDepth(int depth) { rouletteDepth_ = depth; }
+
+    /**
+     * Set the seed that all random numbers of a render are derived from.
+     *
+     * Renders with the same seed are identical, regardless of the
+     * number of threads.
+     */
+    void setSeed(std::uint64_t seed) { seed_ = seed; }
+
+    /**
+     * Set the side length in pixels of the square tiles the image is
+     * split into for rendering. Smaller tiles balance better across
+     * threads, larger tiles have less scheduling overhead.
+     */
+    void setTileSize(int size) { scheduler_.setTileSize(size); }
+
+    /**
+     * Render adaptively: after the first pass over the image, keep
+     * making passes over only the tiles that have a pixel whose relative
+     * error is above @a threshold, until none remain.
+     *
+     * Stops early after @a maxPasses passes in total. A @a threshold
+     * of 0 turns adaptive rendering off.
+     */
+    void setAdaptive(double threshold, int maxPasses) {
+        adaptiveThreshold_ = threshold;
+        maxPasses_ = maxPasses;
     }
 
+    /**
+     * Keep rendering passes over the image until @a seconds have been
+     * spent. A pass is not started if it is not expected to finish in
+     * time. 0 means no limit.
+     */
+    void setTimeLimit(double seconds) { timeLimit_ = seconds; }
+
+    /**
+     * Keep rendering passes over the image until the pixels have
+     * @a samples samples on average. 0 means no target.
+     */
+    void setSampleTarget(unsigned int samples) { sampleTarget_ = samples; }
+
+    /**
+     * Save the image every @a seconds between passes (see CheckpointWriter),
+     * without pausing rendering. 0 turns checkpoints off.
+     */
+    void setCheckpointInterval(double seconds) { checkpoints_.setInterval(seconds); }
+    double checkpointInterval() const { return checkpoints_.interval(); }
+
     /**
      * Return a closure to sample the colour for a ray using this raytracer
      */
     Camera::sampling_func getSamplingFunction() const;
 
+    /**
+     * Return a closure to trace a batch of camera samples together,
+     * or an empty one if samples are traced one at a time
+     */
+    Camera::batch_sampling_func getBatchSamplingFunction() const;
+
     // public flags that can be set:
 
     bool sceneSignature; ///< Whether we want just want the scene signature
@@ -83,6 +204,8 @@ public:
     // all conversion of raw data to images
     bool dumpRaw; ///< Whether to dump the raw image file after rendering
 
+    bool tileReport; ///< Whether to print the timing of every tile after rendering
+
 private:
 
     /**
@@ -90,36 +213,157 @@ private:
      *
      * Called recursively for reflection and refraction
      */
-    Colour shadeRay( Ray3D& ray, int diffuseBounces = 1, int specularBounces = 3) const; 
+    Colour shadeRay( Ray3D& ray, PixelSampler& pixelSampler, int diffuseBounces = 1, int specularBounces = 3) const; 
+
+    /**
+     * Render the tiles dealt out by the scheduler, using all threads.
+     * If @a reportProgress, print progress every 5%.
+     */
+    void renderPass( Camera& cam, bool reportProgress );
 
-    Colour calculateRadiance( Ray3D const& rayFromSurface, Ray3D const& rayFromViewer) const;
+    /**
+     * Light reflected towards the viewer by the surface with @a bsdf,
+     * of the light arriving along @a rayFromSurface.
+     */
+    Colour calculateRadiance( Ray3D const& rayFromSurface, BSDF const& bsdf ) const;
 
     /**
      * After intersection, calculate the colour of the ray by shading it
      * with all light sources in the scene.
      */
-    void lightShading( Ray3D& ray, int diffuseBounces, int specularBounces ) const;
+    void lightShading( Ray3D& ray, BSDF const& bsdf, PixelSampler& pixelSampler,
+                       int diffuseBounces, int specularBounces ) const;
 
     /**
      * Use multiple-importance sampling with sampling strategies to compute
-     * estimate of the ray colour
+     * estimate of the ray colour.
+     *
+     * Samples of the @a lights strategies only gather light emitted at the
+     * first surface they hit, costing a single ray each. Samples of the
+     * @a others are shaded fully.
      */
-    void lightWithStrategies( Ray3D& ray,
-                              std::vector< CachedSamplingStrategy > const& strategies,
+    void lightWithStrategies( Ray3D& ray, BSDF const& bsdf, PixelSampler& pixelSampler,
+                              ScratchArray< CachedSamplingStrategy > const& lights,
+                              ScratchArray< CachedSamplingStrategy > const& others,
                               int diffuseBounces, int specularBounces ) const ;
 
+    /**
+     * Find the first surface hit by @a ray, and return the light
+     * it emits (black if none).
+     */
+    Colour emission( Ray3D& ray ) const;
+
+    /**
+     * Return the colour of the ray by following a single path through the
+     * scene, estimating direct light at every diffuse vertex.
+     *
+     * Iterative alternative to shadeRay, used by the path integrator.
+     * Traced as a batch of one path.
+     */
+    Colour tracePath( Ray3D& ray, PixelSampler& pixelSampler ) const;
+
+    /**
+     * Trace all @a paths to the end with the path integrator, one vertex
+     * of every live path at a time, leaving the light of each in the batch.
+     */
+    void tracePaths( PathBatch& paths ) const;
+
+    /**
+     * Intersect the current ray of every live path with the scene.
+     *
+     * If the rays are @a coherent (camera rays, in pixel order), they
+     * are traced in packets of neighbours.
+     */
+    void intersectPaths( PathBatch& paths, bool coherent ) const;
+
+    /**
+     * Shade the intersection of every live path (see shadePathVertex),
+     * and drop the paths that end there.
+     */
+    void shadePaths( PathBatch& paths, LightRayQueue& emitterRays,
+                     LightRayQueue& shadowRays ) const;
+
+    /**
+     * Shade the intersection of path @a p: gather the light it can find
+     * without tracing, queue rays towards lights for the rest, and choose
+     * the next ray of the path.
+     *
+     * @return false if the path ends at this vertex
+     */
+    bool shadePathVertex( PathBatch& paths, std::uint32_t p,
+                          LightRayQueue& emitterRays, LightRayQueue& shadowRays ) const;
+
+    /**
+     * Queue a ray towards the emitters for path @a p at the intersection of
+     * @a ray, with @a bsdf, using a single sample from one of the @a lights
+     * strategies.
+     *
+     * If @a diffuse strategies are given, the sample is weighted against
+     * the probability of those producing the same direction.
+     */
+    void queueEmitterRay( PathBatch& paths, std::uint32_t p,
+                          Ray3D const& ray, BSDF const& bsdf,
+                          ScratchArray< CachedSamplingStrategy > const& lights,
+                          ScratchArray< CachedSamplingStrategy > const& diffuse,
+                          LightRayQueue& emitterRays ) const;
+
+    /**
+     * Shade path @a p at the intersection of @a ray with the point lights,
+     * queueing a shadow ray for the light of each that may be blocked.
+     */
+    void queuePointLights( PathBatch& paths, std::uint32_t p,
+                           Ray3D const& ray, BSDF const& bsdf,
+                           LightRayQueue& shadowRays ) const;
+
+    /**
+     * Trace the queued rays, adding the light they find to their paths,
+     * and empty the queues.
+     *
+     * Shadow rays are traced in packets of rays heading into the same
+     * octant, which are mostly those towards the same light.
+     */
+    void traceLightRays( PathBatch& paths, LightRayQueue& emitterRays,
+                         LightRayQueue& shadowRays ) const;
+
     void setupStrategies();
 
+    IntegratorType integrator_;
+
+    bool stochasticSpecular_; ///< whether specular surfaces follow a single branch
+
+    bool wavefront_; ///< whether the path integrator traces batches breadth-first
+
     // How many bounces to do for reflections
     int maxDiffuse_;
     int maxSpecular_;
 
+    int rouletteDepth_; ///< diffuse bounces before paths may be terminated
+
+    std::uint64_t seed_; ///< seed for all random numbers
+
+    double adaptiveThreshold_; ///< relative error pixels are sampled down to, 0 if not adaptive
+    int maxPasses_; ///< most passes an adaptive render makes
+    double timeLimit_; ///< seconds after which no more passes are started, if positive
+    unsigned int sampleTarget_; ///< average samples per pixel to render passes up to, if positive
+
+    bool useLightTree_; ///< whether lights are picked from the scene's light trees
+
     // How many samples to take from light source
     SamplingStrategyGroup lightStrategies_;
     SamplingStrategyGroup diffuseStrategies_;
 
+    /**
+     * Strategies sampling refractive objects, which focus light from
+     * behind them (caustics). Takes as many samples as the lights.
+     */
+    SamplingStrategyGroup causticStrategies_;
+
     Scene const* scene_; ///< scene to be rendered
 
+    TileScheduler scheduler_; ///< distributes tiles of the image among threads
+
+    CheckpointWriter checkpoints_; ///< saves the image between passes
+
 };
 
 #endif // _RAYTRACER_H_
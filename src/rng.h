@@ -0,0 +1,125 @@
+/***********************************************************
+    Random number generation, with explicitly passed state.
+***********************************************************/
+
+#ifndef _QND_RNG_H_
+#define _QND_RNG_H_
+
+#include <cstdint>
+#include <array>
+#include <algorithm>
+
+// quick n dirty namespace
+namespace qnd {
+    const int cacheLineSize = 64;
+
+    /**
+     * Scramble the bits of @a key, so that neighbouring keys give
+     * unrelated results (the finalizer of splitmix64).
+     *
+     * Useful for deriving seeds from counters, e.g. pixel coordinates.
+     */
+    inline std::uint64_t mixBits(std::uint64_t key) {
+        key = (key ^ (key >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        key = (key ^ (key >> 27)) * 0x94d049bb133111ebULL;
+        return key ^ (key >> 31);
+    }
+
+    /**
+     * Randomly permute the bits of @a x, depending on @a seed, such that
+     * every bit of the result only depends on the same and lower bits of
+     * @a x (the hash of Laine and Karras, as improved by Burley).
+     *
+     * This makes it a permutation of [0, 2^k) for any k, when only the
+     * lowest k bits are kept.
+     */
+    inline std::uint32_t laineKarrasPermutation(std::uint32_t x, std::uint32_t seed) {
+        x ^= x * 0x3d20adea;
+        x += seed;
+        x *= (seed >> 16) | 1;
+        x ^= x * 0x05526c56;
+        x ^= x * 0x53a22864;
+        return x;
+    }
+
+    /**
+     * A small and fast generator of random numbers (PCG32, by M. O'Neill).
+     *
+     * The generator is not shared between threads- it is created where
+     * random numbers are first needed (e.g. one per pixel), and passed down
+     * explicitly from there. Generators are aligned to a cache line, so
+     * those of different threads never share one.
+     *
+     * Different @a stream values give independent sequences for the same
+     * @a seed, e.g. one stream per pixel.
+     */
+    class alignas(cacheLineSize) Rng {
+
+    public:
+        explicit Rng(std::uint64_t seed = 0x853c49e6748fea9bULL,
+                     std::uint64_t stream = 0xda3e39cb94b95bdbULL) {
+            reseed(seed, stream);
+        }
+
+        void reseed(std::uint64_t seed, std::uint64_t stream) {
+            state_ = 0;
+            inc_ = (stream << 1) | 1;
+            next();
+            state_ += seed;
+            next();
+        }
+
+        /**
+         * Generates a uniformly distributed 32 bit number
+         */
+        std::uint32_t next() {
+            std::uint64_t old = state_;
+            state_ = old * 6364136223846793005ULL + inc_;
+
+            std::uint32_t xorshifted = std::uint32_t(((old >> 18) ^ old) >> 27);
+            std::uint32_t rot = std::uint32_t(old >> 59);
+            return (xorshifted >> rot) | (xorshifted << ((-rot) & 31));
+        }
+
+        /**
+         * Generates a number in [0, 1)
+         */
+        double uniform() {
+            return next() * (1.0 / 4294967296.0);
+        }
+
+        double uniform(double a, double b) {
+            return a + (b-a) * uniform();
+        }
+
+    private:
+        std::uint64_t state_;
+        std::uint64_t inc_; ///< selects the stream, always odd
+    };
+
+    /**
+     * A generator that can be plugged into samplers
+     */
+    template <int Dim>
+    struct uniform_generator {
+        typedef std::array<double, Dim> result_type;
+
+        static result_type generate(Rng& rng) {
+            result_type result;
+            std::generate(result.begin(), result.end(),
+                          [&rng]() { return rng.uniform(); });
+            return result;
+        }
+    };
+
+    template <>
+    struct uniform_generator<1> {
+        typedef double result_type;
+
+        static result_type generate(Rng& rng) {
+            return rng.uniform();
+        }
+    };
+}
+
+#endif // _QND_RNG_H_
@@ -1,6 +1,9 @@
 #include "sampling_strategy.h"
 #include "light_volume.h"
+#include "light_tree.h"
+#include "mesh/mesh_geometry.h"
 #include "ray.h"
+#include "bsdf.h"
 
 SamplingStrategy::~SamplingStrategy() { }
 
@@ -8,8 +11,8 @@ SamplingStrategy::~SamplingStrategy() { }
  *                           HemisphereStrategy                            *
  ***************************************************************************/
 
-strategy_cache HemisphereStrategy::initCache(Ray3D const& ray) const {
-    return strategy_cache( ray, 1.0 );
+strategy_cache HemisphereStrategy::initCache(Ray3D const& ray, BSDF const& bsdf) const {
+    return strategy_cache( ray, bsdf, 1.0 );
 }
 
 void HemisphereStrategy::getSample(double u, double v,
@@ -25,7 +28,7 @@ void HemisphereStrategy::getSample(double u, double v,
                      u);
 
     // rotate direction to be ralative to actual normal
-    dir = rotateVector(tempDir, cache.ray->intersection.normal);
+    dir = cache.bsdf->frame.toWorld(tempDir);
 }
 
 double HemisphereStrategy::dirProbability(Vector3D const& dir, strategy_cache const& cache) const {
@@ -33,6 +36,113 @@ double HemisphereStrategy::dirProbability(Vector3D const& dir, strategy_cache co
 }
 
 
+/***************************************************************************
+ *                             CosineStrategy                              *
+ ***************************************************************************/
+
+strategy_cache CosineStrategy::initCache(Ray3D const& ray, BSDF const& bsdf) const {
+    // probability depends on the direction, see dirProbability
+    return strategy_cache( ray, bsdf, 0.0 );
+}
+
+void CosineStrategy::getSample(double u, double v,
+                                Vector3D& dir, strategy_cache const& cache) const {
+
+    // uniform point on the unit disc, projected up to the hemisphere
+    double sinTheta = sqrt(u);
+    double fi = 2*M_PI*v;
+
+    Vector3D tempDir(cos(fi)*sinTheta,
+                     sin(fi)*sinTheta,
+                     sqrt(std::max(0.0, 1 - u)));
+
+    dir = cache.bsdf->frame.toWorld(tempDir);
+}
+
+double CosineStrategy::dirProbability(Vector3D const& dir, strategy_cache const& cache) const {
+    // cos/pi, relative to the 1/(2*pi) of the uniform hemisphere
+    return 2 * std::max(0.0, dir.dot(cache.bsdf->frame.normal));
+}
+
+
+/***************************************************************************
+ *                            PhongLobeStrategy                            *
+ ***************************************************************************/
+
+strategy_cache PhongLobeStrategy::initCache(Ray3D const& ray, BSDF const& bsdf) const {
+    // probability depends on the direction, see dirProbability
+    return strategy_cache( ray, bsdf, 0.0 );
+}
+
+void PhongLobeStrategy::getSample(double u, double v,
+                                Vector3D& dir, strategy_cache const& cache) const {
+    double exponent = cache.bsdf->exponent;
+
+    double cosAlpha = pow(u, 1.0 / (exponent + 1));
+    double sinAlpha = sqrt(std::max(0.0, 1 - cosAlpha*cosAlpha));
+    double fi = 2*M_PI*v;
+
+    Vector3D tempDir(cos(fi)*sinAlpha,
+                     sin(fi)*sinAlpha,
+                     cosAlpha);
+
+    // directions below the surface are left to the caller to discard
+    dir = cache.bsdf->mirror.toWorld(tempDir);
+}
+
+double PhongLobeStrategy::dirProbability(Vector3D const& dir, strategy_cache const& cache) const {
+    double exponent = cache.bsdf->exponent;
+    double cosAlpha = dir.dot(cache.bsdf->mirror.normal);
+    if (cosAlpha <= 0) {
+        return 0.0;
+    }
+
+    // (n+1)/(2*pi) cos^n, relative to the 1/(2*pi) of the uniform hemisphere
+    return (exponent + 1) * pow(cosAlpha, exponent);
+}
+
+
+/***************************************************************************
+ *                              BRDFStrategy                               *
+ ***************************************************************************/
+
+strategy_cache BRDFStrategy::initCache(Ray3D const& ray, BSDF const& bsdf) const {
+    auto mean = [](Colour const& c) { return (c[0] + c[1] + c[2]) / 3.0; };
+
+    // light reflected by each part of the BRDF under uniform lighting.
+    // The specular lobe integrates to 2/(n+1) around the mirror
+    // direction, weighed by its cosine to the normal.
+    double diffuse = mean(bsdf.diffuse);
+    double cosMirror = std::max(0.0, bsdf.mirror.normal.dot(bsdf.frame.normal));
+    double specular = mean(bsdf.specular) * 2 * cosMirror / (bsdf.exponent + 1);
+
+    double total = diffuse + specular;
+    return strategy_cache( ray, bsdf, total > 0 ? specular / total : 0.0 );
+}
+
+void BRDFStrategy::getSample(double u, double v,
+                                Vector3D& dir, strategy_cache const& cache) const {
+    // choose a lobe, and stretch the part of u that chose it back to [0,1)
+    double specularWeight = cache.probability;
+    if (u < specularWeight) {
+        lobe_.getSample(u / specularWeight, v, dir, cache);
+    }
+    else {
+        cosine_.getSample((u - specularWeight) / (1 - specularWeight), v, dir, cache);
+    }
+}
+
+double BRDFStrategy::dirProbability(Vector3D const& dir, strategy_cache const& cache) const {
+    double specularWeight = cache.probability;
+    double probability = (1 - specularWeight) * cosine_.dirProbability(dir, cache);
+    if (specularWeight > 0) {
+        probability += specularWeight * lobe_.dirProbability(dir, cache);
+    }
+
+    return probability;
+}
+
+
 /***************************************************************************
  *                           LightVolumeStrategy                           *
  ***************************************************************************/
@@ -40,9 +150,9 @@ double HemisphereStrategy::dirProbability(Vector3D const& dir, strategy_cache co
 LightVolumeStrategy::LightVolumeStrategy( LightVolume const& bound)
                 : bound_(bound) { }
                 
-strategy_cache LightVolumeStrategy::initCache(Ray3D const& ray) const {
-    return strategy_cache( ray,
-                          bound_.subtendedProbability(ray.intersection.point)  );
+strategy_cache LightVolumeStrategy::initCache(Ray3D const& ray, BSDF const& bsdf) const {
+    return strategy_cache( ray, bsdf,
+                          bound_.subtendedProbability(ray.intersection.point) );
 }
 
 void LightVolumeStrategy::getSample(double u, double v,
@@ -58,3 +168,160 @@ double LightVolumeStrategy::dirProbability(Vector3D const& dir, strategy_cache c
 
     return 0.0;
 }
+
+
+/***************************************************************************
+ *                            MeshLightStrategy                            *
+ ***************************************************************************/
+
+MeshLightStrategy::MeshLightStrategy( std::shared_ptr< MeshGeometry const > geometry,
+                                      AffineTrans3D const& modelToWorld,
+                                      AffineTrans3D const& worldToModel)
+                : geometry_(geometry),
+                  modelToWorld_(modelToWorld),
+                  worldToModel_(worldToModel),
+                  area_(0.0) {
+
+    // faces scale differently under non-uniform scaling, so weigh
+    // them by their area in world space
+    VertexStorage const& vertices = geometry_->vertices();
+    std::vector<double> areas;
+    for (Face const& face : geometry_->faces()) {
+        Point3D const& p0 = vertices[face.vertices[0]].point;
+        Vector3D edge1 = modelToWorld_.transformVector(vertices[face.vertices[1]].point - p0);
+        Vector3D edge2 = modelToWorld_.transformVector(vertices[face.vertices[2]].point - p0);
+        double area = 0.5 * edge1.v.cross(edge2.v).norm();
+        areas.push_back(area);
+        area_ += area;
+    }
+
+    faces_.build(areas);
+}
+
+strategy_cache MeshLightStrategy::initCache(Ray3D const& ray, BSDF const& bsdf) const {
+    // probability depends on the direction, see dirProbability
+    return strategy_cache( ray, bsdf, 0.0 );
+}
+
+void MeshLightStrategy::getSample(double u, double v,
+                                Vector3D& dir, strategy_cache const& cache) const {
+    Point3D const& viewPoint = cache.ray->intersection.point;
+    dir = Vector3D(0, 0, 0);
+
+    if (faces_.empty()) {
+        return;
+    }
+
+    // uniformly distributed point on the face
+    Face const& face = geometry_->faces()[faces_.sample(u)];
+    VertexStorage const& vertices = geometry_->vertices();
+    double su = std::sqrt(u);
+    Point3D point = (1 - su) * vertices[face.vertices[0]].point.v
+                  + su * (1 - v) * vertices[face.vertices[1]].point.v
+                  + su * v * vertices[face.vertices[2]].point.v;
+
+    // reject the point if another face of the mesh is in front of it,
+    // or it faces away
+    Point3D origin = worldToModel_.transformPoint(viewPoint.v);
+    Vector3D toPoint = point - origin;
+    double distance = toPoint.normalize();
+
+    FaceIntersection intersection;
+    geometry_->kdTree().traverse(origin, toPoint, intersection);
+    if (!intersection.face
+        || std::abs(intersection.t_value - distance) > 1e-6 * distance) {
+        return;
+    }
+
+    dir = modelToWorld_.transformPoint(point.v) - viewPoint.v;
+    dir.normalize();
+}
+
+double MeshLightStrategy::dirProbability(Vector3D const& dir, strategy_cache const& cache) const {
+    if (faces_.empty()) {
+        return 0.0;
+    }
+
+    // first face hit in the direction, in model space
+    Point3D const& viewPoint = cache.ray->intersection.point;
+    Point3D origin = worldToModel_.transformPoint(viewPoint.v);
+    Vector3D modelDir = worldToModel_.transformVector(dir.v);
+    modelDir.normalize();
+
+    FaceIntersection intersection;
+    geometry_->kdTree().traverse(origin, modelDir, intersection);
+    if (!intersection.face) {
+        return 0.0;
+    }
+
+    // convert the probability of the point per area, to one per solid
+    // angle at the view point
+    Point3D point = getInterPoint(intersection.t_value, origin, modelDir);
+    Vector3D toPoint = modelToWorld_.transformPoint(point.v) - viewPoint.v;
+    double distanceSquared = toPoint.squaredNorm();
+    toPoint.normalize();
+
+    Vector3D normal = worldToModel_.invTransNorm(intersection.face->normal.v);
+    normal.normalize();
+    double cosEmitted = std::abs(normal.dot(toPoint));
+    if (cosEmitted <= 0) {
+        return 0.0;
+    }
+
+    // relative to uniformly sampling the hemisphere
+    return 2 * M_PI * distanceSquared / (area_ * cosEmitted);
+}
+
+
+/***************************************************************************
+ *                            LightTreeStrategy                            *
+ ***************************************************************************/
+
+LightTreeStrategy::LightTreeStrategy( LightTree const& tree,
+                                      std::vector< SamplingStrategy* > const& strategies)
+                : tree_(tree), strategies_(strategies) { }
+
+LightTreeStrategy::~LightTreeStrategy() {
+    for (SamplingStrategy* strategy : strategies_) {
+        delete strategy;
+    }
+}
+
+strategy_cache LightTreeStrategy::initCache(Ray3D const& ray, BSDF const& bsdf) const {
+    // probability depends on the direction, see dirProbability
+    return strategy_cache( ray, bsdf, 0.0 );
+}
+
+void LightTreeStrategy::getSample(double u, double v,
+                                Vector3D& dir, strategy_cache const& cache) const {
+    Intersection const& intersection = cache.ray->intersection;
+
+    double probability;
+    int light = tree_.sample(intersection.point, intersection.normal, u, probability);
+
+    // no light can reach the point, so give a direction every
+    // caller rejects
+    if (light < 0) {
+        dir = Vector3D(0, 0, 0);
+        return;
+    }
+
+    SamplingStrategy const& strategy = *strategies_[light];
+    strategy.getSample(u, v, dir, strategy.initCache(*cache.ray, *cache.bsdf));
+}
+
+double LightTreeStrategy::dirProbability(Vector3D const& dir, strategy_cache const& cache) const {
+    Intersection const& intersection = cache.ray->intersection;
+    Vector3D unitDir = dir;
+    unitDir.normalize();
+
+    double probability = 0.0;
+    tree_.visitHit(intersection.point, intersection.normal, unitDir,
+        [&](std::uint32_t light, double lightProbability) {
+            SamplingStrategy const& strategy = *strategies_[light];
+            probability += lightProbability
+                           * strategy.dirProbability(unitDir, strategy.initCache(*cache.ray, *cache.bsdf));
+        });
+
+    return probability;
+}
@@ -2,11 +2,17 @@
 #define _SAMPLING_STRATEGY_H_
 
 #include "uv_sampler.h"
+#include "alias_table.h"
 #include "math/math_types.h"
 #include <utility>
+#include <vector>
+#include <memory>
 
 class Ray3D;
+class BSDF;
 class LightVolume;
+class LightTree;
+class MeshGeometry;
 class SamplingStrategy;
 struct strategy_cache;
 
@@ -42,12 +48,13 @@ public:
     virtual ~SamplingStrategy();
 
     /**
-     * Initializes the cache according to the ray.
+     * Initializes the cache according to the ray, and the
+     * @a bsdf at its intersection.
      *
      * Pass this cache on all subsequent calls of methods
      * below.
      */
-    virtual strategy_cache initCache(Ray3D const& ray) const = 0;
+    virtual strategy_cache initCache(Ray3D const& ray, BSDF const& bsdf) const = 0;
 
     /**
      * Given unit samples @a u and @a v, set a direction through @a dir,
@@ -80,9 +87,11 @@ public:
  * many small heap allocations for strategies.
  */
 struct strategy_cache {
-    strategy_cache( Ray3D const& r, double p) : ray(&r), probability(p) { }
+    strategy_cache( Ray3D const& r, BSDF const& b, double p)
+            : ray(&r), bsdf(&b), probability(p) { }
 
     Ray3D const* ray;
+    BSDF const* bsdf;
     double probability;
 };
 
@@ -95,7 +104,7 @@ class HemisphereStrategy : public SamplingStrategy {
 public:
     HemisphereStrategy() { }
 
-    strategy_cache initCache(Ray3D const& ray) const;
+    strategy_cache initCache(Ray3D const& ray, BSDF const& bsdf) const;
     void getSample(double u, double v,
                            Vector3D& dir, strategy_cache const& cache) const;
 
@@ -103,6 +112,65 @@ public:
 
 };
 
+/**
+ * Sample the hemisphere in proportion to the cosine of the angle to the
+ * normal, which follows the diffuse part of the Phong BRDF (including
+ * the cosine of the rendering equation).
+ */
+class CosineStrategy : public SamplingStrategy {
+
+public:
+    CosineStrategy() { }
+
+    strategy_cache initCache(Ray3D const& ray, BSDF const& bsdf) const;
+    void getSample(double u, double v,
+                           Vector3D& dir, strategy_cache const& cache) const;
+
+    double dirProbability(Vector3D const& dir, strategy_cache const& cache) const;
+
+};
+
+/**
+ * Sample directions around the mirror direction of the ray, in
+ * proportion to the specular lobe of the Phong BRDF (cosine of the
+ * angle to the mirror direction, raised to the specular exponent).
+ */
+class PhongLobeStrategy : public SamplingStrategy {
+
+public:
+    PhongLobeStrategy() { }
+
+    strategy_cache initCache(Ray3D const& ray, BSDF const& bsdf) const;
+    void getSample(double u, double v,
+                           Vector3D& dir, strategy_cache const& cache) const;
+
+    double dirProbability(Vector3D const& dir, strategy_cache const& cache) const;
+
+};
+
+/**
+ * Importance sample the Phong BRDF of the material at the intersection:
+ * a mixture of cosine and Phong lobe sampling, each chosen in proportion
+ * to how much light the diffuse and specular parts reflect.
+ *
+ * The cache holds the chance of choosing the specular lobe.
+ */
+class BRDFStrategy : public SamplingStrategy {
+
+public:
+    BRDFStrategy() { }
+
+    strategy_cache initCache(Ray3D const& ray, BSDF const& bsdf) const;
+    void getSample(double u, double v,
+                           Vector3D& dir, strategy_cache const& cache) const;
+
+    double dirProbability(Vector3D const& dir, strategy_cache const& cache) const;
+
+private:
+    CosineStrategy cosine_;
+    PhongLobeStrategy lobe_;
+
+};
 
 /**
  * A strategy associated with lights. Given a volume in world space that
@@ -117,7 +185,7 @@ class LightVolumeStrategy : public SamplingStrategy {
 public:
     LightVolumeStrategy(LightVolume const& bound);
 
-    strategy_cache initCache(Ray3D const& ray) const;
+    strategy_cache initCache(Ray3D const& ray, BSDF const& bsdf) const;
     void getSample(double u, double v,
                            Vector3D& dir, strategy_cache const& cache) const;
 
@@ -128,4 +196,76 @@ private:
 
 };
 
+/**
+ * A strategy for an emitting mesh. Points are picked on the surface of
+ * the mesh in world space, with probability in proportion to area,
+ * and the direction towards them is sampled.
+ *
+ * Faces are only seen from the front, and may hide each other. A
+ * sampled point that is not the first face hit towards it is rejected
+ * (a zero direction is given), so the probability of a direction only
+ * depends on the first face it hits.
+ */
+class MeshLightStrategy : public SamplingStrategy {
+
+public:
+    /**
+     * Sample the faces of @a geometry, placed in world space by
+     * @a modelToWorld (and its inverse @a worldToModel).
+     */
+    MeshLightStrategy(std::shared_ptr< MeshGeometry const > geometry,
+                      AffineTrans3D const& modelToWorld,
+                      AffineTrans3D const& worldToModel);
+
+    /** @return the area of the mesh in world space */
+    double area() const { return area_; }
+
+    strategy_cache initCache(Ray3D const& ray, BSDF const& bsdf) const;
+    void getSample(double u, double v,
+                           Vector3D& dir, strategy_cache const& cache) const;
+
+    double dirProbability(Vector3D const& dir, strategy_cache const& cache) const;
+
+private:
+    std::shared_ptr< MeshGeometry const > geometry_;
+    AffineTrans3D modelToWorld_;
+    AffineTrans3D worldToModel_;
+
+    AliasTable faces_; ///< picks faces in proportion to their world space area
+    double area_;      ///< total world space area of the faces
+
+};
+
+/**
+ * A strategy over many lights at once. The first sample picks one of
+ * the lights with a LightTree, in proportion to its estimated
+ * contribution at the intersection point, and the rest of the sample
+ * is spent on the strategy of that light.
+ *
+ * The probability of a direction sums over every light it points
+ * towards, so overlapping lights are handled correctly.
+ */
+class LightTreeStrategy : public SamplingStrategy {
+
+public:
+    /**
+     * @a tree holds the lights sampled by @a strategies, in the same
+     * order. Ownership of the strategies is transferred.
+     */
+    LightTreeStrategy(LightTree const& tree,
+                      std::vector< SamplingStrategy* > const& strategies);
+    ~LightTreeStrategy();
+
+    strategy_cache initCache(Ray3D const& ray, BSDF const& bsdf) const;
+    void getSample(double u, double v,
+                           Vector3D& dir, strategy_cache const& cache) const;
+
+    double dirProbability(Vector3D const& dir, strategy_cache const& cache) const;
+
+private:
+    LightTree const& tree_;
+    std::vector< SamplingStrategy* > strategies_;
+
+};
+
 #endif // _SAMPLING_STRATEGY_H_
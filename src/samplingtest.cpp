@@ -1,18 +1,274 @@
-#include "samplingutils.h"
-#include "threadrand.h"
+/***********************************************************
+    Checks of the sample generators. Build and run with
+    "make check"; prints any failures and returns non-zero.
+***********************************************************/
+
+#include "rng.h"
+#include "uv_sampler.h"
+#include "pixel_sampler.h"
+#include "scratch_arena.h"
+#include "alias_table.h"
+#include "sampling_strategy.h"
+#include "bsdf.h"
+#include "ray.h"
+#include "texture/material.h"
+#include "mesh/mesh_geometry.h"
+
+#include <algorithm>
+#include <cmath>
 #include <iostream>
+#include <limits>
+#include <memory>
+#include <vector>
+
+namespace {
+
+    int failures = 0;
+
+    void check(bool condition, char const* what) {
+        if (!condition) {
+            std::cerr << "FAILED: " << what << std::endl;
+            ++failures;
+        }
+    }
+
+    const SampleSequence allSequences[] = {
+        Sequence_Stratified, Sequence_Sobol, Sequence_Halton, Sequence_R2
+    };
+
+    bool inUnitSquare(uv_sample const& sample) {
+        return sample[0] >= 0.0 && sample[0] < 1.0
+            && sample[1] >= 0.0 && sample[1] < 1.0;
+    }
+
+    // @return the first pair of dimensions of samples [begin, end) of the
+    // pixel with @a key
+    std::vector< uv_sample > pixelSamples(UVSampler const& sequence,
+                                          std::uint32_t begin, std::uint32_t end,
+                                          std::uint32_t key) {
+        qnd::Rng rng(key);
+        ScratchArena scratch;
+        std::vector< uv_sample > samples;
+        for (std::uint32_t index = begin; index < end; ++index) {
+            PixelSampler sampler(sequence, index, key, rng, scratch);
+            samples.push_back(sampler.get2D());
+        }
+        return samples;
+    }
+
+    void testUniform() {
+        qnd::Rng rng;
+        bool inRange = true;
+        for (int i = 0; i < 100000; ++i) {
+            double x = rng.uniform();
+            inRange = inRange && x >= 0.0 && x < 1.0;
+        }
+        check(inRange, "uniform numbers lie in [0,1)");
+    }
+
+    void testSequencesInUnitSquare() {
+        for (SampleSequence sequence : allSequences) {
+            qnd::Rng rng;
+            bool inRange = true;
+            for (int n : { 1, 7, 16, 100, 4096 }) {
+                UVSampler sampler(n, sequence);
+                for (int pass = 0; pass < 8; ++pass) {
+                    for (auto const& sample : sampler(rng)) {
+                        inRange = inRange && inUnitSquare(sample);
+                    }
+                }
+            }
+            check(inRange, "sequence samples lie in [0,1)x[0,1)");
+        }
+    }
+
+    // the samples of a pixel visit each pass of the sequence in a shuffled
+    // order, so together they must be exactly the points of the pass
+    void testPixelSamplesArePermutation() {
+        for (SampleSequence sequence : { Sequence_Sobol, Sequence_Halton, Sequence_R2 }) {
+            bool permutation = true;
+            for (std::uint32_t n : { 1u, 3u, 5u, 12u, 33u, 100u, 1000u }) {
+                UVSampler sampler(n, sequence);
+                for (std::uint32_t key : { 0u, 1u, 0xdeadbeefu }) {
+                    // points of the sequence as scrambled for the first
+                    // pair of dimensions of the pixel
+                    std::uint64_t hash = qnd::mixBits(std::uint64_t(key) << 32);
+                    std::uint32_t scramble[2] = { std::uint32_t(hash), std::uint32_t(hash >> 32) };
+                    qnd::Rng rng;
+
+                    for (std::uint32_t pass = 0; pass < 2; ++pass) {
+                        std::vector< uv_sample > expected;
+                        for (std::uint32_t i = pass*n; i < (pass + 1)*n; ++i) {
+                            expected.push_back(*uv_iterator(i, n, sequence, scramble, rng));
+                        }
+
+                        std::vector< uv_sample > samples = pixelSamples(sampler, pass*n, (pass + 1)*n, key);
+
+                        std::sort(expected.begin(), expected.end());
+                        std::sort(samples.begin(), samples.end());
+                        permutation = permutation && samples == expected;
+                    }
+                }
+            }
+            check(permutation, "samples of a pixel are a permutation of each pass of the sequence");
+        }
+    }
+
+    void testPixelSamplesDeterministic() {
+        for (SampleSequence sequence : { Sequence_Sobol, Sequence_Halton, Sequence_R2 }) {
+            UVSampler sampler(24, sequence);
+            bool same = pixelSamples(sampler, 0, 48, 1234) == pixelSamples(sampler, 0, 48, 1234);
+            bool differ = pixelSamples(sampler, 0, 48, 1234) != pixelSamples(sampler, 0, 48, 1235);
+            check(same, "samples of a pixel only depend on its key");
+            check(differ, "pixels with different keys get different samples");
+        }
+    }
+
+    // pick many items from a table over @a weights, and compare how often
+    // each comes up with its weight
+    void checkAliasFrequencies(std::vector<double> const& weights) {
+        AliasTable table;
+        table.build(weights);
+        check(table.size() == weights.size(), "alias table holds every item");
+        if (table.size() != weights.size()) {
+            return;
+        }
+
+        double total = 0.0;
+        for (double weight : weights) {
+            total += weight > 0 ? weight : 0.0;
+        }
 
-using namespace std;
-using namespace boost;
+        const int picks = 1000000;
+        std::vector<int> counts(weights.size(), 0);
+        qnd::Rng rng;
+        bool rescaledInRange = true;
+        for (int i = 0; i < picks; ++i) {
+            double u = rng.uniform();
+            counts[table.sample(u)]++;
+            rescaledInRange = rescaledInRange && u >= 0.0 && u < 1.0;
+        }
+        check(rescaledInRange, "alias table rescales u into [0,1)");
+
+        for (std::size_t i = 0; i < weights.size(); ++i) {
+            double expected = weights[i] > 0 ? weights[i] / total : 0.0;
+            double frequency = double(counts[i]) / picks;
+            // five standard deviations of the frequency
+            double tolerance = 5 * std::sqrt(expected * (1 - expected) / picks);
+
+            check(std::abs(table.probability(i) - expected) < 1e-12,
+                  "alias table probability matches the normalized weight");
+            if (expected == 0.0) {
+                check(counts[i] == 0, "items without weight are never picked");
+            }
+            else {
+                check(std::abs(frequency - expected) <= tolerance,
+                      "items are picked in proportion to their weight");
+            }
+        }
+    }
+
+    void testAliasTable() {
+        checkAliasFrequencies({ 1.0 });
+        checkAliasFrequencies({ 1.0, 1.0, 1.0, 1.0, 1.0 });
+        checkAliasFrequencies({ 1.0, 0.0, 3.0, 0.5, 6.0, 0.0, 1e-3 });
+        // negative and NaN weights count as zero
+        checkAliasFrequencies({ 2.0, -1.0, 0.0, std::numeric_limits<double>::quiet_NaN(), 5.0 });
+        // one item holding nearly all the weight
+        checkAliasFrequencies({ 1e-9, 1e9, 1e-9, 1e-9 });
+
+        AliasTable table;
+        table.build(std::vector<double>());
+        check(table.empty(), "alias table without items is empty");
+        table.build({ 0.0, 0.0, -1.0 });
+        check(table.empty(), "alias table without positive weights is empty");
+    }
+
+    // @return a mesh of the quad [-1,1]x[-1,1] at z = 1, facing -z
+    std::shared_ptr< MeshGeometry const > makeQuad() {
+        Point3D corners[4] = { Point3D(-1, -1, 1), Point3D(1, -1, 1),
+                               Point3D(1, 1, 1), Point3D(-1, 1, 1) };
+        Vector3D normal(0, 0, -1);
+
+        VertexStorage vertices(4);
+        for (int i = 0; i < 4; ++i) {
+            vertices[i].point = corners[i];
+            vertices[i].normal = normal;
+        }
+
+        FaceStorage faces(2);
+        for (int f = 0; f < 2; ++f) {
+            faces[f].vertices = {{ 0, std::uint32_t(2 - f), std::uint32_t(3 - f) }};
+            faces[f].normal = normal;
+        }
+
+        BoundingBox box(Point3D(-1, -1, 1), Point3D(1, 1, 1));
+        return std::make_shared< MeshGeometry const >(std::move(vertices), std::move(faces),
+                                                      box, 1.0, false);
+    }
+
+    // the mean of dirProbability over the hemisphere above a point, which
+    // is 1 when all of the mesh is visible from it
+    double meanMeshProbability(AffineTrans3D const& modelToWorld,
+                               AffineTrans3D const& worldToModel) {
+        MeshLightStrategy strategy(makeQuad(), modelToWorld, worldToModel);
+
+        Material material;
+        Ray3D ray(Point3D(0, 0, -1), Vector3D(0, 0, 1));
+        ray.intersection.point = Point3D(0, 0, 0);
+        ray.intersection.normal = Vector3D(0, 0, 1);
+        ray.intersection.mat = &material;
+        BSDF bsdf(ray);
+        strategy_cache cache = strategy.initCache(ray, bsdf);
+
+        // midpoints of a grid uniform over the hemisphere: uniform in the
+        // height and the angle around the normal
+        const int steps = 1000;
+        double sum = 0.0;
+        for (int i = 0; i < steps; ++i) {
+            double z = (i + 0.5) / steps;
+            double r = std::sqrt(1 - z*z);
+            for (int j = 0; j < steps; ++j) {
+                double phi = 2 * M_PI * (j + 0.5) / steps;
+                sum += strategy.dirProbability(Vector3D(r*std::cos(phi), r*std::sin(phi), z), cache);
+            }
+        }
+
+        return sum / (steps * steps);
+    }
+
+    void testMeshLightProbability() {
+        AffineTrans3D identity;
+        double mean = meanMeshProbability(identity, identity);
+        check(std::abs(mean - 1.0) < 0.01, "mesh light probability integrates to 1");
+
+        // non-uniformly scaled, and moved along the normal
+        AffineTrans3D::EigenMatrixType scale = AffineTrans3D::EigenMatrixType::Identity();
+        scale(0, 0) = 3.0;
+        scale(2, 2) = 0.5;
+        AffineTrans3D::EigenVectorType shift(0, 0, 0.25);
+        AffineTrans3D modelToWorld(scale, shift);
+        AffineTrans3D worldToModel(scale.inverse(), -(scale.inverse() * shift));
+        mean = meanMeshProbability(modelToWorld, worldToModel);
+        check(std::abs(mean - 1.0) < 0.01, "transformed mesh light probability integrates to 1");
+    }
+
+}
 
 int main (int argc, char* argv[]) {
 
-    copy(
-            make_function_input_iterator(qnd::genRandomBetween01, 0),
-            make_function_input_iterator(qnd::genRandomBetween01, 10),
-            ostream_iterator<int>(cout, " ")
-        );
+    testUniform();
+    testSequencesInUnitSquare();
+    testPixelSamplesArePermutation();
+    testPixelSamplesDeterministic();
+    testAliasTable();
+    testMeshLightProbability();
 
+    if (failures) {
+        std::cerr << failures << " check(s) failed" << std::endl;
+        return 1;
+    }
 
+    std::cout << "All sampling checks passed" << std::endl;
     return 0;
 }
@@ -1,10 +1,12 @@
 #include "scene.h"
 #include "light_volume.h"
+#include "sampling_strategy.h"
 #include "texture/material.h"
 #include "mesh/obj_store.h"
+#include "texture/sensor.h"
 
-#include <functional>
 #include <algorithm>
+#include <limits>
 
 SceneDagNode::SceneDagNode() : 
     obj(nullptr), mat(NULL), lightBound(NULL), bound(NULL),
@@ -119,8 +121,7 @@ void SceneDagNode::preprocess() {
 
         // adjust the bounding volume to contain object in world space
         if(lightBound) {
-            lightBound->pos = modelToWorld.t;
-            lightBound->scale = absFactor;
+            lightBound->setTransform(modelToWorld, absFactor);
         }
         if(bound) {
             bound->pos = modelToWorld.t;
@@ -136,6 +137,19 @@ void SceneDagNode::preprocess() {
     }
 }
 
+SamplingStrategy* SceneDagNode::createLightStrategy() const {
+    SamplingStrategy* strategy = obj->createLightStrategy(modelToWorld, worldToModel);
+    if (!strategy) {
+        strategy = new LightVolumeStrategy(*lightBound);
+    }
+
+    return strategy;
+}
+
+double SceneDagNode::getEmissionCone( Vector3D& axis ) const {
+    return obj->getEmissionCone(worldToModel, axis);
+}
+
 void SceneDagNode::traverse( Ray3D& ray ) const {
     // make sure ray.dir is unit length for bounding volume intersections
     ray.renormalize();
@@ -145,16 +159,7 @@ void SceneDagNode::traverse( Ray3D& ray ) const {
 void SceneDagNode::traverseHelper( Ray3D& ray) const {
     SceneDagNode *childPtr;
 
-    if (obj) {
-
-        // Perform intersection. First check the bound
-        // TODO: quit early if a closer intersection exists
-        if ( !bound || bound->fastIntersect(ray.origin, ray.dir) ) {
-            if (obj->intersect(ray, worldToModel, modelToWorld)) {
-                ray.intersection.mat = mat;
-            }
-        }
-    }
+    intersectObject(ray);
 
     // Traverse the children.
     childPtr = child;
@@ -164,6 +169,138 @@ void SceneDagNode::traverseHelper( Ray3D& ray) const {
     }
 }
 
+bool SceneDagNode::occluded( Point3D const& origin, Vector3D const& dir,
+                             double tMax ) const {
+    // make sure dir is unit length for bounding volume intersections
+    Vector3D unitDir = dir;
+    double length = unitDir.normalize();
+    return occludedHelper(origin, unitDir, tMax * length);
+}
+
+bool SceneDagNode::occludedHelper( Point3D const& origin, Vector3D const& dir,
+                                   double tMax ) const {
+    if (occludesObject(origin, dir, tMax)) {
+        return true;
+    }
+
+    // Traverse the children, until one is intersected
+    for (SceneDagNode* childPtr = child; childPtr != nullptr; childPtr = childPtr->next) {
+        if (childPtr->occludedHelper(origin, dir, tMax)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool SceneDagNode::intersectObject( Ray3D& ray ) const {
+    if (!obj) {
+        return false;
+    }
+
+    // Perform intersection. First check the bound
+    if ( !bound || bound->fastIntersect(ray.origin, ray.dir) ) {
+        if (obj->intersect(ray, worldToModel, modelToWorld)) {
+            ray.intersection.mat = mat;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool SceneDagNode::occludesObject( Point3D const& origin, Vector3D const& dir,
+                                   double tMax ) const {
+    if (!obj) {
+        return false;
+    }
+
+    if ( !bound || bound->fastIntersect(origin, dir) ) {
+        return obj->occluded(origin, dir, tMax, worldToModel);
+    }
+
+    return false;
+}
+
+LaneMask SceneDagNode::intersectObject( RayPacket& packet, LaneMask mask ) const {
+    if (!obj) {
+        return 0;
+    }
+
+    // Perform intersection. First check the bound
+    if (bound) {
+        for (LaneMask m = mask; m; m &= m - 1) {
+            int lane = firstLane(m);
+            if ( !bound->fastIntersect(packet.originOf(lane), packet.dirOf(lane)) ) {
+                mask &= ~(1u << lane);
+            }
+        }
+    }
+
+    if (!mask) {
+        return 0;
+    }
+
+    LaneMask hit = obj->intersect(packet, mask, worldToModel, modelToWorld);
+    for (LaneMask m = hit; m; m &= m - 1) {
+        packet.ray[firstLane(m)]->intersection.mat = mat;
+    }
+
+    return hit;
+}
+
+LaneMask SceneDagNode::occludesObject( RayPacket const& packet, LaneMask mask,
+                                       double const* tMax ) const {
+    if (!obj) {
+        return 0;
+    }
+
+    if (bound) {
+        for (LaneMask m = mask; m; m &= m - 1) {
+            int lane = firstLane(m);
+            if ( !bound->fastIntersect(packet.originOf(lane), packet.dirOf(lane)) ) {
+                mask &= ~(1u << lane);
+            }
+        }
+    }
+
+    return mask ? obj->occluded(packet, mask, tMax, worldToModel) : 0;
+}
+
+bool SceneDagNode::getWorldBound( Point3D& minPoint, Point3D& maxPoint ) const {
+    Point3D modelMin, modelMax;
+    if (!obj || !obj->getModelBound(modelMin, modelMax)) {
+        return false;
+    }
+
+    // transform all corners of the model box, and bound those
+    const double inf = std::numeric_limits<double>::infinity();
+    minPoint = Point3D(inf, inf, inf);
+    maxPoint = Point3D(-inf, -inf, -inf);
+    for (int corner = 0; corner < 8; ++corner) {
+        Point3D p( (corner & 1) ? modelMax[0] : modelMin[0],
+                   (corner & 2) ? modelMax[1] : modelMin[1],
+                   (corner & 4) ? modelMax[2] : modelMin[2] );
+        Point3D q = modelToWorld.transformPoint(p.v);
+
+        for (int dim = 0; dim < 3; ++dim) {
+            minPoint[dim] = std::min(minPoint[dim], q[dim]);
+            maxPoint[dim] = std::max(maxPoint[dim], q[dim]);
+        }
+    }
+
+    return true;
+}
+
+void SceneDagNode::collectObjectNodes( std::vector< SceneDagNode const* >& nodes ) const {
+    if (obj) {
+        nodes.push_back(this);
+    }
+
+    for (SceneDagNode* childPtr = child; childPtr != nullptr; childPtr = childPtr->next) {
+        childPtr->collectObjectNodes(nodes);
+    }
+}
 
 /***************************************************************************
  *                                  Scene                                  *
@@ -191,6 +328,7 @@ SceneDagNode* Scene::addObject( SceneDagNode* parent,
         if (mat->emittance.getTexture() || !mat->emittance.getVal().isBlack()) {
             areaLights_ = true;
             emissiveNodes_.push_back(node);
+            emitterNodes_.push_back(node);
         }
         // if the object can refract, sample it for light too (for caustics)
         else if (mat->isTransmissive && obj->isSolid()) {
@@ -201,12 +339,122 @@ SceneDagNode* Scene::addObject( SceneDagNode* parent,
     return node;
 }
 
-Ray3D::intersection_func Scene::getIntersectionFunction() const {
-    return std::bind(&SceneDagNode::traverse, root_, std::placeholders::_1);
+void Scene::traverse( Ray3D& ray ) const {
+    // fall back to walking the scene graph if not preprocessed
+    if (bvh_.empty()) {
+        root_->traverse(ray);
+        return;
+    }
+
+    // make sure ray.dir is unit length for bounding volume intersections
+    ray.renormalize();
+    bvh_.traverse(ray);
+}
+
+bool Scene::occluded( Point3D const& origin, Vector3D const& dir, double tMax ) const {
+    if (bvh_.empty()) {
+        return root_->occluded(origin, dir, tMax);
+    }
+
+    Vector3D unitDir = dir;
+    double length = unitDir.normalize();
+    return bvh_.occluded(origin, unitDir, tMax * length);
+}
+
+void Scene::traverse( RayPacket& packet ) const {
+    if (bvh_.empty()) {
+        for (LaneMask m = packet.active; m; m &= m - 1) {
+            root_->traverse(*packet.ray[firstLane(m)]);
+        }
+        return;
+    }
+
+    // make sure the directions are unit length, in the rays and the packet
+    for (LaneMask m = packet.active; m; m &= m - 1) {
+        int lane = firstLane(m);
+        packet.ray[lane]->renormalize();
+        packet.setRay(lane, *packet.ray[lane]);
+    }
+    bvh_.traverse(packet);
+}
+
+LaneMask Scene::occluded( RayPacket const& packet, double const* tMax ) const {
+    LaneMask blocked = 0;
+    if (bvh_.empty()) {
+        for (LaneMask m = packet.active; m; m &= m - 1) {
+            int lane = firstLane(m);
+            if (root_->occluded(packet.originOf(lane), packet.dirOf(lane), tMax[lane])) {
+                blocked |= 1u << lane;
+            }
+        }
+        return blocked;
+    }
+
+    RayPacket unit;
+    double unitMax[PacketWidth] = { 0 };
+    for (LaneMask m = packet.active; m; m &= m - 1) {
+        int lane = firstLane(m);
+        Vector3D unitDir = packet.dirOf(lane);
+        double length = unitDir.normalize();
+        unit.setRay(lane, packet.originOf(lane), unitDir);
+        unitMax[lane] = tMax[lane] * length;
+    }
+    return bvh_.occluded(unit, unitMax);
 }
 
 void Scene::preprocess() {
     root_->preprocess();
+
+    std::vector< SceneDagNode const* > objects;
+    root_->collectObjectNodes(objects);
+    bvh_.build(objects);
+
+    buildLightTrees();
+}
+
+void Scene::buildLightTrees() {
+    std::vector< LightBounds > bounds;
+
+    for (emissive_iter it = emitter_begin(); it != emitter_end(); ++it) {
+        SceneDagNode const* node = *it;
+        MaterialParameter<Colour> const& emittance = node->mat->emittance;
+
+        // average a textured emittance over a coarse grid
+        Colour emitted;
+        if (emittance.getTexture()) {
+            const int grid = 8;
+            for (int u = 0; u < grid; ++u) {
+                for (int v = 0; v < grid; ++v) {
+                    emitted += emittance.at((u + 0.5) / grid, (v + 0.5) / grid);
+                }
+            }
+            emitted = emitted / double(grid * grid);
+        }
+        else {
+            emitted = emittance.getVal();
+        }
+
+        LightBounds light;
+        light.center = node->lightBound->pos;
+        light.radius = node->lightBound->boundingRadius();
+        light.cosCone = node->getEmissionCone(light.axis);
+
+        // emitted radiance over the area of the light, keeping a little
+        // so dark emitters can still be picked
+        light.power = std::max(SensorPixel::brightness(emitted), 1e-4)
+                      * light.radius * light.radius;
+        bounds.push_back(light);
+    }
+    emitterTree_.build(bounds);
+
+    bounds.clear();
+    for (light_iter it = light_begin(); it != light_end(); ++it) {
+        LightBounds light;
+        light.center = (*it)->position();
+        light.power = (*it)->power();
+        bounds.push_back(light);
+    }
+    pointLightTree_.build(bounds);
 }
 
 void Scene::addLightSource( LightSource* light ) {
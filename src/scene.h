@@ -7,6 +7,8 @@
 #include "texture/texture_storage.h"
 #include "texture/bmp_image.h"
 #include "template_utils.h"
+#include "scene_bvh.h"
+#include "light_tree.h"
 
 #include <vector>
 #include <set>
@@ -14,6 +16,7 @@
 class SceneObject;
 class LightVolume;
 class ObjStore;
+class SamplingStrategy;
 
 /**
  * A node of the scene tree, containing objects in the scene.
@@ -56,6 +59,77 @@ public:
     // Ray will contain the closest intersection if one exists
     void traverse( Ray3D& ray) const;
 
+    /**
+     * @Return true if any object intersects the segment starting at
+     * @a origin, and extending along @a dir up to @a tMax.
+     *
+     * Stops at the first intersection found, so is cheaper than
+     * traversal when only visibility matters (e.g. shadow rays).
+     */
+    bool occluded( Point3D const& origin, Vector3D const& dir, double tMax ) const;
+
+    /**
+     * Intersect the ray with the object of this node only (not children),
+     * in world space. ASSUMPTION: ray.dir is unit length.
+     *
+     * @return true if the ray now holds an intersection with the object.
+     */
+    bool intersectObject( Ray3D& ray ) const;
+
+    /**
+     * Check whether the object of this node only (not children)
+     * intersects the segment. ASSUMPTION: dir is unit length.
+     */
+    bool occludesObject( Point3D const& origin, Vector3D const& dir,
+                         double tMax ) const;
+
+    /**
+     * Intersect the rays in the lanes @a mask of @a packet with the object
+     * of this node only, as intersectObject does for each.
+     *
+     * @return the lanes whose rays now hold an intersection with the object.
+     */
+    LaneMask intersectObject( RayPacket& packet, LaneMask mask ) const;
+
+    /**
+     * @Return the lanes of @a mask whose segments, up to @a tMax (one per
+     * lane), intersect the object of this node only.
+     */
+    LaneMask occludesObject( RayPacket const& packet, LaneMask mask,
+                             double const* tMax ) const;
+
+    /**
+     * Get an axis-aligned box around the object of this node in
+     * world space. Valid after preprocessing.
+     *
+     * @return false if the node has no object, or it provides no bound.
+     */
+    bool getWorldBound( Point3D& minPoint, Point3D& maxPoint ) const;
+
+    /**
+     * Append all nodes holding an object, within the subtree rooted
+     * at this node, to @a nodes.
+     */
+    void collectObjectNodes( std::vector< SceneDagNode const* >& nodes ) const;
+
+    /**
+     * Create a strategy for sampling the light emitted by the object of
+     * this node: the object's own if it provides one, otherwise one for
+     * the light bound. Valid after preprocessing.
+     *
+     * Ownership passes to the caller.
+     */
+    SamplingStrategy* createLightStrategy() const;
+
+    /**
+     * Get the cone of directions the object of this node emits light
+     * into, with its @a axis in world space. Valid after preprocessing.
+     *
+     * @return the cosine of the half angle of the cone, -1 if the object
+     * emits in all directions.
+     */
+    double getEmissionCone( Vector3D& axis ) const;
+
     /**
      * Preprocess this node and all children.
      *
@@ -91,6 +165,12 @@ private:
      */
     void traverseHelper( Ray3D& ray) const; 
 
+    /**
+     *  Internal helper for occlusion. ASSUMPTION: dir is unit length.
+     */
+    bool occludedHelper( Point3D const& origin, Vector3D const& dir,
+                         double tMax ) const;
+
 private:
     SceneDagNode* next; ///< points to next sibling in tree
     SceneDagNode* parent; ///< points to parent node
@@ -170,7 +250,8 @@ public:
 
 
     /**
-     * Calculate the absolute worldToModel and modelToWorld matrices for the scene.
+     * Calculate the absolute worldToModel and modelToWorld matrices for the scene,
+     * and build a hierarchy of bounding boxes around the objects.
      *
      * Please call this before rendering a frame.
      */
@@ -182,20 +263,36 @@ public:
      * The ray is transformed into the object space of each node where the
      * intersection is performed. Ray will contain the closest intersection if one exists
      */
-    void traverse( Ray3D& ray) const {
-        root_->traverse(ray);
-    }
+    void traverse( Ray3D& ray) const;
+
+    /**
+     * @Return true if any object intersects the segment starting at
+     * @a origin, and extending along @a dir up to @a tMax.
+     */
+    bool occluded( Point3D const& origin, Vector3D const& dir, double tMax ) const;
+
+    /**
+     * Find the closest intersection for the ray of every active lane
+     * of @a packet, as traverse() does for each. Coherent rays (e.g.
+     * camera rays of neighbouring samples) walk the scene together.
+     */
+    void traverse( RayPacket& packet ) const;
 
     /**
-     * Return a closure that can be used to check for intersections
-     * with objects along a ray.
+     * @Return the active lanes of @a packet whose segments, extending along
+     * their direction up to @a tMax (one per lane), intersect any object.
      */
-    Ray3D::intersection_func getIntersectionFunction() const;
+    LaneMask occluded( RayPacket const& packet, double const* tMax ) const;
 
     // iterator to iterate through emissive nodes
     emissive_iter emissive_begin() const { return emissiveNodes_.begin(); }
     emissive_iter emissive_end() const { return emissiveNodes_.end(); }
 
+    // iterator to iterate through nodes that emit light themselves
+    // (a subset of emissive nodes, without the refractive ones)
+    emissive_iter emitter_begin() const { return emitterNodes_.begin(); }
+    emissive_iter emitter_end() const { return emitterNodes_.end(); }
+
     // iterator to iterate through simple lights
     light_iter light_begin() const  { return lights_.begin(); }
     light_iter light_end() const    { return lights_.end(); }
@@ -206,6 +303,18 @@ public:
      * Used to optimize raytracing
      */
     bool hasAreaLights() const { return areaLights_; }
+
+    /**
+     * Hierarchy over the emitter nodes, built when preprocessing.
+     * Lights are referred to by their index in the emitter nodes.
+     */
+    LightTree const& emitterTree() const { return emitterTree_; }
+
+    /**
+     * Hierarchy over the simple lights, built when preprocessing.
+     * Lights are referred to by their index in the simple lights.
+     */
+    LightTree const& pointLightTree() const { return pointLightTree_; }
     
 private:
     typedef std::set<Material*>::const_iterator mat_iter;
@@ -214,6 +323,9 @@ private:
 
     SceneDagNode *root_; ///< Scene graph.
 
+    /** Hierarchy over objects in the scene graph, built when preprocessing */
+    SceneBVH bvh_;
+
     PointerMap<Image<RGBA> > images_; ///< image database
 
     PointerMap<Material> materials_; ///< material database
@@ -225,7 +337,18 @@ private:
      */
     std::vector<SceneDagNode*> emissiveNodes_;
 
+    std::vector<SceneDagNode*> emitterNodes_; ///< nodes with emitting materials
+
     bool areaLights_;
+
+    LightTree emitterTree_;    ///< many-light hierarchy over emitterNodes_
+    LightTree pointLightTree_; ///< many-light hierarchy over lights_
+
+    /**
+     * Build the many-light hierarchies, once the light bounds of the
+     * nodes are in world space.
+     */
+    void buildLightTrees();
 };
 
 #endif // _SCENE_H_
@@ -0,0 +1,471 @@
+#include "scene_bvh.h"
+#include "scene.h"
+
+#include <algorithm>
+#include <limits>
+
+namespace {
+    /**
+     * Cost of visiting a node relative to intersecting an object,
+     * used by the surface area heuristic.
+     */
+    const double traversalCost = 0.125;
+
+    double surfaceArea(double const* minPoint, double const* maxPoint) {
+        double dx = maxPoint[0] - minPoint[0];
+        double dy = maxPoint[1] - minPoint[1];
+        double dz = maxPoint[2] - minPoint[2];
+        return 2.0 * (dx*dy + dy*dz + dz*dx);
+    }
+
+    /** Grow the box given by @a minPoint and @a maxPoint to contain another */
+    void growBox(double* minPoint, double* maxPoint,
+                 double const* otherMin, double const* otherMax) {
+        for (int dim = 0; dim < 3; ++dim) {
+            minPoint[dim] = std::min(minPoint[dim], otherMin[dim]);
+            maxPoint[dim] = std::max(maxPoint[dim], otherMax[dim]);
+        }
+    }
+
+    void emptyBox(double* minPoint, double* maxPoint) {
+        const double inf = std::numeric_limits<double>::infinity();
+        std::fill_n(minPoint, 3, inf);
+        std::fill_n(maxPoint, 3, -inf);
+    }
+}
+
+SceneBVH::SceneBVH() { }
+SceneBVH::~SceneBVH() { }
+
+SceneBVH::BoxRay::BoxRay(Point3D const& o, Vector3D const& dir) {
+    for (int dim = 0; dim < 3; ++dim) {
+        origin[dim] = o[dim];
+        // division by zero gives infinities, handled when intersecting
+        invDir[dim] = 1.0 / dir[dim];
+    }
+}
+
+SceneBVH::BoxPacket::BoxPacket(RayPacket const& packet) {
+    for (int dim = 0; dim < 3; ++dim) {
+        origin[dim] = Double4::load(packet.origin[dim]);
+        invDir[dim] = Double4(1.0) / Double4::load(packet.dir[dim]);
+    }
+}
+
+void SceneBVH::clear() {
+    nodes_.clear();
+    objects_.clear();
+    unbounded_.clear();
+}
+
+void SceneBVH::build(std::vector< SceneDagNode const* > const& objects) {
+    clear();
+
+    std::vector< BuildItem > items;
+    for (SceneDagNode const* node : objects) {
+        Point3D minPoint, maxPoint;
+        if (!node->getWorldBound(minPoint, maxPoint)) {
+            unbounded_.push_back(node);
+            continue;
+        }
+
+        BuildItem item;
+        for (int dim = 0; dim < 3; ++dim) {
+            item.minPoint[dim] = minPoint[dim];
+            item.maxPoint[dim] = maxPoint[dim];
+            item.centroid[dim] = (minPoint[dim] + maxPoint[dim]) / 2.0;
+        }
+        item.node = node;
+        items.push_back(item);
+    }
+
+    if (items.empty()) {
+        return;
+    }
+
+    buildHelper(items, 0, items.size(), 0);
+}
+
+std::uint32_t SceneBVH::buildHelper(std::vector< BuildItem >& items,
+                                    size_t begin, size_t end, int depth) {
+    std::uint32_t index = nodes_.size();
+    nodes_.push_back(Node());
+
+    // find box around all items
+    Node node;
+    emptyBox(node.minPoint, node.maxPoint);
+    for (size_t i = begin; i < end; ++i) {
+        growBox(node.minPoint, node.maxPoint, items[i].minPoint, items[i].maxPoint);
+    }
+
+    // Evaluate splitting the items, ordered by their centroids, in each
+    // dimension. Sweep from the right to accumulate the boxes of the
+    // right side, and from the left to evaluate the cost of each split.
+    size_t const count = end - begin;
+    double const area = surfaceArea(node.minPoint, node.maxPoint);
+    double bestCost = std::numeric_limits<double>::infinity();
+    int bestDim = -1;
+    size_t bestSplit = 0;
+
+    std::vector< double > rightAreas(count);
+    for (int dim = 0; dim < 3 && count > 1; ++dim) {
+        std::sort(items.begin() + begin, items.begin() + end,
+            [dim](BuildItem const& a, BuildItem const& b) {
+                return a.centroid[dim] < b.centroid[dim];
+            });
+
+        double minPoint[3], maxPoint[3];
+        emptyBox(minPoint, maxPoint);
+        for (size_t i = count - 1; i > 0; --i) {
+            growBox(minPoint, maxPoint,
+                    items[begin + i].minPoint, items[begin + i].maxPoint);
+            rightAreas[i] = surfaceArea(minPoint, maxPoint);
+        }
+
+        emptyBox(minPoint, maxPoint);
+        for (size_t i = 1; i < count; ++i) {
+            growBox(minPoint, maxPoint,
+                    items[begin + i - 1].minPoint, items[begin + i - 1].maxPoint);
+            double cost = surfaceArea(minPoint, maxPoint) * i
+                        + rightAreas[i] * (count - i);
+            if (cost < bestCost) {
+                bestCost = cost;
+                bestDim = dim;
+                bestSplit = i;
+            }
+        }
+    }
+
+    // make a leaf if splitting does not pay off, or the stack would overflow
+    bool makeLeaf = count == 1 || depth >= MaxDepth - 2
+                 || traversalCost * area + bestCost >= area * count;
+    if (makeLeaf) {
+        node.offset = objects_.size();
+        node.count = count;
+        for (size_t i = begin; i < end; ++i) {
+            objects_.push_back(items[i].node);
+        }
+        nodes_[index] = node;
+        return index;
+    }
+
+    // restore the order of the best dimension, and split there
+    std::sort(items.begin() + begin, items.begin() + end,
+        [bestDim](BuildItem const& a, BuildItem const& b) {
+            return a.centroid[bestDim] < b.centroid[bestDim];
+        });
+
+    // left child directly follows
+    buildHelper(items, begin, begin + bestSplit, depth + 1);
+    node.offset = buildHelper(items, begin + bestSplit, end, depth + 1);
+    node.count = 0;
+    nodes_[index] = node;
+
+    return index;
+}
+
+bool SceneBVH::intersectBox(Node const& node, BoxRay const& ray,
+                            double tMax, double& tEntry) {
+    double tNear = 0;
+    double tFar = tMax;
+
+    for (int dim = 0; dim < 3; ++dim) {
+        double t1 = (node.minPoint[dim] - ray.origin[dim]) * ray.invDir[dim];
+        double t2 = (node.maxPoint[dim] - ray.origin[dim]) * ray.invDir[dim];
+
+        // a ray parallel to the slab, starting on its boundary, gives NaN.
+        // Treat it as inside the slab.
+        if (t1 != t1 || t2 != t2) {
+            continue;
+        }
+
+        if (t1 > t2) {
+            std::swap(t1, t2);
+        }
+
+        if (t1 > tNear) { tNear = t1; } // want largest tNear
+        if (t2 < tFar) { tFar = t2; }   // want smallest tFar
+
+        if (tNear > tFar) {
+            return false;
+        }
+    }
+
+    tEntry = tNear;
+    return true;
+}
+
+LaneMask SceneBVH::intersectBox(Node const& node, BoxPacket const& ray,
+                                Double4 const& tMax, Double4& tEntry) {
+    const double inf = std::numeric_limits<double>::infinity();
+
+    Double4 tNear(0.0);
+    Double4 tFar = tMax;
+
+    for (int dim = 0; dim < 3; ++dim) {
+        Double4 t1 = (Double4(node.minPoint[dim]) - ray.origin[dim]) * ray.invDir[dim];
+        Double4 t2 = (Double4(node.maxPoint[dim]) - ray.origin[dim]) * ray.invDir[dim];
+
+        Double4 slabNear = min(t1, t2);
+        Double4 slabFar = max(t1, t2);
+
+        // as for single rays, lanes parallel to the slab, starting on
+        // its boundary, are inside it
+        LaneMask valid = ordered(t1, t2);
+        if (valid != AllLanes) {
+            slabNear = select(valid, slabNear, Double4(-inf));
+            slabFar = select(valid, slabFar, Double4(inf));
+        }
+
+        tNear = max(slabNear, tNear);
+        tFar = min(slabFar, tFar);
+    }
+
+    tEntry = tNear;
+    return tNear <= tFar;
+}
+
+void SceneBVH::traverse( Ray3D& ray ) const {
+    for (SceneDagNode const* node : unbounded_) {
+        node->intersectObject(ray);
+    }
+
+    if (nodes_.empty()) {
+        return;
+    }
+
+    const double inf = std::numeric_limits<double>::infinity();
+    auto closest = [&ray, inf]() {
+        return ray.intersection.none ? inf : ray.intersection.t_value;
+    };
+
+    BoxRay boxRay(ray.origin, ray.dir);
+
+    // nodes still to be visited, with the distance to their boxes
+    struct StackEntry {
+        std::uint32_t node;
+        double tEntry;
+    };
+    StackEntry stack[MaxDepth];
+    int stackSize = 0;
+
+    double tEntry;
+    if (!intersectBox(nodes_[0], boxRay, closest(), tEntry)) {
+        return;
+    }
+    stack[stackSize++] = StackEntry{0, tEntry};
+
+    while (stackSize > 0) {
+        StackEntry entry = stack[--stackSize];
+
+        // quit early if a closer intersection has been found
+        // since the node was queued
+        if (entry.tEntry > closest()) {
+            continue;
+        }
+
+        Node const& node = nodes_[entry.node];
+        if (node.count > 0) {
+            for (std::uint32_t i = node.offset; i < node.offset + node.count; ++i) {
+                objects_[i]->intersectObject(ray);
+            }
+            continue;
+        }
+
+        // push the further child first, so the nearer one is visited next
+        std::uint32_t children[2] = { entry.node + 1, node.offset };
+        double tChild[2];
+        bool hit[2];
+        for (int c = 0; c < 2; ++c) {
+            hit[c] = intersectBox(nodes_[children[c]], boxRay, closest(), tChild[c]);
+        }
+
+        int nearChild = (hit[0] && (!hit[1] || tChild[0] <= tChild[1])) ? 0 : 1;
+        int farChild = 1 - nearChild;
+
+        if (hit[farChild]) {
+            stack[stackSize++] = StackEntry{children[farChild], tChild[farChild]};
+        }
+        if (hit[nearChild]) {
+            stack[stackSize++] = StackEntry{children[nearChild], tChild[nearChild]};
+        }
+    }
+}
+
+bool SceneBVH::occluded( Point3D const& origin, Vector3D const& dir,
+                         double tMax ) const {
+    for (SceneDagNode const* node : unbounded_) {
+        if (node->occludesObject(origin, dir, tMax)) {
+            return true;
+        }
+    }
+
+    if (nodes_.empty()) {
+        return false;
+    }
+
+    BoxRay boxRay(origin, dir);
+
+    // any intersection will do, so order does not matter
+    std::uint32_t stack[MaxDepth];
+    int stackSize = 0;
+    stack[stackSize++] = 0;
+
+    while (stackSize > 0) {
+        Node const& node = nodes_[stack[--stackSize]];
+
+        double tEntry;
+        if (!intersectBox(node, boxRay, tMax, tEntry)) {
+            continue;
+        }
+
+        if (node.count > 0) {
+            for (std::uint32_t i = node.offset; i < node.offset + node.count; ++i) {
+                if (objects_[i]->occludesObject(origin, dir, tMax)) {
+                    return true;
+                }
+            }
+            continue;
+        }
+
+        stack[stackSize++] = node.offset;
+        stack[stackSize++] = &node - &nodes_[0] + 1;
+    }
+
+    return false;
+}
+
+void SceneBVH::traverse( RayPacket& packet ) const {
+    for (SceneDagNode const* node : unbounded_) {
+        node->intersectObject(packet, packet.active);
+    }
+
+    if (nodes_.empty()) {
+        return;
+    }
+
+    const double inf = std::numeric_limits<double>::infinity();
+    auto closest = [&packet, inf]() {
+        double t[PacketWidth];
+        for (int lane = 0; lane < PacketWidth; ++lane) {
+            Ray3D const* ray = packet.ray[lane];
+            t[lane] = (!ray || ray->intersection.none) ? inf : ray->intersection.t_value;
+        }
+        return Double4::load(t);
+    };
+
+    BoxPacket boxPacket(packet);
+
+    // nodes still to be visited, with the lanes entering their boxes
+    // and where they enter
+    struct StackEntry {
+        std::uint32_t node;
+        LaneMask mask;
+        Double4 tEntry;
+    };
+    StackEntry stack[MaxDepth];
+    int stackSize = 0;
+
+    Double4 tEntry;
+    LaneMask lanes = packet.active & intersectBox(nodes_[0], boxPacket, closest(), tEntry);
+    if (!lanes) {
+        return;
+    }
+    stack[stackSize++] = StackEntry{0, lanes, tEntry};
+
+    while (stackSize > 0) {
+        StackEntry entry = stack[--stackSize];
+
+        // drop lanes that found a closer intersection
+        // since the node was queued
+        Double4 tClosest = closest();
+        lanes = entry.mask & (entry.tEntry <= tClosest);
+        if (!lanes) {
+            continue;
+        }
+
+        Node const& node = nodes_[entry.node];
+        if (node.count > 0) {
+            for (std::uint32_t i = node.offset; i < node.offset + node.count; ++i) {
+                objects_[i]->intersectObject(packet, lanes);
+            }
+            continue;
+        }
+
+        std::uint32_t children[2] = { entry.node + 1, node.offset };
+        Double4 tChild[2];
+        LaneMask hit[2];
+        for (int c = 0; c < 2; ++c) {
+            hit[c] = lanes & intersectBox(nodes_[children[c]], boxPacket, tClosest, tChild[c]);
+        }
+
+        // push the further child first, so the one nearer
+        // to most lanes entering both is visited next
+        LaneMask both = hit[0] & hit[1];
+        LaneMask firstNearer = both & (tChild[0] <= tChild[1]);
+        int nearChild = (hit[0] && (!hit[1]
+                    || 2 * __builtin_popcount(firstNearer) >= __builtin_popcount(both))) ? 0 : 1;
+        int farChild = 1 - nearChild;
+
+        if (hit[farChild]) {
+            stack[stackSize++] = StackEntry{children[farChild], hit[farChild], tChild[farChild]};
+        }
+        if (hit[nearChild]) {
+            stack[stackSize++] = StackEntry{children[nearChild], hit[nearChild], tChild[nearChild]};
+        }
+    }
+}
+
+LaneMask SceneBVH::occluded( RayPacket const& packet, double const* tMax ) const {
+    LaneMask blocked = 0;
+    for (SceneDagNode const* node : unbounded_) {
+        LaneMask open = packet.active & ~blocked;
+        if (open) {
+            blocked |= node->occludesObject(packet, open, tMax);
+        }
+    }
+
+    if (nodes_.empty()) {
+        return blocked;
+    }
+
+    BoxPacket boxPacket(packet);
+    Double4 tLimit = Double4::load(tMax);
+
+    // any intersection will do, so order does not matter
+    struct StackEntry {
+        std::uint32_t node;
+        LaneMask mask;
+    };
+    StackEntry stack[MaxDepth];
+    int stackSize = 0;
+    stack[stackSize++] = StackEntry{0, packet.active};
+
+    while (stackSize > 0) {
+        StackEntry entry = stack[--stackSize];
+        Node const& node = nodes_[entry.node];
+
+        Double4 tEntry;
+        LaneMask lanes = entry.mask & ~blocked;
+        if (lanes) {
+            lanes &= intersectBox(node, boxPacket, tLimit, tEntry);
+        }
+        if (!lanes) {
+            continue;
+        }
+
+        if (node.count > 0) {
+            for (std::uint32_t i = node.offset; i < node.offset + node.count && lanes; ++i) {
+                LaneMask found = objects_[i]->occludesObject(packet, lanes, tMax);
+                blocked |= found;
+                lanes &= ~found;
+            }
+            continue;
+        }
+
+        stack[stackSize++] = StackEntry{node.offset, lanes};
+        stack[stackSize++] = StackEntry{entry.node + 1, lanes};
+    }
+
+    return blocked;
+}
@@ -0,0 +1,141 @@
+#ifndef _SCENE_BVH_H_
+#define _SCENE_BVH_H_
+
+#include "math/math_types.h"
+#include "ray.h"
+#include "ray_packet.h"
+
+#include <vector>
+#include <cstdint>
+
+class SceneDagNode;
+
+/**
+ * A bounding volume hierarchy over the objects of a scene, in world space.
+ *
+ * Replaces walking every node of the scene graph for each ray: nodes are
+ * visited front to back, and any subtree whose box starts beyond the
+ * closest intersection found so far is skipped.
+ *
+ * Objects without a model-space bound are kept aside, and intersected
+ * for every ray.
+ */
+class SceneBVH {
+
+public:
+    SceneBVH();
+    ~SceneBVH();
+
+    /**
+     * Build the hierarchy over the scene graph nodes in @a objects,
+     * which must have been preprocessed.
+     */
+    void build(std::vector< SceneDagNode const* > const& objects);
+
+    /** @return whether the hierarchy holds any objects */
+    bool empty() const { return objects_.empty() && unbounded_.empty(); }
+
+    void clear();
+
+    /**
+     * Find the closest intersection along the ray, and store it in the ray.
+     * ASSUMPTION: ray.dir is unit length.
+     */
+    void traverse( Ray3D& ray ) const;
+
+    /**
+     * @Return true if any object intersects the segment starting at
+     * @a origin, extending along @a dir up to @a tMax.
+     * ASSUMPTION: dir is unit length.
+     */
+    bool occluded( Point3D const& origin, Vector3D const& dir, double tMax ) const;
+
+    /**
+     * Find the closest intersection for the ray of every active lane of
+     * @a packet, as traverse() does for each. A node is visited if any
+     * lane enters its box before its closest intersection so far.
+     * ASSUMPTION: directions are unit length.
+     */
+    void traverse( RayPacket& packet ) const;
+
+    /**
+     * @Return the active lanes of @a packet whose segments, extending along
+     * their direction up to @a tMax (one per lane), intersect any object.
+     * ASSUMPTION: directions are unit length.
+     */
+    LaneMask occluded( RayPacket const& packet, double const* tMax ) const;
+
+private:
+    /**
+     * A node of the hierarchy, stored in depth-first order.
+     * The left child of an interior node directly follows it.
+     */
+    struct Node {
+        double minPoint[3]; ///< corner of the box with smallest coordinates
+        double maxPoint[3]; ///< corner of the box with largest coordinates
+
+        /** first object of a leaf, or index of the right child */
+        std::uint32_t offset;
+        std::uint32_t count; ///< number of objects in a leaf, 0 if interior
+    };
+
+    /** An object being placed in the hierarchy */
+    struct BuildItem {
+        double minPoint[3];
+        double maxPoint[3];
+        double centroid[3];
+        SceneDagNode const* node;
+    };
+
+    /**
+     * A ray prepared for repeated box intersections
+     */
+    struct BoxRay {
+        BoxRay(Point3D const& origin, Vector3D const& dir);
+
+        double origin[3];
+        double invDir[3];
+    };
+
+    /**
+     * The lanes of a packet prepared for repeated box intersections
+     */
+    struct BoxPacket {
+        explicit BoxPacket(RayPacket const& packet);
+
+        Double4 origin[3];
+        Double4 invDir[3];
+    };
+
+    /**
+     * Recursively build the subtree over @a items in [@a begin, @a end),
+     * and @return the index of its root.
+     */
+    std::uint32_t buildHelper(std::vector< BuildItem >& items,
+                              size_t begin, size_t end, int depth);
+
+    /**
+     * Intersect the ray with the box of @a node, considering only
+     * t_values below @a tMax. On success @a tEntry is set to the
+     * t_value where the ray enters the box.
+     */
+    static bool intersectBox(Node const& node, BoxRay const& ray,
+                             double tMax, double& tEntry);
+
+    /**
+     * Intersect the lanes of @a ray with the box of @a node, each
+     * considering only t_values below its @a tMax, and @return the
+     * lanes that enter the box, at @a tEntry.
+     */
+    static LaneMask intersectBox(Node const& node, BoxPacket const& ray,
+                                 Double4 const& tMax, Double4& tEntry);
+
+    /** deepest hierarchy that can be traversed */
+    static const int MaxDepth = 64;
+
+    std::vector< Node > nodes_; ///< nodes in depth-first order, root first
+    std::vector< SceneDagNode const* > objects_; ///< objects of all leaves
+    std::vector< SceneDagNode const* > unbounded_; ///< objects outside the hierarchy
+};
+
+#endif // _SCENE_BVH_H_
@@ -4,6 +4,7 @@
 
 #include "math/math_types.h"
 #include "ray.h"
+#include "ray_packet.h"
 
 #include <cmath>
 #include <iostream>
@@ -36,6 +37,89 @@ bool SceneObject::intersect( Ray3D& ray, const AffineTrans3D& worldToModel,
     return consolidateRayInter(ray, intersection);
 }
 
+// The segment is transformed into object space. Since the transformation
+// is affine, t_values along the ray are the same in both spaces.
+bool SceneObject::occluded( Point3D const& origin, Vector3D const& dir,
+        double tMax, const AffineTrans3D& worldToModel ) const {
+    return doOccluded(worldToModel.transformPoint(origin.v),
+                      worldToModel.transformVector(dir.v),
+                      rayEpsilon, tMax);
+}
+
+bool SceneObject::doOccluded( Point3D origin, Vector3D dir,
+        double tMin, double tMax ) const {
+    Intersection intersection;
+    doIntersect(origin, dir, intersection);
+
+    return !intersection.none
+        && intersection.t_value >= tMin
+        && intersection.t_value < tMax;
+}
+
+namespace {
+    /** @return the lanes @a mask of @a packet in model space */
+    RayPacket toModel( RayPacket const& packet, LaneMask mask,
+                       AffineTrans3D const& worldToModel ) {
+        RayPacket model;
+        for (LaneMask m = mask; m; m &= m - 1) {
+            int lane = firstLane(m);
+            model.setRay(lane, worldToModel.transformPoint(packet.originOf(lane).v),
+                               worldToModel.transformVector(packet.dirOf(lane).v));
+        }
+        return model;
+    }
+}
+
+// Lanes are intersected in model space together, then consolidated
+// with their rays one at a time, as single rays are
+LaneMask SceneObject::intersect( RayPacket& packet, LaneMask mask,
+        const AffineTrans3D& worldToModel, const AffineTrans3D& modelToWorld ) const {
+    Intersection intersections[PacketWidth];
+    doIntersectPacket(toModel(packet, mask, worldToModel), mask, intersections);
+
+    LaneMask hit = 0;
+    for (LaneMask m = mask; m; m &= m - 1) {
+        int lane = firstLane(m);
+        Intersection& intersection = intersections[lane];
+
+        intersection.transform(modelToWorld, worldToModel);
+        intersection.isSolid = this->isSolid();
+        if (consolidateRayInter(*packet.ray[lane], intersection)) {
+            hit |= 1u << lane;
+        }
+    }
+
+    return hit;
+}
+
+LaneMask SceneObject::occluded( RayPacket const& packet, LaneMask mask,
+        double const* tMax, const AffineTrans3D& worldToModel ) const {
+    double tMin[PacketWidth];
+    std::fill_n(tMin, PacketWidth, rayEpsilon);
+
+    return doOccludedPacket(toModel(packet, mask, worldToModel), mask, tMin, tMax);
+}
+
+void SceneObject::doIntersectPacket( RayPacket const& packet, LaneMask mask,
+        Intersection* intersections ) const {
+    for (LaneMask m = mask; m; m &= m - 1) {
+        int lane = firstLane(m);
+        doIntersect(packet.originOf(lane), packet.dirOf(lane), intersections[lane]);
+    }
+}
+
+LaneMask SceneObject::doOccludedPacket( RayPacket const& packet, LaneMask mask,
+        double const* tMin, double const* tMax ) const {
+    LaneMask blocked = 0;
+    for (LaneMask m = mask; m; m &= m - 1) {
+        int lane = firstLane(m);
+        if (doOccluded(packet.originOf(lane), packet.dirOf(lane), tMin[lane], tMax[lane])) {
+            blocked |= 1u << lane;
+        }
+    }
+    return blocked;
+}
+
 // ==========================
 
 BoundedObject::BoundedObject(LightVolume* bound) : lightBound_(bound), bound_(bound) { }
@@ -51,6 +135,12 @@ BoundedObject::~BoundedObject() {
 
 // ==========================
 
+double UnitSquare::getEmissionCone( AffineTrans3D const& worldToModel, Vector3D& axis ) const {
+    axis = worldToModel.invTransNorm(Vector3D(0.0, 0.0, 1.0).v);
+    axis.normalize();
+    return 0.0;
+}
+
 void UnitSquare::doIntersect( Point3D origin, Vector3D dir, Intersection& intersection ) const {
 
     // if ray is parallel, no solution exists
@@ -83,14 +173,21 @@ void UnitSquare::doIntersect( Point3D origin, Vector3D dir, Intersection& inters
     intersection.normal[2] = 1.0;
 }
 
-UnitSquare::UnitSquare() : BoundedObject(new LightSphere(sqrt(2)/2.0)) { }
+UnitSquare::UnitSquare() : BoundedObject(new LightRectangle(Point3D(-0.5, -0.5, 0.0),
+                                                           Vector3D(1.0, 0.0, 0.0),
+                                                           Vector3D(0.0, 1.0, 0.0)),
+                                        new BoundingSphere(sqrt(2)/2.0)) { }
 
 // ==========================
 // UnitCube::UnitCube(): BoundedObject(new LightSphere(sqrt(3)/2.0),
 //                                     new BoundingBox(Point3D(-0.5, -0.5, -0.5) * sqrt(3),
 //                                                     Point3D(0.5, 0.5, 0.5)    * sqrt(3))) { }
 
-UnitCube::UnitCube(): BoundedObject(new LightSphere(sqrt(3)/2.0) ) { }
+UnitCube::UnitCube(): BoundedObject(new LightBox(Point3D(-0.5, -0.5, -0.5),
+                                                 {{ Vector3D(1.0, 0.0, 0.0),
+                                                    Vector3D(0.0, 1.0, 0.0),
+                                                    Vector3D(0.0, 0.0, 1.0) }}),
+                                    new BoundingSphere(sqrt(3)/2.0) ) { }
 
 void UnitCube::doIntersect( Point3D origin,
                       Vector3D dir,
@@ -2,13 +2,16 @@
 #define _SCENE_OBJECT_H_
 
 #include "math/math_types.h"
+#include "simd.h"
 
 
 class Intersection;
 class Ray3D;
 class BoundingVolume;
 class LightVolume;
+class SamplingStrategy;
 class UVMap;
+struct RayPacket;
 
 /**
  * All primitives should provide an intersection function.  
@@ -25,9 +28,65 @@ public:
      */
     bool intersect( Ray3D&, const AffineTrans3D&, const AffineTrans3D& ) const;
 
+    /**
+     * @Return true if the object intersects the segment starting at
+     * @a origin and extending along @a dir up to @a tMax, given in
+     * world space. Stops at the first intersection found.
+     */
+    bool occluded( Point3D const& origin, Vector3D const& dir, double tMax,
+                   const AffineTrans3D& worldToModel ) const;
+
+    /**
+     * Intersect the rays in the lanes @a mask of @a packet, as intersect()
+     * does for each. @Return the lanes whose rays now hold an intersection
+     * with the object.
+     */
+    LaneMask intersect( RayPacket& packet, LaneMask mask,
+                        const AffineTrans3D& worldToModel,
+                        const AffineTrans3D& modelToWorld ) const;
+
+    /**
+     * @Return the lanes of @a mask whose segments, extending along their
+     * direction up to @a tMax (one per lane), intersect the object.
+     */
+    LaneMask occluded( RayPacket const& packet, LaneMask mask, double const* tMax,
+                       const AffineTrans3D& worldToModel ) const;
+
     virtual BoundingVolume* getBoundingVolume() const { return nullptr; }
     virtual LightVolume*    getLightVolume()    const { return nullptr; }
 
+    /**
+     * Create a strategy for sampling directions towards the object when
+     * it emits light, as placed by @a modelToWorld (and its inverse
+     * @a worldToModel). Ownership passes to the caller.
+     *
+     * @return nullptr to sample the light volume instead.
+     */
+    virtual SamplingStrategy* createLightStrategy( AffineTrans3D const& modelToWorld,
+                                                   AffineTrans3D const& worldToModel ) const {
+        return nullptr;
+    }
+
+    /**
+     * Get the cone of directions the object emits light into, as placed
+     * by @a worldToModel, storing its world space @a axis.
+     *
+     * @return the cosine of the half angle of the cone, -1 if the object
+     * emits in all directions.
+     */
+    virtual double getEmissionCone( AffineTrans3D const& worldToModel, Vector3D& axis ) const {
+        return -1.0;
+    }
+
+    /**
+     * Get an axis-aligned box around the object in model space.
+     *
+     * @return false if the object is unbounded, or provides no box.
+     */
+    virtual bool getModelBound( Point3D& minPoint, Point3D& maxPoint ) const {
+        return false;
+    }
+
     /**
      * @return whether the object has any volume (when considering transmission)
      */
@@ -45,6 +104,32 @@ private:
     virtual void doIntersect( Point3D origin,
                               Vector3D dir,
                               Intersection& intersection ) const = 0;
+
+    /**
+     * Private method that operates strictly in model space.
+     *
+     * @Return whether any intersection exists with a t_value between
+     * @a tMin and @a tMax. Defaults to finding the closest intersection,
+     * objects that can stop at any intersection should override this.
+     */
+    virtual bool doOccluded( Point3D origin,
+                             Vector3D dir,
+                             double tMin, double tMax ) const;
+
+    /**
+     * Model space intersection of the lanes @a mask of @a packet, one
+     * Intersection per lane. Defaults to intersecting each lane alone,
+     * objects that can trace lanes together should override this.
+     */
+    virtual void doIntersectPacket( RayPacket const& packet, LaneMask mask,
+                                    Intersection* intersections ) const;
+
+    /**
+     * Model space occlusion of the lanes @a mask of @a packet, with
+     * @a tMin and @a tMax per lane. Defaults to testing each lane alone.
+     */
+    virtual LaneMask doOccludedPacket( RayPacket const& packet, LaneMask mask,
+                                       double const* tMin, double const* tMax ) const;
 };
 
 /**
@@ -76,6 +161,18 @@ public:
     UnitSquare();
     bool isSolid() const { return false; }
 
+    bool getModelBound( Point3D& minPoint, Point3D& maxPoint ) const {
+        minPoint = Point3D(-0.5, -0.5, 0.0);
+        maxPoint = Point3D(0.5, 0.5, 0.0);
+        return true;
+    }
+
+    /**
+     * Only the +z side can be intersected, so light leaves the square
+     * over the hemisphere around its normal.
+     */
+    double getEmissionCone( AffineTrans3D const& worldToModel, Vector3D& axis ) const;
+
 private:
     void doIntersect( Point3D origin,
                       Vector3D dir,
@@ -91,6 +188,12 @@ public:
     UnitCube();
     bool isSolid() const { return true; }
 
+    bool getModelBound( Point3D& minPoint, Point3D& maxPoint ) const {
+        minPoint = Point3D(-0.5, -0.5, -0.5);
+        maxPoint = Point3D(0.5, 0.5, 0.5);
+        return true;
+    }
+
 private:
     void doIntersect( Point3D origin,
                       Vector3D dir,
@@ -106,6 +209,12 @@ public:
 
     bool isSolid() const { return true; }
 
+    bool getModelBound( Point3D& minPoint, Point3D& maxPoint ) const {
+        minPoint = Point3D(-1.0, -1.0, -1.0);
+        maxPoint = Point3D(1.0, 1.0, 1.0);
+        return true;
+    }
+
 private:
     void doIntersect( Point3D origin,
                       Vector3D dir,
@@ -0,0 +1,34 @@
+#include "scratch_arena.h"
+
+#include <algorithm>
+#include <cstdint>
+
+ScratchArena::ScratchArena(std::size_t blockSize)
+    : current_(0),
+      offset_(0),
+      blockSize_(blockSize) { }
+
+ScratchArena::~ScratchArena() { }
+
+void* ScratchArena::allocate(std::size_t bytes, std::size_t alignment) {
+    for (;;) {
+        // blocks are only added the first time they are needed
+        if (current_ == blocks_.size()) {
+            blocks_.push_back(Block(std::max(blockSize_, bytes + alignment)));
+        }
+
+        Block& block = blocks_[current_];
+        std::uintptr_t base = reinterpret_cast<std::uintptr_t>(block.data.get());
+        std::uintptr_t start = (base + offset_ + alignment - 1) & ~std::uintptr_t(alignment - 1);
+        std::size_t end = (start - base) + bytes;
+
+        if (end <= block.size) {
+            offset_ = end;
+            return block.data.get() + (start - base);
+        }
+
+        // does not fit, continue in the next block
+        ++current_;
+        offset_ = 0;
+    }
+}
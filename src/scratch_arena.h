@@ -0,0 +1,152 @@
+#ifndef _SCRATCH_ARENA_H_
+#define _SCRATCH_ARENA_H_
+
+#include <vector>
+#include <algorithm>
+#include <memory>
+#include <new>
+#include <cstddef>
+#include <cassert>
+#include <type_traits>
+
+/**
+ * Bump allocator for short lived memory of a single thread, e.g. the
+ * per hit state of the shading of a camera sample.
+ *
+ * Memory is handed out from large blocks, and released all at once,
+ * back to a mark or completely. Blocks are kept for reuse, so once they
+ * have grown to what rendering needs, no more heap allocations happen.
+ */
+class ScratchArena {
+
+public:
+    /**
+     * Position of the arena, to release memory back to
+     */
+    struct Marker {
+        std::size_t block;
+        std::size_t offset;
+    };
+
+    /**
+     * Releases the memory allocated within its lifetime on destruction
+     */
+    class Scope {
+    public:
+        explicit Scope(ScratchArena& arena) : arena_(arena), mark_(arena.mark()) { }
+        ~Scope() { arena_.release(mark_); }
+
+    private:
+        Scope(Scope const&);
+        Scope& operator =(Scope const&);
+
+        ScratchArena& arena_;
+        Marker mark_;
+    };
+
+    explicit ScratchArena(std::size_t blockSize = 64 * 1024);
+    ~ScratchArena();
+
+    /**
+     * @return uninitialized memory of @a bytes, aligned to @a alignment
+     * (a power of two), valid until released
+     */
+    void* allocate(std::size_t bytes, std::size_t alignment);
+
+    /**
+     * @return uninitialized memory for @a n objects of type T
+     */
+    template<typename T>
+    T* allocate(std::size_t n) {
+        return static_cast<T*>(allocate(n * sizeof(T), std::alignment_of<T>::value));
+    }
+
+    Marker mark() const {
+        Marker m = { current_, offset_ };
+        return m;
+    }
+
+    /** release all memory allocated since @a m was taken */
+    void release(Marker const& m) {
+        current_ = m.block;
+        offset_ = m.offset;
+    }
+
+    /** release all memory */
+    void reset() {
+        current_ = 0;
+        offset_ = 0;
+    }
+
+private:
+    ScratchArena(ScratchArena const&);
+    ScratchArena& operator =(ScratchArena const&);
+
+    struct Block {
+        explicit Block(std::size_t size) : data(new char[size]), size(size) { }
+
+        std::unique_ptr<char[]> data;
+        std::size_t size;
+    };
+
+    std::vector<Block> blocks_;
+    std::size_t current_;   ///< block allocations are taken from
+    std::size_t offset_;    ///< first free byte of the current block
+    std::size_t blockSize_; ///< size of new blocks, unless a larger one is needed
+};
+
+/**
+ * Array with a fixed capacity, living in a ScratchArena.
+ *
+ * Only valid until the memory of the arena it was created in is released.
+ */
+template<typename T>
+class ScratchArray {
+
+public:
+    typedef T const* const_iterator;
+
+    ScratchArray(ScratchArena& arena, std::size_t capacity)
+        : data_(arena.allocate<T>(capacity)), size_(0), capacity_(capacity) { }
+
+    ~ScratchArray() {
+        clear();
+    }
+
+    /** ASSUMPTION: the array is not full */
+    void push_back(T const& value) {
+        assert(size_ < capacity_);
+        new (data_ + size_) T(value);
+        ++size_;
+    }
+
+    /** remove the elements past the first @a size */
+    void truncate(std::size_t size) {
+        for (std::size_t i = size; i < size_; ++i) {
+            data_[i].~T();
+        }
+        size_ = std::min(size, size_);
+    }
+
+    void clear() { truncate(0); }
+
+    std::size_t size() const { return size_; }
+    std::size_t capacity() const { return capacity_; }
+    bool empty() const { return size_ == 0; }
+
+    T& operator [](std::size_t i) { return data_[i]; }
+    T const& operator [](std::size_t i) const { return data_[i]; }
+
+    const_iterator begin() const { return data_; }
+    const_iterator end() const { return data_ + size_; }
+
+private:
+    ScratchArray(ScratchArray const&);
+    ScratchArray& operator =(ScratchArray const&);
+
+    T* data_;
+    std::size_t size_;
+    std::size_t capacity_;
+};
+
+#endif // _SCRATCH_ARENA_H_
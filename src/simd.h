@@ -0,0 +1,183 @@
+#ifndef _SIMD_H_
+#define _SIMD_H_
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include <algorithm>
+
+/** Number of lanes in a packet of rays */
+const int PacketWidth = 4;
+
+/** Set of lanes of a packet, lane i being bit i */
+typedef unsigned int LaneMask;
+
+/** All lanes of a packet */
+const LaneMask AllLanes = (1u << PacketWidth) - 1;
+
+/** @return the index of the lowest lane in @a mask, which must not be empty */
+inline int firstLane(LaneMask mask) { return __builtin_ctz(mask); }
+
+/**
+ * Four doubles, one per lane of a packet, operated on together.
+ *
+ * Uses a single AVX register when compiled with AVX enabled (e.g. -mavx2
+ * in SIMD_FLAGS of the Makefile), two SSE2 registers otherwise, and
+ * plain loops on other architectures.
+ */
+struct Double4 {
+    Double4() { }
+    explicit Double4(double x) {
+#if defined(__AVX__)
+        v = _mm256_set1_pd(x);
+#elif defined(__SSE2__)
+        lo = hi = _mm_set1_pd(x);
+#else
+        std::fill_n(v, 4, x);
+#endif
+    }
+
+    /** Load from 4 doubles at @a p, which need not be aligned */
+    static Double4 load(double const* p) {
+        Double4 r;
+#if defined(__AVX__)
+        r.v = _mm256_loadu_pd(p);
+#elif defined(__SSE2__)
+        r.lo = _mm_loadu_pd(p);
+        r.hi = _mm_loadu_pd(p + 2);
+#else
+        std::copy(p, p + 4, r.v);
+#endif
+        return r;
+    }
+
+    void store(double* p) const {
+#if defined(__AVX__)
+        _mm256_storeu_pd(p, v);
+#elif defined(__SSE2__)
+        _mm_storeu_pd(p, lo);
+        _mm_storeu_pd(p + 2, hi);
+#else
+        std::copy(v, v + 4, p);
+#endif
+    }
+
+#if defined(__AVX__)
+    __m256d v;
+#elif defined(__SSE2__)
+    __m128d lo, hi;
+#else
+    double v[4];
+#endif
+};
+
+#if defined(__AVX__)
+
+#define QND_DOUBLE4_OP(name, expr) \
+    inline Double4 name(Double4 const& a, Double4 const& b) { \
+        Double4 r; r.v = expr(a.v, b.v); return r; }
+
+QND_DOUBLE4_OP(operator +, _mm256_add_pd)
+QND_DOUBLE4_OP(operator -, _mm256_sub_pd)
+QND_DOUBLE4_OP(operator *, _mm256_mul_pd)
+QND_DOUBLE4_OP(operator /, _mm256_div_pd)
+QND_DOUBLE4_OP(min, _mm256_min_pd)
+QND_DOUBLE4_OP(max, _mm256_max_pd)
+
+inline LaneMask operator <(Double4 const& a, Double4 const& b) {
+    return _mm256_movemask_pd(_mm256_cmp_pd(a.v, b.v, _CMP_LT_OQ));
+}
+
+inline LaneMask operator <=(Double4 const& a, Double4 const& b) {
+    return _mm256_movemask_pd(_mm256_cmp_pd(a.v, b.v, _CMP_LE_OQ));
+}
+
+/** @return the lanes where neither @a a nor @a b is NaN */
+inline LaneMask ordered(Double4 const& a, Double4 const& b) {
+    return _mm256_movemask_pd(_mm256_cmp_pd(a.v, b.v, _CMP_ORD_Q));
+}
+
+#elif defined(__SSE2__)
+
+#define QND_DOUBLE4_OP(name, expr) \
+    inline Double4 name(Double4 const& a, Double4 const& b) { \
+        Double4 r; r.lo = expr(a.lo, b.lo); r.hi = expr(a.hi, b.hi); return r; }
+
+QND_DOUBLE4_OP(operator +, _mm_add_pd)
+QND_DOUBLE4_OP(operator -, _mm_sub_pd)
+QND_DOUBLE4_OP(operator *, _mm_mul_pd)
+QND_DOUBLE4_OP(operator /, _mm_div_pd)
+QND_DOUBLE4_OP(min, _mm_min_pd)
+QND_DOUBLE4_OP(max, _mm_max_pd)
+
+inline LaneMask operator <(Double4 const& a, Double4 const& b) {
+    return _mm_movemask_pd(_mm_cmplt_pd(a.lo, b.lo))
+         | _mm_movemask_pd(_mm_cmplt_pd(a.hi, b.hi)) << 2;
+}
+
+inline LaneMask operator <=(Double4 const& a, Double4 const& b) {
+    return _mm_movemask_pd(_mm_cmple_pd(a.lo, b.lo))
+         | _mm_movemask_pd(_mm_cmple_pd(a.hi, b.hi)) << 2;
+}
+
+/** @return the lanes where neither @a a nor @a b is NaN */
+inline LaneMask ordered(Double4 const& a, Double4 const& b) {
+    return _mm_movemask_pd(_mm_cmpord_pd(a.lo, b.lo))
+         | _mm_movemask_pd(_mm_cmpord_pd(a.hi, b.hi)) << 2;
+}
+
+#else
+
+// min and max return the second operand if either is NaN, like the
+// SSE and AVX instructions
+#define QND_DOUBLE4_OP(name, expr) \
+    inline Double4 name(Double4 const& a, Double4 const& b) { \
+        Double4 r; \
+        for (int i = 0; i < 4; ++i) { double x = a.v[i], y = b.v[i]; r.v[i] = (expr); } \
+        return r; }
+
+QND_DOUBLE4_OP(operator +, x + y)
+QND_DOUBLE4_OP(operator -, x - y)
+QND_DOUBLE4_OP(operator *, x * y)
+QND_DOUBLE4_OP(operator /, x / y)
+QND_DOUBLE4_OP(min, x < y ? x : y)
+QND_DOUBLE4_OP(max, x > y ? x : y)
+
+inline LaneMask operator <(Double4 const& a, Double4 const& b) {
+    LaneMask m = 0;
+    for (int i = 0; i < 4; ++i) { m |= LaneMask(a.v[i] < b.v[i]) << i; }
+    return m;
+}
+
+inline LaneMask operator <=(Double4 const& a, Double4 const& b) {
+    LaneMask m = 0;
+    for (int i = 0; i < 4; ++i) { m |= LaneMask(a.v[i] <= b.v[i]) << i; }
+    return m;
+}
+
+/** @return the lanes where neither @a a nor @a b is NaN */
+inline LaneMask ordered(Double4 const& a, Double4 const& b) {
+    LaneMask m = 0;
+    for (int i = 0; i < 4; ++i) { m |= LaneMask(a.v[i] == a.v[i] && b.v[i] == b.v[i]) << i; }
+    return m;
+}
+
+#endif
+
+#undef QND_DOUBLE4_OP
+
+/** @return @a a in the lanes of @a mask, @a b in the others */
+inline Double4 select(LaneMask mask, Double4 const& a, Double4 const& b) {
+    double x[4], y[4];
+    a.store(x);
+    b.store(y);
+    for (int i = 0; i < 4; ++i) {
+        if (!(mask & (1u << i))) { x[i] = y[i]; }
+    }
+    return Double4::load(x);
+}
+
+#endif // _SIMD_H_
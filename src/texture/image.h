@@ -45,11 +45,9 @@ public:
      * Copy another image's data into this image.
      */
     Image(SelfType const& other) : width_(other.width_),
-                                   height_(other.height_) {
+                                   height_(other.height_),
+                                   pixels_(new PixelType[other.width_*other.height_]) {
 
-        delete[] pixels_; // TODO: use a RAII class for array
-        pixels_ = new PixelType[width_*height_];
-                                       
         // copy pixels
         std::copy(other.pixels_, other.pixels_ + width_*height_, pixels_);
     }
@@ -67,6 +65,7 @@ public:
 
         // copy pixels
         std::copy(other.pixels_, other.pixels_ + width_*height_, pixels_);
+        return *this;
     }
 
     /**
@@ -89,6 +88,7 @@ public:
         height_ = other.height_;
         pixels_ = other.pixels_;
         other.invalidate();
+        return *this;
     }
 
     /** @Return whether this image is valid */
@@ -120,11 +120,19 @@ ImageType readImageFromFile(std::ifstream& file) {
     
     // read header
     readFromStream(file, header);
+    if ( !file ) {
+        std::cerr << "Image read error" << std::endl;
+        std::cerr << "The file is too short to hold an image header." << std::endl;
+        return ImageType();
+    }
 
-    // check that pixel byte size matches
+    // check that pixel byte size matches. This also rejects files written
+    // with an older layout of the pixel type.
     if (header.pixelSize != sizeof(typename ImageType::pixel_type) ) {
         std::cerr << "Image read error" << std::endl;
-        std::cerr << "Pixel size mismatch. Pixel byte size in the file header differs from image type's pixel size." << std::endl;
+        std::cerr << "Pixel size mismatch. Pixel byte size in the file header ("
+                  << header.pixelSize << ") differs from image type's pixel size ("
+                  << sizeof(typename ImageType::pixel_type) << ")." << std::endl;
         return ImageType();
     }
 
@@ -136,6 +144,12 @@ ImageType readImageFromFile(std::ifstream& file) {
         readFromStream(file, *it);
     }
 
+    if ( !file ) {
+        std::cerr << "Image read error" << std::endl;
+        std::cerr << "The file holds fewer pixels than its header claims." << std::endl;
+        return ImageType();
+    }
+
     return image;
 }
 
@@ -46,19 +46,6 @@ struct Material {
     }
     Colour absorption; ///< absorption coefficient
 
-    /**
-     * A BRDF based on the phong reflectance model
-     * returns a ratio of incoming to outgoing radiance for each RGB component.
-     * Both incoming and outgoing vectors have to face away from the surface,
-     * and be unit length
-     *
-     * TODO: make an assignable closure to use different BRDFs?
-     */
-    Colour phongBRDF(Vector3D const& incoming,
-                     Vector3D const& outgoing,
-                     Vector3D const& normal,
-                     UVPoint uv) const;
-
     /** determines whether the object can transmit (refract etc.) light */
     bool isTransmissive;
 
@@ -5,20 +5,41 @@
 #include "../colour.h"
 #include "rgba_converter.hpp"
 
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
 /**
  * A structure that stores an accumulated Colour and
  * the number of sample taken.
+ *
+ * Also accumulates the squared brightness of the samples, to estimate
+ * how far the pixel is from converging.
+ *
+ * Raw sensor dumps (.rsd) store the pixels as they are in memory, and
+ * readImageFromFile refuses files whose pixel size differs. Keep the
+ * size changing along with the layout, so older dumps are not misread.
  */
 struct SensorPixel {
-    SensorPixel() : col(), samples(0) { }
+    SensorPixel() : col(), samples(0), reserved(0), brightnessSquared(0.0) { }
     Colour col;
     unsigned int samples;
 
+    /**
+     * Fills what would otherwise be uninitialized padding, so raw dumps
+     * of identical sensors are identical files.
+     */
+    unsigned int reserved;
+
+    double brightnessSquared; ///< sum of the squared brightness of all samples
+
     /**
      * Add a sample of color to the sensor pixel
      */
     SensorPixel& operator +=(Colour const& other) {
         col += other;
+        double b = brightness(other);
+        brightnessSquared += b*b;
         // increment sample count
         samples++;
         return *this;
@@ -29,11 +50,33 @@ struct SensorPixel {
      */
     SensorPixel& operator +=(SensorPixel const& other) {
         col += other.col;
+        brightnessSquared += other.brightnessSquared;
         // sum number of samples
         samples += other.samples;
         return *this;
     }
 
+    /**
+     * Estimate the relative error of the pixel's brightness: the
+     * standard error of the mean over the mean itself. Dark pixels are
+     * judged against a brightness of at least 1%, since the eye does not
+     * notice relative noise there.
+     *
+     * Returns infinity while there are too few samples to tell.
+     */
+    double relativeError() const {
+        if (samples < 2) { return std::numeric_limits<double>::infinity(); }
+
+        double mean = brightness(col) / samples;
+        double variance = (brightnessSquared / samples - mean*mean)
+                          * samples / (samples - 1);
+
+        // rounding can make the estimate slightly negative
+        double standardError = std::sqrt(std::max(variance, 0.0) / samples);
+
+        return standardError / std::max(mean, 0.01);
+    }
+
     /**
      * Returns final colour based on number of samples and
      * accumulated Colour.
@@ -44,8 +87,16 @@ struct SensorPixel {
         return col / double(samples);
     }
 
+    static double brightness(Colour const& c) {
+        return (c[0] + c[1] + c[2]) / 3.0;
+    }
+
 };
 
+// dumps from before brightnessSquared held just the colour and sample count
+static_assert(sizeof(SensorPixel) != sizeof(Colour) + sizeof(double),
+              "raw dumps of older sensor pixels must be told apart by size");
+
 /**
  * Combine the samples gathered on two sensors.
  *
@@ -0,0 +1,239 @@
+#include "tile_scheduler.h"
+#include "camera.h"
+#include "scratch_arena.h"
+
+#include <omp.h>
+#include <algorithm>
+#include <numeric>
+
+TileScheduler::TileScheduler() : tileSize_(32),
+                                 camera_(nullptr),
+                                 height_(0),
+                                 width_(0),
+                                 numQueues_(0),
+                                 dealt_(0),
+                                 completed_(0) { }
+
+TileScheduler::~TileScheduler() { }
+
+void TileScheduler::setTileSize(int size) {
+    if (size > 0) {
+        tileSize_ = size;
+    }
+}
+
+void TileScheduler::createTiles(int height, int width) {
+    tiles_.clear();
+
+    for (int i = 0; i < height; i += tileSize_) {
+        for (int j = 0; j < width; j += tileSize_) {
+            tiles_.push_back(Tile(i, std::min(i + tileSize_, height),
+                                  j, std::min(j + tileSize_, width)));
+        }
+    }
+
+    height_ = height;
+    width_ = width;
+}
+
+void TileScheduler::estimateCosts(Camera const& cam) {
+    // probe a few points in each tile, and use the time it takes to shade
+    // them as an estimate of how expensive the whole tile is
+    const int numTiles = tiles_.size();
+
+    #pragma omp parallel
+    {
+        ScratchArena scratch;
+
+        #pragma omp for schedule(dynamic)
+        for (int t = 0; t < numTiles; ++t) {
+            Tile& tile = tiles_[t];
+            int iMid = (tile.iStart + tile.iEnd) / 2;
+            int jMid = (tile.jStart + tile.jEnd) / 2;
+            int iProbes[] = { (tile.iStart + iMid) / 2, (iMid + tile.iEnd) / 2 };
+            int jProbes[] = { (tile.jStart + jMid) / 2, (jMid + tile.jEnd) / 2 };
+
+            double start = omp_get_wtime();
+            for (int i : iProbes) {
+                for (int j : jProbes) {
+                    cam.probePixel(i, j, scratch);
+                }
+            }
+
+            // scale up to the number of pixels in the tile
+            tile.cost = (omp_get_wtime() - start) * tile.pixels() / 4.0;
+        }
+    }
+}
+
+void TileScheduler::prepare(Camera const& cam, int numThreads) {
+
+    // reuse tiles (and their timings) if the layout is unchanged
+    bool sameLayout = !tiles_.empty()
+                      && camera_ == &cam
+                      && height_ == cam.height()
+                      && width_ == cam.width()
+                      && tiles_[0].iEnd == std::min(tileSize_, height_)
+                      && tiles_[0].jEnd == std::min(tileSize_, width_);
+
+    if (sameLayout) {
+        // timings of the previous pass are the best estimate we have
+        for (Tile& tile : tiles_) {
+            tile.cost = tile.time;
+        }
+    }
+    else {
+        camera_ = &cam;
+        createTiles(cam.height(), cam.width());
+        estimateCosts(cam);
+    }
+
+    for (Tile& tile : tiles_) {
+        tile.time = 0;
+    }
+
+    std::vector<int> order(tiles_.size());
+    std::iota(order.begin(), order.end(), 0);
+    deal(order, numThreads);
+}
+
+int TileScheduler::refine(Camera const& cam, int numThreads, double threshold) {
+    const int numTiles = tiles_.size();
+
+    #pragma omp parallel for schedule(dynamic)
+    for (int t = 0; t < numTiles; ++t) {
+        Tile& tile = tiles_[t];
+        tile.error = cam.areaError(tile.iStart, tile.iEnd, tile.jStart, tile.jEnd);
+    }
+
+    // only tiles that have not converged are rendered again. The time
+    // they took in the last pass is the estimate of their cost.
+    std::vector<int> order;
+    for (int t = 0; t < numTiles; ++t) {
+        Tile& tile = tiles_[t];
+        tile.cost = tile.time;
+
+        if (tile.error > threshold) {
+            tile.time = 0;
+            order.push_back(t);
+        }
+    }
+
+    deal(order, numThreads);
+    return order.size();
+}
+
+void TileScheduler::deal(std::vector<int> order, int numThreads) {
+    // order tiles from most to least expensive
+    std::stable_sort(order.begin(), order.end(),
+                     [this](int a, int b) { return tiles_[a].cost > tiles_[b].cost; });
+
+    // deal the tiles round-robin, so every queue starts with hot tiles
+    numQueues_ = std::max(numThreads, 1);
+    queues_.reset(new WorkQueue[numQueues_]);
+    for (unsigned int k = 0; k < order.size(); ++k) {
+        queues_[k % numQueues_].tiles.push_back(order[k]);
+    }
+
+    dealt_ = order.size();
+    completed_ = 0;
+}
+
+bool TileScheduler::popFront(WorkQueue& queue, int& tile) {
+    std::lock_guard<std::mutex> guard(queue.lock);
+    if (queue.tiles.empty()) {
+        return false;
+    }
+
+    tile = queue.tiles.front();
+    queue.tiles.pop_front();
+    return true;
+}
+
+bool TileScheduler::popBack(WorkQueue& queue, int& tile) {
+    std::lock_guard<std::mutex> guard(queue.lock);
+    if (queue.tiles.empty()) {
+        return false;
+    }
+
+    tile = queue.tiles.back();
+    queue.tiles.pop_back();
+    return true;
+}
+
+bool TileScheduler::next(int thread, int& tile) {
+    WorkQueue& own = queues_[thread % numQueues_];
+
+    // own work is taken hottest first
+    if (popFront(own, tile)) {
+        return true;
+    }
+
+    // otherwise steal from the cold end of the other queues
+    for (int k = 1; k < numQueues_; ++k) {
+        if (popBack(queues_[(thread + k) % numQueues_], tile)) {
+            own.steals++;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void TileScheduler::render(Camera const& cam, int tile, ScratchArena& scratch) {
+    Tile& t = tiles_[tile];
+
+    double start = omp_get_wtime();
+    cam.computeArea(t.iStart, t.iEnd, t.jStart, t.jEnd, scratch);
+    t.time = omp_get_wtime() - start;
+
+    #pragma omp atomic
+    completed_++;
+}
+
+double TileScheduler::progress() const {
+    if (dealt_ == 0) {
+        return 1.0;
+    }
+
+    int completed;
+    #pragma omp atomic read
+    completed = completed_;
+
+    return double(completed) / dealt_;
+}
+
+void TileScheduler::report(std::ostream& out, bool perTile) const {
+    if (tiles_.empty()) {
+        return;
+    }
+
+    std::vector<double> times;
+    for (Tile const& tile : tiles_) {
+        times.push_back(tile.time);
+    }
+    std::sort(times.begin(), times.end());
+
+    double total = std::accumulate(times.begin(), times.end(), 0.0);
+    unsigned int steals = 0;
+    for (int q = 0; q < numQueues_; ++q) {
+        steals += queues_[q].steals;
+    }
+
+    out << "Tiles: " << tiles_.size()
+        << " (" << tileSize_ << "x" << tileSize_ << ")"
+        << " total: " << total << "s"
+        << " min: " << times.front() << "s"
+        << " median: " << times[times.size()/2] << "s"
+        << " max: " << times.back() << "s"
+        << " steals: " << steals
+        << std::endl;
+
+    if (perTile) {
+        for (Tile const& tile : tiles_) {
+            out << "tile [" << tile.iStart << "," << tile.iEnd << ")x["
+                << tile.jStart << "," << tile.jEnd << ") "
+                << tile.time << "s" << std::endl;
+        }
+    }
+}
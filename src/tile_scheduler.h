@@ -0,0 +1,151 @@
+#ifndef _TILE_SCHEDULER_H_
+#define _TILE_SCHEDULER_H_
+
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <memory>
+#include <ostream>
+
+class Camera;
+class ScratchArena;
+
+/**
+ * A square (or clipped at the image border) area of the sensor,
+ * rendered as a single unit of work.
+ */
+struct Tile {
+    Tile(int iStart, int iEnd, int jStart, int jEnd)
+        : iStart(iStart), iEnd(iEnd), jStart(jStart), jEnd(jEnd),
+          cost(0), time(0), error(0) { }
+
+    // bounds of the tile in the form accepted by Camera::computeArea
+    int iStart;
+    int iEnd;
+    int jStart;
+    int jEnd;
+
+    double cost; ///< estimated cost of the tile, used for ordering
+    double time; ///< seconds spent rendering the tile during the last pass it was in
+    double error; ///< largest relative error of its pixels, measured by refine()
+
+    int pixels() const { return (iEnd - iStart)*(jEnd - jStart); }
+};
+
+/**
+ * Splits a camera's sensor into tiles and hands them out to threads.
+ *
+ * Each thread owns a queue of tiles, dealt out so that the most expensive
+ * tiles are rendered first. Once a thread runs out of its own work it steals
+ * from the back of the other queues, so no thread sits idle while expensive
+ * tiles remain. Tile timings from a pass are kept and used as the cost
+ * estimate for the following pass over the same sensor.
+ *
+ * Usage:
+ *   scheduler.prepare(cam, numThreads);   // once, outside parallel region
+ *   while (scheduler.next(thread, tile))  // inside, per thread
+ *       scheduler.render(cam, tile);
+ */
+class TileScheduler {
+
+public:
+    TileScheduler();
+    ~TileScheduler();
+
+    /**
+     * Set the side length of tiles in pixels.
+     * Takes effect the next time tiles are created.
+     */
+    void setTileSize(int size);
+    int tileSize() const { return tileSize_; }
+
+    /**
+     * Split the sensor of @a cam into tiles (unless tiles of the
+     * same layout already exist), estimate their cost, and deal
+     * them out to @a numThreads queues, most expensive first.
+     *
+     * If no timings exist from a previous pass, the cost is estimated
+     * by tracing a few probe rays through each tile.
+     */
+    void prepare(Camera const& cam, int numThreads);
+
+    /**
+     * Prepare another pass over the tiles of the last pass, only dealing
+     * out those whose pixels have not converged yet, i.e. where the
+     * largest relative error of a pixel is above @a threshold.
+     *
+     * Must be called after a pass over the sensor of @a cam.
+     *
+     * @return number of tiles dealt out. If 0, the image has converged.
+     */
+    int refine(Camera const& cam, int numThreads, double threshold);
+
+    /**
+     * Fetch the next tile for @a thread to render.
+     * Takes from the thread's own queue, and steals from others
+     * once the own queue is empty.
+     *
+     * @return false once there is no work left.
+     */
+    bool next(int thread, int& tile);
+
+    /**
+     * Render tile @a tile on the sensor of @a cam, recording its timing.
+     * Shading takes its temporary memory from @a scratch, which belongs
+     * to the calling thread.
+     */
+    void render(Camera const& cam, int tile, ScratchArena& scratch);
+
+    /**
+     * Fraction of the tiles dealt out for the current pass that
+     * have been rendered.
+     */
+    double progress() const;
+
+    /**
+     * Print a summary of the tile timings of the last pass to @a out.
+     * If @a perTile is set, the time for every tile is listed too.
+     */
+    void report(std::ostream& out, bool perTile) const;
+
+    std::vector<Tile> const& tiles() const { return tiles_; }
+
+private:
+    /**
+     * Queue of tile indices belonging to a thread.
+     * Padded so locks of neighbouring queues do not share a cache line.
+     */
+    struct WorkQueue {
+        std::mutex lock;
+        std::deque<int> tiles;
+        unsigned int steals = 0; ///< number of tiles this thread stole
+        char padding[64];
+    };
+
+    void createTiles(int height, int width);
+    void estimateCosts(Camera const& cam);
+
+    /**
+     * Deal out the tiles in @a order to @a numThreads queues, most
+     * expensive first
+     */
+    void deal(std::vector<int> order, int numThreads);
+
+    bool popFront(WorkQueue& queue, int& tile);
+    bool popBack(WorkQueue& queue, int& tile);
+
+    int tileSize_;
+    Camera const* camera_; ///< camera the tiles were created for
+    int height_; ///< height of the sensor the tiles were created for
+    int width_;  ///< width of the sensor the tiles were created for
+
+    std::vector<Tile> tiles_;
+
+    std::unique_ptr<WorkQueue[]> queues_;
+    int numQueues_;
+
+    int dealt_; ///< tiles dealt out for the current pass
+    int completed_; ///< tiles completed in the current pass
+};
+
+#endif // _TILE_SCHEDULER_H_
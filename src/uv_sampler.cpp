@@ -0,0 +1,163 @@
+#include "uv_sampler.h"
+#include "iterator/stratified_iterator.hpp"
+
+#include <cmath>
+
+namespace {
+
+    const double uint32ToUnit = 1.0 / 4294967296.0;
+
+    inline std::uint32_t reverseBits(std::uint32_t x) {
+        x = (x << 16) | (x >> 16);
+        x = ((x & 0x00ff00ff) << 8) | ((x & 0xff00ff00) >> 8);
+        x = ((x & 0x0f0f0f0f) << 4) | ((x & 0xf0f0f0f0) >> 4);
+        x = ((x & 0x33333333) << 2) | ((x & 0xcccccccc) >> 2);
+        x = ((x & 0x55555555) << 1) | ((x & 0xaaaaaaaa) >> 1);
+        return x;
+    }
+
+    // second dimension of the Sobol sequence. (The first one is just the
+    // base 2 radical inverse, i.e. the reversed bits of the index)
+    inline std::uint32_t sobolSecond(std::uint32_t index) {
+        std::uint32_t result = 0;
+        for (std::uint32_t v = 1u << 31; index; index >>= 1, v ^= v >> 1) {
+            if (index & 1) {
+                result ^= v;
+            }
+        }
+        return result;
+    }
+
+    // Owen scrambling: randomly permutes the digits of x, where the
+    // permutation of each digit depends on all the digits before it.
+    inline std::uint32_t owenScramble(std::uint32_t x, std::uint32_t seed) {
+        return reverseBits(qnd::laineKarrasPermutation(reverseBits(x), seed));
+    }
+
+    inline double radicalInverse3(std::uint32_t index) {
+        double result = 0.0;
+        double digitValue = 1.0 / 3.0;
+        while (index) {
+            result += (index % 3) * digitValue;
+            index /= 3;
+            digitValue /= 3.0;
+        }
+        return result;
+    }
+
+    // shift a point of [0,1) around the unit interval
+    inline double rotate(double x, std::uint32_t shift) {
+        x += shift * uint32ToUnit;
+        return x < 1.0 ? x : x - 1.0;
+    }
+
+}
+
+bool sampleSequenceFromName(std::string const& name, SampleSequence& sequence) {
+    if (name.compare("stratified") == 0) {
+        sequence = Sequence_Stratified;
+    }
+    else if (name.compare("sobol") == 0) {
+        sequence = Sequence_Sobol;
+    }
+    else if (name.compare("halton") == 0) {
+        sequence = Sequence_Halton;
+    }
+    else if (name.compare("r2") == 0) {
+        sequence = Sequence_R2;
+    }
+    else {
+        return false;
+    }
+
+    return true;
+}
+
+/***************************************************************************
+ *                               uv_iterator                               *
+ ***************************************************************************/
+
+uv_iterator::uv_iterator(int index, int n, SampleSequence sequence,
+                         std::uint32_t const scramble[2], qnd::Rng& rng)
+    : index_(index),
+      strata_(qnd::closestSquareRoot(n)),
+      sequence_(sequence),
+      rng_(&rng) {
+    scramble_[0] = scramble[0];
+    scramble_[1] = scramble[1];
+}
+
+uv_sample uv_iterator::dereference() const {
+    const std::uint32_t index = index_;
+
+    switch (sequence_) {
+    case Sequence_Sobol: {
+        uv_sample result = { { owenScramble(reverseBits(index), scramble_[0]) * uint32ToUnit,
+                               owenScramble(sobolSecond(index), scramble_[1]) * uint32ToUnit } };
+        return result;
+    }
+    case Sequence_Halton: {
+        uv_sample result = { { rotate(reverseBits(index) * uint32ToUnit, scramble_[0]),
+                               rotate(radicalInverse3(index), scramble_[1]) } };
+        return result;
+    }
+    case Sequence_R2: {
+        // 1/g and 1/g^2, where g is the plastic number
+        const double alpha1 = 0.7548776662466927;
+        const double alpha2 = 0.5698402909980532;
+
+        double x = index * alpha1;
+        double y = index * alpha2;
+        uv_sample result = { { rotate(x - std::floor(x), scramble_[0]),
+                               rotate(y - std::floor(y), scramble_[1]) } };
+        return result;
+    }
+    case Sequence_Stratified:
+    default: {
+        // further passes over the grid are jittered anew
+        int cell = index_ % (strata_*strata_);
+        int i = cell / strata_;
+        int j = cell % strata_;
+        uv_sample result = { { (double(i) + rng_->uniform()) / strata_,
+                               (double(j) + rng_->uniform()) / strata_ } };
+        return result;
+    }
+    }
+}
+
+/***************************************************************************
+ *                                UVSampler                                *
+ ***************************************************************************/
+
+UVSampler::UVSampler(int iterations, SampleSequence sequence)
+    : n_(iterations),
+      sequence_(sequence) {
+
+    // the grid of stratified samples has to be square
+    if (sequence_ == Sequence_Stratified) {
+        n_ = qnd::stratified_iterator< qnd::uniform_generator<1> >::round(iterations);
+    }
+}
+
+UVSampler::range::range(UVSampler const& sampler, qnd::Rng& rng)
+    : n_(sampler.n()),
+      sequence_(sampler.sequence()),
+      rng_(&rng) {
+
+    // stratified samples draw their random numbers as they go
+    if (sequence_ == Sequence_Stratified) {
+        scramble_[0] = scramble_[1] = 0;
+    }
+    else {
+        scramble_[0] = rng.next();
+        scramble_[1] = rng.next();
+    }
+}
+
+uv_iterator UVSampler::range::begin() const {
+    return uv_iterator(0, n_, sequence_, scramble_, *rng_);
+}
+
+uv_iterator UVSampler::range::end() const {
+    return uv_iterator(n_, n_, sequence_, scramble_, *rng_);
+}
@@ -1,11 +1,124 @@
 #ifndef _UV_SAMPLER_H_
 #define _UV_SAMPLER_H_
 
-#include "iterator/generator_iterator.hpp"
-#include "iterator/stratified_iterator.hpp"
-#include "threadrand.h"
+#include "rng.h"
 
-typedef qnd::stratified_iterator<qnd::uniform_generator<1> > uv_iterator;
-typedef qnd::generator_iterator_builder<uv_iterator> UVSampler;
+#include <boost/iterator/iterator_facade.hpp>
+#include <boost/array.hpp>
+#include <cstdint>
+#include <string>
+
+/**
+ * Point sets a UVSampler can take its samples from
+ */
+enum SampleSequence {
+    Sequence_Stratified, ///< jittered grid, the count is rounded down to a perfect square
+    Sequence_Sobol,      ///< Sobol points with Owen scrambling
+    Sequence_Halton,     ///< Halton points in bases 2 and 3, randomly shifted
+    Sequence_R2          ///< Roberts' R2 sequence, randomly shifted
+};
+
+/**
+ * Find the sequence called @a name in scene files
+ * ("stratified", "sobol", "halton" or "r2").
+ *
+ * @return false if there is no such sequence.
+ */
+bool sampleSequenceFromName(std::string const& name, SampleSequence& sequence);
+
+typedef boost::array<double, 2> uv_sample;
+
+/**
+ * Iterates over the points of a randomized sample sequence in [0,1]x[0,1].
+ *
+ * The randomization of the low discrepancy sequences is fixed by the
+ * @a scramble values for the whole iteration. Stratified samples are
+ * jittered with numbers from @a rng as they are visited instead.
+ */
+class uv_iterator :
+        public boost::iterator_facade< uv_iterator,
+                                       uv_sample const,
+                                       boost::forward_traversal_tag,
+                                       uv_sample const> {
+
+public:
+    uv_iterator(int index, int n, SampleSequence sequence,
+                std::uint32_t const scramble[2], qnd::Rng& rng);
+
+private:
+    friend class boost::iterator_core_access;
+
+    void increment() { ++index_; }
+
+    bool equal(uv_iterator const& other) const {
+        return index_ == other.index_;
+    }
+
+    uv_sample dereference() const;
+
+    int index_;
+    int strata_; ///< number of strata along each side, for stratified samples
+    SampleSequence sequence_;
+    std::uint32_t scramble_[2];
+    qnd::Rng* rng_;
+};
+
+/**
+ * Takes a fixed number of samples from [0,1]x[0,1], from one of
+ * several sequences chosen at runtime.
+ *
+ * Once given a random number generator, can be iterated over like a
+ * container. Every iteration is randomized independently, so repeated
+ * iterations give different (but equally well distributed) points.
+ *
+ * Usage:
+ *   for (auto const& sample : sampler(rng)) { ... }
+ */
+class UVSampler {
+
+public:
+    typedef uv_iterator const_iterator;
+    typedef const_iterator iterator;
+
+    /**
+     * A single iteration over the samples, with its randomization
+     */
+    class range {
+    public:
+        range(UVSampler const& sampler, qnd::Rng& rng);
+
+        uv_iterator begin() const;
+        uv_iterator end() const;
+
+    private:
+        int n_;
+        SampleSequence sequence_;
+        std::uint32_t scramble_[2];
+        qnd::Rng* rng_;
+    };
+
+    UVSampler(int iterations, SampleSequence sequence = Sequence_Stratified);
+
+    /**
+     * Number of samples in an iteration. May be less than requested,
+     * if the sequence needs a particular count.
+     */
+    int n() const {
+        return n_;
+    }
+
+    SampleSequence sequence() const {
+        return sequence_;
+    }
+
+    range operator()(qnd::Rng& rng) const {
+        return range(*this, rng);
+    }
+
+private:
+    int n_;
+    SampleSequence sequence_;
+
+};
 
 #endif // _UV_SAMPLER_H_
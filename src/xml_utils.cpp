@@ -115,10 +115,26 @@ bool SceneXmlParser::parseSettings( TiXmlElement* settingsElement) {
         {
             if(!parseOutputSettings(pChild)) return false;
         }
-        else IF_CHILD_IS("bounces")
+        else IF_CHILD_IS("samples")
         {
             if(!parseSamples(pChild)) return false;
         }
+        else IF_CHILD_IS("tiles")
+        {
+            if(!parseTiles(pChild)) return false;
+        }
+        else IF_CHILD_IS("integrator")
+        {
+            if(!parseIntegrator(pChild)) return false;
+        }
+        else IF_CHILD_IS("random")
+        {
+            if(!parseRandom(pChild)) return false;
+        }
+        else IF_CHILD_IS("adaptive")
+        {
+            if(!parseAdaptive(pChild)) return false;
+        }
 	}
 
     return true;
@@ -165,13 +181,130 @@ bool SceneXmlParser::parseBounces( TiXmlElement* bouncesElement) {
 
 bool SceneXmlParser::parseSamples( TiXmlElement* samplesElement) {
 
+    SampleSequence sequence = Sequence_Stratified;
+    if(!parseSampleSequence(samplesElement, sequence)) return false;
+
     int val;
     if ( TIXML_SUCCESS == samplesElement->QueryValueAttribute("light", &val) ) {
-        raytracer_.setLightSamples(val);
+        raytracer_.setLightSamples(val, sequence);
     }
 
     if ( TIXML_SUCCESS == samplesElement->QueryValueAttribute("diffuse", &val) ) {
-        raytracer_.setDiffuseSamples(val);
+        raytracer_.setDiffuseSamples(val, sequence);
+    }
+
+    return true;
+}
+
+bool SceneXmlParser::parseSampleSequence( TiXmlElement* samplesElement,
+                                          SampleSequence& sequence ) {
+
+    std::string text;
+    if ( TIXML_SUCCESS == samplesElement->QueryValueAttribute("sequence", &text) ) {
+        if (!sampleSequenceFromName(text, sequence)) {
+            std::cerr << "Unknown sample sequence: " << text << std::endl;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool SceneXmlParser::parseIntegrator( TiXmlElement* integratorElement) {
+
+    std::string text;
+    if ( TIXML_SUCCESS == integratorElement->QueryValueAttribute("type", &text) ) {
+        if (text.compare("path") == 0) {
+            raytracer_.setIntegrator(Integrator_Path);
+        }
+        else if (text.compare("classic") == 0) {
+            raytracer_.setIntegrator(Integrator_Classic);
+        }
+        else {
+            std::cerr << "Unknown integrator type: " << text << std::endl;
+            return false;
+        }
+    }
+
+    text.clear();
+    if ( TIXML_SUCCESS == integratorElement->QueryValueAttribute("stochasticSpecular", &text) ) {
+        raytracer_.setStochasticSpecular(text.compare("true") == 0);
+    }
+
+    text.clear();
+    if ( TIXML_SUCCESS == integratorElement->QueryValueAttribute("lightTree", &text) ) {
+        raytracer_.setLightTree(text.compare("true") == 0);
+    }
+
+    text.clear();
+    if ( TIXML_SUCCESS == integratorElement->QueryValueAttribute("wavefront", &text) ) {
+        raytracer_.setWavefront(text.compare("true") == 0);
+    }
+
+    int val;
+    if ( TIXML_SUCCESS == integratorElement->QueryValueAttribute("rouletteDepth", &val) ) {
+        if (val < 0) {
+            std::cerr << "Roulette depth must not be negative." << std::endl;
+            return false;
+        }
+        raytracer_.setRouletteDepth(val);
+    }
+
+    return true;
+}
+
+bool SceneXmlParser::parseRandom( TiXmlElement* randomElement) {
+
+    std::uint64_t seed;
+    if ( TIXML_SUCCESS == randomElement->QueryValueAttribute("seed", &seed) ) {
+        raytracer_.setSeed(seed);
+    }
+
+    return true;
+}
+
+bool SceneXmlParser::parseTiles( TiXmlElement* tilesElement) {
+
+    int val;
+    if ( TIXML_SUCCESS == tilesElement->QueryValueAttribute("size", &val) ) {
+        if (val <= 0) {
+            std::cerr << "Tile size must be positive." << std::endl;
+            return false;
+        }
+        raytracer_.setTileSize(val);
+    }
+
+    std::string text;
+    if ( TIXML_SUCCESS == tilesElement->QueryValueAttribute("report", &text) ) {
+        if (text.compare("true") == 0) {
+            raytracer_.tileReport = true;
+        }
+    }
+
+    return true;
+}
+
+bool SceneXmlParser::parseAdaptive( TiXmlElement* adaptiveElement) {
+
+    double threshold;
+    if ( TIXML_SUCCESS != adaptiveElement->QueryValueAttribute("threshold", &threshold)
+         || threshold <= 0 ) {
+        std::cerr << "Adaptive sampling needs a positive error threshold." << std::endl;
+        return false;
+    }
+
+    int maxPasses = 16;
+    if ( TIXML_SUCCESS == adaptiveElement->QueryValueAttribute("maxPasses", &maxPasses)
+         && maxPasses <= 0 ) {
+        std::cerr << "Maximum number of passes must be positive." << std::endl;
+        return false;
+    }
+
+    raytracer_.setAdaptive(threshold, maxPasses);
+
+    double timeLimit;
+    if ( TIXML_SUCCESS == adaptiveElement->QueryValueAttribute("timeLimit", &timeLimit) ) {
+        raytracer_.setTimeLimit(timeLimit);
     }
 
     return true;
@@ -223,6 +356,20 @@ bool SceneXmlParser::parseMesh( TiXmlElement* meshElement) {
         }
     }
 
+    if ( TIXML_SUCCESS == meshElement->QueryValueAttribute("kdBuilder", &text) ) {
+        if (text.compare("sah") == 0) {
+            obj->kdBuildMethod = KDBuild_SurfaceArea;
+        }
+        else if (text.compare("fom") == 0) {
+            obj->kdBuildMethod = KDBuild_FigureOfMerit;
+        }
+        else {
+            std::cerr << "Unknown kd tree builder \"" << text
+                      << "\" for mesh \"" << name << "\"." << std::endl;
+            return false;
+        }
+    }
+
 
     // read mesh from disk
     if (!ObjParser::parse(path, *obj) ) {
@@ -565,13 +712,21 @@ bool SceneXmlParser::parseCamera( TiXmlElement* cameraElement ) {
 bool SceneXmlParser::parseCameraSamples( TiXmlElement* samplesElement,
                                 std::shared_ptr<Camera> const& camera ) {
 
+    SampleSequence sequence = Sequence_Stratified;
+    if(!parseSampleSequence(samplesElement, sequence)) return false;
+
     int val;
     if ( TIXML_SUCCESS == samplesElement->QueryValueAttribute("aperture", &val) ) {
-        camera->setApertureSamples(val);
+        camera->setApertureSamples(val, sequence);
     }
 
     if ( TIXML_SUCCESS == samplesElement->QueryValueAttribute("antialias", &val) ) {
-        camera->setAntialiasSamples(val);
+        camera->setAntialiasSamples(val, sequence);
+    }
+
+    // a flat budget of samples per pixel, replacing the nested loops
+    if ( TIXML_SUCCESS == samplesElement->QueryValueAttribute("spp", &val) ) {
+        camera->setPixelSamples(val, sequence);
     }
 
     return true;
@@ -9,6 +9,7 @@
 
 #include "texture/texture.h"
 #include "texture/bmp_image.h"
+#include "uv_sampler.h"
 
 class Raytracer;
 class Scene;
@@ -44,6 +45,11 @@ private:
     bool parseOutputSettings( TiXmlElement* outputElement);
     bool parseBounces( TiXmlElement* bouncesElement);
     bool parseSamples( TiXmlElement* samplesElement);
+    bool parseSampleSequence( TiXmlElement* samplesElement, SampleSequence& sequence );
+    bool parseTiles( TiXmlElement* tilesElement);
+    bool parseIntegrator( TiXmlElement* integratorElement);
+    bool parseRandom( TiXmlElement* randomElement);
+    bool parseAdaptive( TiXmlElement* adaptiveElement);
 
     // Meshes
     bool parseMeshes( TiXmlElement* meshesElement);